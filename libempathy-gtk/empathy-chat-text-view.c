@@ -72,6 +72,8 @@ typedef struct {
 	GSettings            *gsettings_chat;
 	EmpathySmileyManager *smiley_manager;
 	gboolean              only_if_date;
+	/* EmpathyStringSpan, reused for each body */
+	GArray               *spans;
 } EmpathyChatTextViewPriv;
 
 static void chat_text_view_iface_init (EmpathyChatViewIface *iface);
@@ -571,6 +573,7 @@ chat_text_view_finalize (GObject *object)
 		g_source_remove (priv->scroll_timeout);
 	}
 	g_object_unref (priv->smiley_manager);
+	g_array_unref (priv->spans);
 
 	G_OBJECT_CLASS (empathy_chat_text_view_parent_class)->finalize (object);
 }
@@ -627,6 +630,7 @@ empathy_chat_text_view_init (EmpathyChatTextView *view)
 	priv->last_timestamp = 0;
 	priv->allow_scrolling = TRUE;
 	priv->smiley_manager = empathy_smiley_manager_dup_singleton ();
+	priv->spans = g_array_new (FALSE, FALSE, sizeof (EmpathyStringSpan));
 
 	g_object_set (view,
 		      "wrap-mode", GTK_WRAP_WORD_CHAR,
@@ -1343,89 +1347,55 @@ empathy_chat_text_view_set_only_if_date (EmpathyChatTextView *view,
 	}
 }
 
-static void
-chat_text_view_replace_link (const gchar *text,
-			     gssize len,
-			     gpointer match_data,
-			     gpointer user_data)
-{
-	GtkTextBuffer *buffer = GTK_TEXT_BUFFER (user_data);
-	GtkTextIter iter;
-
-	gtk_text_buffer_get_end_iter (buffer, &iter);
-	gtk_text_buffer_insert_with_tags_by_name (buffer, &iter,
-						  text, len,
-						  EMPATHY_CHAT_TEXT_VIEW_TAG_LINK,
-						  NULL);
-}
-
-static void
-chat_text_view_replace_smiley (const gchar *text,
-			       gssize len,
-			       gpointer match_data,
-			       gpointer user_data)
-{
-	EmpathySmileyHit *hit = match_data;
-	GtkTextBuffer *buffer = GTK_TEXT_BUFFER (user_data);
-	GtkTextIter iter;
-
-	gtk_text_buffer_get_end_iter (buffer, &iter);
-	gtk_text_buffer_insert_pixbuf (buffer, &iter, hit->pixbuf);
-}
-
-static void
-chat_text_view_replace_verbatim (const gchar *text,
-				 gssize len,
-				 gpointer match_data,
-				 gpointer user_data)
-{
-	GtkTextBuffer *buffer = GTK_TEXT_BUFFER (user_data);
-	GtkTextIter iter;
-
-	gtk_text_buffer_get_end_iter (buffer, &iter);
-	gtk_text_buffer_insert (buffer, &iter, text, len);
-}
-
-static EmpathyStringParser string_parsers[] = {
-	{empathy_string_match_link, chat_text_view_replace_link},
-	{empathy_string_match_all, chat_text_view_replace_verbatim},
-	{NULL, NULL}
-};
-
-static EmpathyStringParser string_parsers_with_smiley[] = {
-	{empathy_string_match_link, chat_text_view_replace_link},
-	{empathy_string_match_smiley, chat_text_view_replace_smiley},
-	{empathy_string_match_all, chat_text_view_replace_verbatim},
-	{NULL, NULL}
-};
-
 void
 empathy_chat_text_view_append_body (EmpathyChatTextView *view,
 				    const gchar         *body,
 				    const gchar         *tag)
 {
 	EmpathyChatTextViewPriv *priv = GET_PRIV (view);
-	EmpathyStringParser     *parsers;
 	gboolean                 use_smileys;
 	GtkTextIter              start_iter;
 	GtkTextIter              iter;
 	GtkTextMark             *mark;
+	guint                    i;
 
 	/* Check if we have to parse smileys */
 	use_smileys = g_settings_get_boolean (priv->gsettings_chat,
 			EMPATHY_PREFS_CHAT_SHOW_SMILEYS);
 
-	if (use_smileys)
-		parsers = string_parsers_with_smiley;
-	else
-		parsers = string_parsers;
-
 	/* Create a mark at the place we'll start inserting */
 	gtk_text_buffer_get_end_iter (priv->buffer, &start_iter);
 	mark = gtk_text_buffer_create_mark (priv->buffer, NULL, &start_iter, TRUE);
 
 	/* Parse text for links/smileys and insert in the buffer */
-	empathy_string_parser_substr (body, -1, parsers, priv->buffer);
+	g_array_set_size (priv->spans, 0);
+	empathy_string_tokenize (body, -1, use_smileys, priv->spans);
+
+	for (i = 0; i < priv->spans->len; i++) {
+		EmpathyStringSpan *span;
+
+		span = &g_array_index (priv->spans, EmpathyStringSpan, i);
+		gtk_text_buffer_get_end_iter (priv->buffer, &iter);
+
+		switch (span->type) {
+		case EMPATHY_STRING_SPAN_LINK:
+			gtk_text_buffer_insert_with_tags_by_name (priv->buffer,
+				&iter, body + span->start,
+				span->end - span->start,
+				EMPATHY_CHAT_TEXT_VIEW_TAG_LINK, NULL);
+			break;
+		case EMPATHY_STRING_SPAN_SMILEY:
+			gtk_text_buffer_insert_pixbuf (priv->buffer, &iter,
+						       span->pixbuf);
+			break;
+		case EMPATHY_STRING_SPAN_TEXT:
+		default:
+			gtk_text_buffer_insert (priv->buffer, &iter,
+						body + span->start,
+						span->end - span->start);
+			break;
+		}
+	}
 
 	/* Insert a newline after the text inserted */
 	gtk_text_buffer_get_end_iter (priv->buffer, &iter);
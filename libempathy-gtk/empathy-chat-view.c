@@ -253,3 +253,25 @@ empathy_chat_view_message_acknowledged (EmpathyChatView *view,
 	}
 }
 
+
+/* Messages appended between begin_batch() and end_batch() may be held
+ * back by the view and displayed all at once when the batch ends. */
+void
+empathy_chat_view_begin_batch (EmpathyChatView *view)
+{
+	g_return_if_fail (EMPATHY_IS_CHAT_VIEW (view));
+
+	if (EMPATHY_TYPE_CHAT_VIEW_GET_IFACE (view)->begin_batch) {
+		EMPATHY_TYPE_CHAT_VIEW_GET_IFACE (view)->begin_batch (view);
+	}
+}
+
+void
+empathy_chat_view_end_batch (EmpathyChatView *view)
+{
+	g_return_if_fail (EMPATHY_IS_CHAT_VIEW (view));
+
+	if (EMPATHY_TYPE_CHAT_VIEW_GET_IFACE (view)->end_batch) {
+		EMPATHY_TYPE_CHAT_VIEW_GET_IFACE (view)->end_batch (view);
+	}
+}
@@ -30,7 +30,6 @@
 #include <string.h>
 #include <stdlib.h>
 
-#undef G_DISABLE_DEPRECATED /* for GCompletion */
 #include <gdk/gdkkeysyms.h>
 #include <glib/gi18n-lib.h>
 #include <gtk/gtk.h>
@@ -52,6 +51,7 @@
 #include "empathy-individual-store-channel.h"
 #include "empathy-individual-view.h"
 #include "empathy-input-text-view.h"
+#include "empathy-nick-completion.h"
 #include "empathy-search-bar.h"
 #include "empathy-theme-manager.h"
 #include "empathy-theme-adium.h"
@@ -65,6 +65,12 @@
 
 #define IS_ENTER(v) (v == GDK_KEY_Return || v == GDK_KEY_ISO_Enter || v == GDK_KEY_KP_Enter)
 #define COMPOSING_STOP_TIMEOUT 5
+/* Number of messages loaded from the logs each time the user scrolls
+ * to the top of a pruned conversation */
+#define SCROLLBACK_PAGE_SIZE 50
+/* When more contacts join or leave the room at once, a single event
+ * summarizes them (e.g. on netsplits) */
+#define MAX_MEMBERS_EVENTS 10
 
 #define GET_PRIV(obj) EMPATHY_GET_PRIV (obj, EmpathyChat)
 struct _EmpathyChatPriv {
@@ -85,7 +91,7 @@ struct _EmpathyChatPriv {
 	GList             *input_history;
 	GList             *input_history_current;
 	GList             *compositors;
-	GCompletion       *completion;
+	EmpathyNickCompletion *nick_completion;
 	guint              composing_stop_timeout_id;
 	guint              block_events_timeout_id;
 	TpHandleType       handle_type;
@@ -102,7 +108,9 @@ struct _EmpathyChatPriv {
 	gulong		   delete_range_id;
 	gulong		   notify_cursor_position_id;
 
-	/* Source func ID for update_misspelled_words () */
+	/* Source func ID for update_misspelled_words (), set while words
+	 * between the "spell-dirty-start" and "spell-dirty-end" marks have to
+	 * be checked */
 	guint              update_misspelled_words_id;
 	/* Source func ID for save_paned_pos_timeout () */
 	guint              save_paned_pos_id;
@@ -152,6 +160,10 @@ struct _EmpathyChatPriv {
 	gboolean           retrieving_backlogs;
 	gboolean           sms_channel;
 
+	/* Only log events older than this are loaded when the view asks
+	 * for the messages it pruned, see chat_load_older_messages_cb() */
+	gint64             scrollback_before;
+
 	/* we need to know whether populate-popup happened in response to
 	 * the keyboard or the mouse. We can't ask GTK for the most recent
 	 * event, because it will be a notify event. Instead we track it here */
@@ -1494,6 +1506,10 @@ chat_message_received (EmpathyChat *chat,
 		if (empathy_message_is_incoming (message)) {
 			priv->unread_messages++;
 			g_object_notify (G_OBJECT (chat), "nb-unread-messages");
+
+			/* Complete the nicks of recent speakers first */
+			empathy_nick_completion_spoke (priv->nick_completion,
+				sender);
 		}
 
 		g_signal_emit (chat, signals[NEW_MESSAGE], 0, message, pending,
@@ -1771,6 +1787,59 @@ chat_input_text_get_word_from_iter (GtkTextIter   *iter,
 	return TRUE;
 }
 
+/* Words are not checked as soon as they are typed or pasted. The range of
+ * text to check is extended instead, and update_misspelled_words () checks
+ * it in idle, SPELL_CHECK_WORDS_PER_IDLE words at a time, so long texts
+ * don't stall typing. */
+#define SPELL_CHECK_WORDS_PER_IDLE 50
+
+static void
+chat_input_spell_mark_dirty (EmpathyChat *chat,
+			     const GtkTextIter *start,
+			     const GtkTextIter *end)
+{
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+	GtkTextBuffer *buffer;
+	GtkTextIter dirty_start = *start;
+	GtkTextIter dirty_end = *end;
+	GtkTextMark *start_mark, *end_mark;
+
+	buffer = gtk_text_view_get_buffer (GTK_TEXT_VIEW (chat->input_text_view));
+	start_mark = gtk_text_buffer_get_mark (buffer, "spell-dirty-start");
+	end_mark = gtk_text_buffer_get_mark (buffer, "spell-dirty-end");
+
+	if (priv->update_misspelled_words_id != 0) {
+		GtkTextIter iter;
+
+		/* Merge with the range not checked yet */
+		gtk_text_buffer_get_iter_at_mark (buffer, &iter, start_mark);
+		if (gtk_text_iter_compare (&iter, &dirty_start) < 0)
+			dirty_start = iter;
+
+		gtk_text_buffer_get_iter_at_mark (buffer, &iter, end_mark);
+		if (gtk_text_iter_compare (&iter, &dirty_end) > 0)
+			dirty_end = iter;
+	} else {
+		priv->update_misspelled_words_id =
+			g_idle_add (update_misspelled_words, chat);
+	}
+
+	gtk_text_buffer_move_mark (buffer, start_mark, &dirty_start);
+	gtk_text_buffer_move_mark (buffer, end_mark, &dirty_end);
+}
+
+static void
+chat_input_spell_check_all (EmpathyChat *chat)
+{
+	GtkTextBuffer *buffer;
+	GtkTextIter start, end;
+
+	buffer = gtk_text_view_get_buffer (GTK_TEXT_VIEW (chat->input_text_view));
+	gtk_text_buffer_get_bounds (buffer, &start, &end);
+
+	chat_input_spell_mark_dirty (chat, &start, &end);
+}
+
 static void
 chat_input_text_buffer_insert_text_cb (GtkTextBuffer *buffer,
                                        GtkTextIter   *location,
@@ -1778,38 +1847,17 @@ chat_input_text_buffer_insert_text_cb (GtkTextBuffer *buffer,
                                        gint           len,
                                        EmpathyChat   *chat)
 {
-	GtkTextIter iter, pos;
+	GtkTextIter iter;
 
 	/* Remove all misspelled tags in the inserted text.
 	 * This happens when text is inserted within a misspelled word. */
 	gtk_text_buffer_get_iter_at_offset (buffer, &iter,
-					    gtk_text_iter_get_offset (location) - len);
+					    gtk_text_iter_get_offset (location) -
+					    g_utf8_strlen (text, len));
 	gtk_text_buffer_remove_tag_by_name (buffer, "misspelled",
 					    &iter, location);
 
-	gtk_text_buffer_get_iter_at_mark (buffer, &pos, gtk_text_buffer_get_insert (buffer));
-
-	do {
-		GtkTextIter start, end;
-		gchar *str;
-
-		if (!chat_input_text_get_word_from_iter (&iter, &start, &end))
-			continue;
-
-		str = gtk_text_buffer_get_text (buffer, &start, &end, FALSE);
-
-		if (gtk_text_iter_in_range (&pos, &start, &end) ||
-				gtk_text_iter_equal (&pos, &end) ||
-				empathy_spell_check (str)) {
-			gtk_text_buffer_remove_tag_by_name (buffer, "misspelled", &start, &end);
-		} else {
-			gtk_text_buffer_apply_tag_by_name (buffer, "misspelled", &start, &end);
-		}
-
-		g_free (str);
-
-	} while (gtk_text_iter_forward_word_end (&iter) &&
-		 gtk_text_iter_compare (&iter, location) <= 0);
+	chat_input_spell_mark_dirty (chat, &iter, location);
 }
 
 static void
@@ -1976,7 +2024,7 @@ chat_input_key_press_event_cb (GtkWidget   *widget,
 		GtkTextBuffer *buffer;
 		GtkTextIter    start, current;
 		gchar         *nick, *completed;
-		GList         *list, *completed_list;
+		GList         *completed_list;
 		gboolean       is_start_of_buffer;
 
 		buffer = gtk_text_view_get_buffer (GTK_TEXT_VIEW (EMPATHY_CHAT (chat)->input_text_view));
@@ -1989,13 +2037,9 @@ chat_input_key_press_event_cb (GtkWidget   *widget,
 		}
 		is_start_of_buffer = gtk_text_iter_is_start (&start);
 
-		list = empathy_contact_list_get_members (EMPATHY_CONTACT_LIST (priv->tp_chat));
-		g_completion_add_items (priv->completion, list);
-
 		nick = gtk_text_buffer_get_text (buffer, &start, &current, FALSE);
-		completed_list = g_completion_complete (priv->completion,
-							nick,
-							&completed);
+		completed_list = empathy_nick_completion_complete (
+			priv->nick_completion, nick, &completed);
 
 		g_free (nick);
 
@@ -2009,17 +2053,11 @@ chat_input_key_press_event_cb (GtkWidget   *widget,
 
 			len = g_list_length (completed_list);
 
-			if (len == 1) {
-				/* If we only have one hit, use that text
-				 * instead of the text in completed since the
-				 * completed text will use the typed string
-				 * which might be cased all wrong.
-				 * Fixes #120876
-				 * */
-				text = empathy_contact_get_alias (completed_list->data);
-			} else {
-				text = completed;
+			/* completed has the case of the matching nicks,
+			 * not the one of the typed string. Fixes #120876 */
+			text = completed;
 
+			if (len > 1) {
 				/* Print all hits to the scrollback view, so the
 				 * user knows what possibilities he has.
 				 * Fixes #599779
@@ -2054,10 +2092,7 @@ chat_input_key_press_event_cb (GtkWidget   *widget,
 			g_free (completed);
 		}
 
-		g_completion_clear_items (priv->completion);
-
-		g_list_foreach (list, (GFunc) g_object_unref, NULL);
-		g_list_free (list);
+		g_list_free (completed_list);
 
 		return TRUE;
 	}
@@ -2265,12 +2300,9 @@ static void
 chat_add_to_dictionary_activate_cb (GtkMenuItem     *menu_item,
 				    EmpathyChatWord *chat_word)
 {
-	EmpathyChatPriv *priv = GET_PRIV (chat_word->chat);
-
 	empathy_spell_add_to_dictionary (chat_word->code,
 					 chat_word->word);
-	priv->update_misspelled_words_id =
-		g_idle_add (update_misspelled_words, chat_word->chat);
+	chat_input_spell_check_all (chat_word->chat);
 }
 
 static GtkWidget *
@@ -2493,30 +2525,96 @@ chat_input_populate_popup_cb (GtkTextView *view,
 }
 
 
+/* What empathy_message_equal() compares */
+typedef struct {
+	gint64 timestamp;
+	gchar *body;
+} MessageKey;
+
+typedef struct {
+	EmpathyChat *chat;
+	/* Set of the MessageKey of the pending messages, built before the
+	 * logs are fetched as the filter may run in another thread */
+	GHashTable *pending;
+} BacklogData;
+
+static guint
+message_key_hash (gconstpointer key)
+{
+	const MessageKey *k = key;
+
+	return g_str_hash (k->body != NULL ? k->body : "") ^
+		g_int64_hash (&k->timestamp);
+}
+
 static gboolean
-chat_log_filter (TplEvent *event,
-		 gpointer user_data)
+message_key_equal (gconstpointer a,
+		   gconstpointer b)
+{
+	const MessageKey *k1 = a;
+	const MessageKey *k2 = b;
+
+	return k1->timestamp == k2->timestamp &&
+		!tp_strdiff (k1->body, k2->body);
+}
+
+static void
+message_key_free (MessageKey *key)
+{
+	g_free (key->body);
+	g_slice_free (MessageKey, key);
+}
+
+static BacklogData *
+backlog_data_new (EmpathyChat *chat)
 {
-	EmpathyChat *chat = user_data;
-	EmpathyMessage *message;
 	EmpathyChatPriv *priv = GET_PRIV (chat);
-	const GList *pending;
+	BacklogData *data;
+	const GList *l;
 
-	g_return_val_if_fail (TPL_IS_EVENT (event), FALSE);
-	g_return_val_if_fail (EMPATHY_IS_CHAT (chat), FALSE);
+	data = g_slice_new (BacklogData);
+	data->chat = chat;
+	data->pending = g_hash_table_new_full (message_key_hash,
+		message_key_equal, (GDestroyNotify) message_key_free, NULL);
 
-	pending = empathy_tp_chat_get_pending_messages (priv->tp_chat);
-	message = empathy_message_from_tpl_log_event (event);
+	for (l = empathy_tp_chat_get_pending_messages (priv->tp_chat);
+	     l != NULL; l = g_list_next (l)) {
+		MessageKey *key = g_slice_new (MessageKey);
 
-	for (; pending; pending = g_list_next (pending)) {
-		if (empathy_message_equal (message, pending->data)) {
-			g_object_unref (message);
-			return FALSE;
-		}
+		key->timestamp = empathy_message_get_timestamp (l->data);
+		key->body = g_strdup (empathy_message_get_body (l->data));
+		g_hash_table_insert (data->pending, key, key);
 	}
 
-	g_object_unref (message);
-	return TRUE;
+	return data;
+}
+
+static void
+backlog_data_free (BacklogData *data)
+{
+	g_hash_table_unref (data->pending);
+	g_slice_free (BacklogData, data);
+}
+
+static gboolean
+chat_log_filter (TplEvent *event,
+		 gpointer user_data)
+{
+	BacklogData *data = user_data;
+	TplTextEvent *text;
+	MessageKey key;
+
+	g_return_val_if_fail (TPL_IS_TEXT_EVENT (event), FALSE);
+
+	/* Same timestamp and body as empathy_message_from_tpl_log_event() */
+	text = TPL_TEXT_EVENT (event);
+	if (tp_str_empty (tpl_text_event_get_supersedes_token (text)))
+		key.timestamp = tpl_event_get_timestamp (event);
+	else
+		key.timestamp = tpl_text_event_get_edit_timestamp (text);
+	key.body = (gchar *) tpl_text_event_get_message (text);
+
+	return g_hash_table_lookup (data->pending, &key) == NULL;
 }
 
 
@@ -2549,10 +2647,13 @@ got_filtered_messages_cb (GObject *manager,
 {
 	GList *l;
 	GList *messages;
-	EmpathyChat *chat = EMPATHY_CHAT (user_data);
+	BacklogData *data = user_data;
+	EmpathyChat *chat = data->chat;
 	EmpathyChatPriv *priv = GET_PRIV (chat);
 	GError *error = NULL;
 
+	backlog_data_free (data);
+
 	if (!tpl_log_manager_get_filtered_events_finish (TPL_LOG_MANAGER (manager),
 		result, &messages, &error)) {
 		DEBUG ("%s. Aborting.", error->message);
@@ -2562,6 +2663,9 @@ got_filtered_messages_cb (GObject *manager,
 		goto out;
 	}
 
+	/* Display the whole backlog at once */
+	empathy_chat_view_begin_batch (chat->view);
+
 	for (l = messages; l; l = g_list_next (l)) {
 		EmpathyMessage *message;
 
@@ -2602,6 +2706,8 @@ got_filtered_messages_cb (GObject *manager,
 	}
 	g_list_free (messages);
 
+	empathy_chat_view_end_batch (chat->view);
+
 out:
 	/* in case of TPL error, skip backlog and show pending messages */
 	priv->can_show_pending = TRUE;
@@ -2621,6 +2727,7 @@ chat_add_logs (EmpathyChat *chat)
 {
 	EmpathyChatPriv *priv = GET_PRIV (chat);
 	TplEntity       *target;
+	BacklogData     *data;
 
 	if (!priv->id) {
 		return;
@@ -2635,49 +2742,101 @@ chat_add_logs (EmpathyChat *chat)
 	else
 	  target = tpl_entity_new (priv->id, TPL_ENTITY_CONTACT, NULL, NULL);
 
+	data = backlog_data_new (chat);
+
 	priv->retrieving_backlogs = TRUE;
 	tpl_log_manager_get_filtered_events_async (priv->log_manager,
 						   priv->account,
 						   target,
 						   TPL_EVENT_MASK_TEXT,
-						   5,
+						   g_settings_get_int (priv->gsettings_chat,
+							EMPATHY_PREFS_CHAT_BACKLOG_LENGTH),
 						   chat_log_filter,
-						   chat,
+						   data,
 						   got_filtered_messages_cb,
-						   (gpointer) chat);
+						   data);
 
 	g_object_unref (target);
 }
 
-static gint
-chat_contacts_completion_func (const gchar *s1,
-			       const gchar *s2,
-			       gsize        n)
+static gboolean
+chat_scrollback_filter (TplEvent *event,
+			gpointer user_data)
 {
-	gchar *tmp, *nick1, *nick2;
-	gint   ret;
+	EmpathyChatPriv *priv = GET_PRIV (user_data);
 
-	if (s1 == s2) {
-		return 0;
+	/* Edits can't be applied to messages we don't display yet, the
+	 * original text is shown instead */
+	if (TPL_IS_TEXT_EVENT (event) &&
+	    !tp_str_empty (tpl_text_event_get_supersedes_token (TPL_TEXT_EVENT (event)))) {
+		return FALSE;
 	}
-	if (!s1 || !s2) {
-		return s1 ? -1 : +1;
+
+	return tpl_event_get_timestamp (event) < priv->scrollback_before;
+}
+
+static void
+got_older_messages_cb (GObject *manager,
+		       GAsyncResult *result,
+		       gpointer user_data)
+{
+	EmpathyChat *chat = EMPATHY_CHAT (user_data);
+	GList *events = NULL;
+	GList *messages = NULL;
+	GList *l;
+	GError *error = NULL;
+
+	if (!tpl_log_manager_get_filtered_events_finish (TPL_LOG_MANAGER (manager),
+		result, &events, &error)) {
+		DEBUG ("%s. Not loading older messages.", error->message);
+		g_error_free (error);
 	}
 
-	tmp = g_utf8_normalize (s1, -1, G_NORMALIZE_DEFAULT);
-	nick1 = g_utf8_casefold (tmp, -1);
-	g_free (tmp);
+	for (l = events; l != NULL; l = g_list_next (l)) {
+		messages = g_list_prepend (messages,
+			empathy_message_from_tpl_log_event (l->data));
+		g_object_unref (l->data);
+	}
+	g_list_free (events);
+
+	messages = g_list_reverse (messages);
+	empathy_theme_adium_prepend_messages (EMPATHY_THEME_ADIUM (chat->view),
+		messages);
 
-	tmp = g_utf8_normalize (s2, -1, G_NORMALIZE_DEFAULT);
-	nick2 = g_utf8_casefold (tmp, -1);
-	g_free (tmp);
+	g_list_free_full (messages, g_object_unref);
+	g_object_unref (chat);
+}
 
-	ret = strncmp (nick1, nick2, n);
+static void
+chat_load_older_messages_cb (EmpathyThemeAdium *view,
+			     gint64 before,
+			     EmpathyChat *chat)
+{
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+	TplEntity       *target;
+
+	if (!priv->id) {
+		empathy_theme_adium_prepend_messages (view, NULL);
+		return;
+	}
+
+	if (priv->handle_type == TP_HANDLE_TYPE_ROOM)
+	  target = tpl_entity_new_from_room_id (priv->id);
+	else
+	  target = tpl_entity_new (priv->id, TPL_ENTITY_CONTACT, NULL, NULL);
 
-	g_free (nick1);
-	g_free (nick2);
+	priv->scrollback_before = before;
+	tpl_log_manager_get_filtered_events_async (priv->log_manager,
+						   priv->account,
+						   target,
+						   TPL_EVENT_MASK_TEXT,
+						   SCROLLBACK_PAGE_SIZE,
+						   chat_scrollback_filter,
+						   chat,
+						   got_older_messages_cb,
+						   g_object_ref (chat));
 
-	return ret;
+	g_object_unref (target);
 }
 
 static gchar *
@@ -2736,33 +2895,85 @@ build_part_message (guint           reason,
 	return g_string_free (s, FALSE);
 }
 
+static void
+chat_append_members_events (EmpathyChat    *chat,
+			    GPtrArray      *contacts,
+			    EmpathyContact *actor,
+			    guint           reason,
+			    const gchar    *message,
+			    gboolean        is_member)
+{
+	gchar *str;
+	guint i;
+
+	if (contacts == NULL || contacts->len == 0)
+		return;
+
+	if (contacts->len > MAX_MEMBERS_EVENTS) {
+		if (is_member) {
+			str = g_strdup_printf (ngettext (
+				"%u person has joined the room",
+				"%u people have joined the room",
+				contacts->len), contacts->len);
+		} else {
+			str = g_strdup_printf (ngettext (
+				"%u person has left the room",
+				"%u people have left the room",
+				contacts->len), contacts->len);
+		}
+
+		empathy_chat_view_append_event (chat->view, str);
+		g_free (str);
+		return;
+	}
+
+	for (i = 0; i < contacts->len; i++) {
+		const gchar *name = empathy_contact_get_alias (
+			g_ptr_array_index (contacts, i));
+
+		if (is_member) {
+			str = g_strdup_printf (_("%s has joined the room"),
+					       name);
+		} else {
+			str = build_part_message (reason, name, actor, message);
+		}
+
+		empathy_chat_view_append_event (chat->view, str);
+		g_free (str);
+	}
+}
+
 static void
 chat_members_changed_cb (EmpathyTpChat  *tp_chat,
-			 EmpathyContact *contact,
+			 GPtrArray      *added,
+			 GPtrArray      *removed,
 			 EmpathyContact *actor,
 			 guint           reason,
 			 gchar          *message,
-			 gboolean        is_member,
 			 EmpathyChat    *chat)
 {
 	EmpathyChatPriv *priv = GET_PRIV (chat);
-	const gchar *name = empathy_contact_get_alias (contact);
-	gchar *str;
+	guint i;
 
 	g_return_if_fail (TP_CHANNEL_GROUP_CHANGE_REASON_RENAMED != reason);
 
-	if (priv->block_events_timeout_id != 0)
-		return;
+	for (i = 0; removed != NULL && i < removed->len; i++) {
+		empathy_nick_completion_remove (priv->nick_completion,
+			g_ptr_array_index (removed, i));
+	}
 
-	if (is_member) {
-		str = g_strdup_printf (_("%s has joined the room"),
-				       name);
-	} else {
-		str = build_part_message (reason, name, actor, message);
+	for (i = 0; added != NULL && i < added->len; i++) {
+		empathy_nick_completion_add (priv->nick_completion,
+			g_ptr_array_index (added, i));
 	}
 
-	empathy_chat_view_append_event (chat->view, str);
-	g_free (str);
+	if (priv->block_events_timeout_id != 0)
+		return;
+
+	chat_append_members_events (chat, removed, actor, reason, message,
+				    FALSE);
+	chat_append_members_events (chat, added, actor, reason, message,
+				    TRUE);
 }
 
 static void
@@ -2777,6 +2988,9 @@ chat_member_renamed_cb (EmpathyTpChat  *tp_chat,
 
 	g_return_if_fail (TP_CHANNEL_GROUP_CHANGE_REASON_RENAMED == reason);
 
+	empathy_nick_completion_rename (priv->nick_completion,
+		old_contact, new_contact);
+
 	if (priv->block_events_timeout_id == 0) {
 		gchar *str;
 
@@ -2925,6 +3139,8 @@ chat_remote_contact_changed_cb (EmpathyChat *chat)
 	EmpathyChatPriv *priv = GET_PRIV (chat);
 
 	if (priv->remote_contact != NULL) {
+		empathy_nick_completion_remove (priv->nick_completion,
+			priv->remote_contact);
 		g_object_unref (priv->remote_contact);
 		priv->remote_contact = NULL;
 	}
@@ -2936,6 +3152,8 @@ chat_remote_contact_changed_cb (EmpathyChat *chat)
 	if (priv->remote_contact != NULL) {
 		g_object_ref (priv->remote_contact);
 		priv->handle_type = TP_HANDLE_TYPE_CONTACT;
+		empathy_nick_completion_add (priv->nick_completion,
+			priv->remote_contact);
 	}
 	else if (priv->tp_chat != NULL) {
 		tp_channel_get_handle ((TpChannel *) priv->tp_chat, &priv->handle_type);
@@ -2981,15 +3199,53 @@ update_misspelled_words (gpointer data)
 	EmpathyChat *chat = EMPATHY_CHAT (data);
 	EmpathyChatPriv *priv = GET_PRIV (chat);
 	GtkTextBuffer *buffer;
-	GtkTextIter iter;
-	gint length;
+	GtkTextMark *start_mark;
+	GtkTextIter iter, dirty_end, pos;
+	guint n_words = 0;
 
 	buffer = gtk_text_view_get_buffer (GTK_TEXT_VIEW (chat->input_text_view));
 
-	gtk_text_buffer_get_end_iter (buffer, &iter);
-	length = gtk_text_iter_get_offset (&iter);
-	chat_input_text_buffer_insert_text_cb (buffer, &iter,
-					       NULL, length, chat);
+	start_mark = gtk_text_buffer_get_mark (buffer, "spell-dirty-start");
+	gtk_text_buffer_get_iter_at_mark (buffer, &iter, start_mark);
+	gtk_text_buffer_get_iter_at_mark (buffer, &dirty_end,
+		gtk_text_buffer_get_mark (buffer, "spell-dirty-end"));
+	gtk_text_buffer_get_iter_at_mark (buffer, &pos,
+		gtk_text_buffer_get_insert (buffer));
+
+	while (TRUE) {
+		GtkTextIter start, end;
+
+		if (chat_input_text_get_word_from_iter (&iter, &start, &end)) {
+			gchar *str;
+
+			str = gtk_text_buffer_get_text (buffer, &start, &end,
+							FALSE);
+
+			/* The word being typed is checked once the cursor
+			 * leaves it */
+			if (gtk_text_iter_in_range (&pos, &start, &end) ||
+					gtk_text_iter_equal (&pos, &end) ||
+					empathy_spell_check (str)) {
+				gtk_text_buffer_remove_tag_by_name (buffer,
+					"misspelled", &start, &end);
+			} else {
+				gtk_text_buffer_apply_tag_by_name (buffer,
+					"misspelled", &start, &end);
+			}
+
+			g_free (str);
+		}
+
+		if (!gtk_text_iter_forward_word_end (&iter) ||
+		    gtk_text_iter_compare (&iter, &dirty_end) > 0)
+			break;
+
+		if (++n_words == SPELL_CHECK_WORDS_PER_IDLE) {
+			/* Check the rest next time */
+			gtk_text_buffer_move_mark (buffer, start_mark, &iter);
+			return TRUE;
+		}
+	}
 
 	priv->update_misspelled_words_id = 0;
 
@@ -3023,8 +3279,7 @@ conf_spell_checking_cb (GSettings *gsettings_chat,
 			/* Possibly changed dictionaries,
 			 * update misspelled words. Need to do so in idle
 			 * so the spell checker is updated. */
-			priv->update_misspelled_words_id =
-				g_idle_add (update_misspelled_words, chat);
+			chat_input_spell_check_all (chat);
 		}
 
 		return;
@@ -3054,11 +3309,14 @@ conf_spell_checking_cb (GSettings *gsettings_chat,
 	                                          gtk_text_buffer_get_insert (buffer));
 		gtk_text_buffer_create_mark (buffer, "previous-cursor-position",
 					     &iter, TRUE);
+		gtk_text_buffer_create_mark (buffer, "spell-dirty-start",
+					     &iter, TRUE);
+		gtk_text_buffer_create_mark (buffer, "spell-dirty-end",
+					     &iter, FALSE);
 
 		/* Mark misspelled words in the existing buffer.
 		 * Need to do so in idle so the spell checker is updated. */
-		priv->update_misspelled_words_id =
-			g_idle_add (update_misspelled_words, chat);
+		chat_input_spell_check_all (chat);
 	} else {
 		GtkTextTagTable *table;
 		GtkTextTag *tag;
@@ -3074,8 +3332,17 @@ conf_spell_checking_cb (GSettings *gsettings_chat,
 		tag = gtk_text_tag_table_lookup (table, "misspelled");
 		gtk_text_tag_table_remove (table, tag);
 
+		if (priv->update_misspelled_words_id != 0) {
+			g_source_remove (priv->update_misspelled_words_id);
+			priv->update_misspelled_words_id = 0;
+		}
+
 		gtk_text_buffer_delete_mark_by_name (buffer,
 						     "previous-cursor-position");
+		gtk_text_buffer_delete_mark_by_name (buffer,
+						     "spell-dirty-start");
+		gtk_text_buffer_delete_mark_by_name (buffer,
+						     "spell-dirty-end");
 	}
 
 	priv->spell_checking_enabled = spell_checker;
@@ -3157,6 +3424,11 @@ chat_create_ui (EmpathyChat *chat)
 	g_signal_connect (chat->view, "focus_in_event",
 			  G_CALLBACK (chat_text_view_focus_in_event_cb),
 			  chat);
+	if (EMPATHY_IS_THEME_ADIUM (chat->view)) {
+		g_signal_connect (chat->view, "load-older-messages",
+				  G_CALLBACK (chat_load_older_messages_cb),
+				  chat);
+	}
 	gtk_container_add (GTK_CONTAINER (priv->scrolled_window_chat),
 			   GTK_WIDGET (chat->view));
 	gtk_widget_show (GTK_WIDGET (chat->view));
@@ -3304,7 +3576,7 @@ chat_finalize (GObject *object)
 	g_free (priv->id);
 	g_free (priv->name);
 	g_free (priv->subject);
-	g_completion_free (priv->completion);
+	empathy_nick_completion_free (priv->nick_completion);
 
 	tp_clear_pointer (&priv->highlight_regex, g_regex_unref);
 
@@ -3528,8 +3800,7 @@ empathy_chat_init (EmpathyChat *chat)
 		g_timeout_add_seconds (1, chat_block_events_timeout_cb, chat);
 
 	/* Add nick name completion */
-	priv->completion = g_completion_new ((GCompletionFunc) empathy_contact_get_alias);
-	g_completion_set_compare (priv->completion, chat_contacts_completion_func);
+	priv->nick_completion = empathy_nick_completion_new ();
 
 	chat_create_ui (chat);
 }
@@ -3976,6 +4247,7 @@ empathy_chat_set_tp_chat (EmpathyChat   *chat,
 			  EmpathyTpChat *tp_chat)
 {
 	EmpathyChatPriv *priv = GET_PRIV (chat);
+	GList           *members, *l;
 
 	g_return_if_fail (EMPATHY_IS_CHAT (chat));
 	g_return_if_fail (EMPATHY_IS_TP_CHAT (tp_chat));
@@ -3991,6 +4263,18 @@ empathy_chat_set_tp_chat (EmpathyChat   *chat,
 	priv->tp_chat = g_object_ref (tp_chat);
 	priv->account = g_object_ref (empathy_tp_chat_get_account (priv->tp_chat));
 
+	/* Members of the previous channel may have left meanwhile */
+	empathy_nick_completion_free (priv->nick_completion);
+	priv->nick_completion = empathy_nick_completion_new ();
+
+	members = empathy_contact_list_get_members (
+		EMPATHY_CONTACT_LIST (priv->tp_chat));
+	for (l = members; l != NULL; l = l->next) {
+		empathy_nick_completion_add (priv->nick_completion, l->data);
+		g_object_unref (l->data);
+	}
+	g_list_free (members);
+
 	g_signal_connect (tp_chat, "invalidated",
 			  G_CALLBACK (chat_invalidated_cb),
 			  chat);
@@ -4006,7 +4290,7 @@ empathy_chat_set_tp_chat (EmpathyChat   *chat,
 	g_signal_connect (tp_chat, "chat-state-changed-empathy",
 			  G_CALLBACK (chat_state_changed_cb),
 			  chat);
-	g_signal_connect (tp_chat, "members-changed",
+	g_signal_connect (tp_chat, "members-changed-batch",
 			  G_CALLBACK (chat_members_changed_cb),
 			  chat);
 	g_signal_connect (tp_chat, "member-renamed",
@@ -160,7 +160,12 @@ channel_prepare_cb (GObject *source,
   members = tp_channel_group_dup_members_contacts (channel);
   if (members != NULL)
     {
+      EmpathyIndividualStore *store = EMPATHY_INDIVIDUAL_STORE (self);
+
+      empathy_individual_store_begin_bulk_load (store);
       add_members (self, members);
+      empathy_individual_store_end_bulk_load (store);
+
       g_ptr_array_unref (members);
     }
 
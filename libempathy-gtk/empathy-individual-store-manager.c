@@ -47,6 +47,9 @@
 #define DEBUG_FLAG EMPATHY_DEBUG_CONTACT
 #include <libempathy/empathy-debug.h>
 
+/* Adding at least this many individuals at once is done as a bulk load */
+#define BULK_LOAD_THRESHOLD 50
+
 struct _EmpathyIndividualStoreManagerPriv
 {
   EmpathyIndividualManager *manager;
@@ -73,6 +76,11 @@ individual_store_manager_members_changed_cb (EmpathyIndividualManager *manager,
 {
   GList *l;
   EmpathyIndividualStore *store = EMPATHY_INDIVIDUAL_STORE (self);
+  gboolean bulk_load;
+
+  bulk_load = g_list_length (added) >= BULK_LOAD_THRESHOLD;
+  if (bulk_load)
+    empathy_individual_store_begin_bulk_load (store);
 
   for (l = removed; l; l = l->next)
     {
@@ -88,6 +96,9 @@ individual_store_manager_members_changed_cb (EmpathyIndividualManager *manager,
 
       individual_store_add_individual_and_connect (store, l->data);
     }
+
+  if (bulk_load)
+    empathy_individual_store_end_bulk_load (store);
 }
 
 static void
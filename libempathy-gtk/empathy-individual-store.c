@@ -56,6 +56,10 @@
 /* Time in seconds after connecting which we wait before active users are enabled */
 #define ACTIVE_USER_WAIT_TO_ENABLE_TIME 5
 
+/* Flushing at least this many updates at once re-sorts the store only once
+ * instead of moving each updated row */
+#define UPDATES_RESORT_THRESHOLD 50
+
 struct _EmpathyIndividualStorePriv
 {
   gboolean show_avatars;
@@ -74,6 +78,11 @@ struct _EmpathyIndividualStorePriv
   /* Hash: char *groupname -> GtkTreeIter * */
   GHashTable                  *empathy_group_cache;
   gboolean show_active;
+  /* Nesting level of empathy_individual_store_begin_bulk_load() calls */
+  guint bulk_load;
+  /* Individuals whose rows have to be updated: FolksIndividual (owned) set */
+  GHashTable *pending_updates;
+  guint pending_updates_id;
 };
 
 typedef struct
@@ -92,12 +101,15 @@ enum
   PROP_SHOW_GROUPS,
   PROP_FORCE_UNGROUPED,
   PROP_IS_COMPACT,
-  PROP_SORT_CRITERIUM
+  PROP_SORT_CRITERIUM,
+  PROP_BULK_LOADING
 };
 
 /* prototypes to break cycles */
 static void individual_store_contact_update (EmpathyIndividualStore *self,
     FolksIndividual *individual);
+static void individual_store_apply_sort_criterium (
+    EmpathyIndividualStore *self);
 
 G_DEFINE_TYPE (EmpathyIndividualStore, empathy_individual_store,
     GTK_TYPE_TREE_STORE);
@@ -764,6 +776,65 @@ individual_store_contact_update (EmpathyIndividualStore *self,
   free_iters (iters);
 }
 
+static gboolean
+individual_store_flush_updates_cb (gpointer user_data)
+{
+  EmpathyIndividualStore *self = user_data;
+  GHashTable *updates;
+  GHashTableIter iter;
+  gpointer individual;
+  gboolean resort;
+
+  self->priv->pending_updates_id = 0;
+
+  /* Updating a row may queue another update */
+  updates = self->priv->pending_updates;
+  self->priv->pending_updates = g_hash_table_new_full (NULL, NULL,
+      g_object_unref, NULL);
+
+  DEBUG ("Flushing updates of %u individuals", g_hash_table_size (updates));
+
+  resort = self->priv->bulk_load == 0 &&
+      g_hash_table_size (updates) >= UPDATES_RESORT_THRESHOLD;
+  if (resort)
+    {
+      gtk_tree_sortable_set_sort_column_id (GTK_TREE_SORTABLE (self),
+          GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID, GTK_SORT_ASCENDING);
+    }
+
+  g_hash_table_iter_init (&iter, updates);
+  while (g_hash_table_iter_next (&iter, &individual, NULL))
+    individual_store_contact_update (self, individual);
+
+  if (resort)
+    individual_store_apply_sort_criterium (self);
+
+  g_hash_table_unref (updates);
+
+  return FALSE;
+}
+
+/* Presence and alias changes tend to come in bursts, e.g. when a server
+ * reconnects. Only the latest state of each individual matters, so the rows
+ * are updated all together from an idle callback. */
+static void
+individual_store_queue_update (EmpathyIndividualStore *self,
+    FolksIndividual *individual)
+{
+  if (!g_hash_table_lookup_extended (self->priv->pending_updates, individual,
+          NULL, NULL))
+    {
+      g_hash_table_insert (self->priv->pending_updates,
+          g_object_ref (individual), NULL);
+    }
+
+  if (self->priv->pending_updates_id == 0)
+    {
+      self->priv->pending_updates_id = g_idle_add (
+          individual_store_flush_updates_cb, self);
+    }
+}
+
 static void
 individual_store_individual_updated_cb (FolksIndividual *individual,
     GParamSpec *param,
@@ -772,7 +843,7 @@ individual_store_individual_updated_cb (FolksIndividual *individual,
   DEBUG ("Individual'%s' updated, checking roster is in sync...",
       folks_alias_details_get_alias (FOLKS_ALIAS_DETAILS (individual)));
 
-  individual_store_contact_update (self, individual);
+  individual_store_queue_update (self, individual);
 }
 
 static void
@@ -789,7 +860,7 @@ individual_store_contact_updated_cb (EmpathyContact *contact,
   if (individual == NULL)
     return;
 
-  individual_store_contact_update (self, individual);
+  individual_store_queue_update (self, individual);
 }
 
 static void
@@ -920,6 +991,9 @@ empathy_individual_store_disconnect_individual (EmpathyIndividualStore *self,
       (GCallback) individual_personas_changed_cb, self);
   g_signal_handlers_disconnect_by_func (individual,
       (GCallback) individual_store_favourites_changed_cb, self);
+
+  /* An update would add the individual back */
+  g_hash_table_remove (self->priv->pending_updates, individual);
 }
 
 void
@@ -954,6 +1028,13 @@ individual_store_dispose (GObject *object)
       g_source_remove (self->priv->inhibit_active);
     }
 
+  if (self->priv->pending_updates_id != 0)
+    {
+      g_source_remove (self->priv->pending_updates_id);
+      self->priv->pending_updates_id = 0;
+    }
+  g_hash_table_unref (self->priv->pending_updates);
+
   g_hash_table_unref (self->priv->status_icons);
   g_hash_table_unref (self->priv->folks_individual_cache);
   g_hash_table_unref (self->priv->empathy_group_cache);
@@ -988,6 +1069,9 @@ individual_store_get_property (GObject *object,
     case PROP_SORT_CRITERIUM:
       g_value_set_enum (value, self->priv->sort_criterium);
       break;
+    case PROP_BULK_LOADING:
+      g_value_set_boolean (value, self->priv->bulk_load > 0);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, param_id, pspec);
       break;
@@ -1081,6 +1165,14 @@ empathy_individual_store_class_init (EmpathyIndividualStoreClass *klass)
           EMPATHY_TYPE_INDIVIDUAL_STORE_SORT,
           EMPATHY_INDIVIDUAL_STORE_SORT_NAME, G_PARAM_READWRITE));
 
+  g_object_class_install_property (object_class,
+      PROP_BULK_LOADING,
+      g_param_spec_boolean ("bulk-loading",
+          "Bulk loading",
+          "Whether many individuals are being added at once, "
+          "with sorting disabled",
+          FALSE, G_PARAM_READABLE));
+
   g_type_class_add_private (object_class,
       sizeof (EmpathyIndividualStorePriv));
 }
@@ -1412,6 +1504,8 @@ empathy_individual_store_init (EmpathyIndividualStore *self)
       g_queue_free_full_iter);
   self->priv->empathy_group_cache = g_hash_table_new_full (g_str_hash,
       g_str_equal, g_free, (GDestroyNotify) gtk_tree_iter_free);
+  self->priv->pending_updates = g_hash_table_new_full (NULL, NULL,
+      g_object_unref, NULL);
   individual_store_setup (self);
 }
 
@@ -1619,15 +1713,10 @@ empathy_individual_store_get_sort_criterium (EmpathyIndividualStore *self)
   return self->priv->sort_criterium;
 }
 
-void
-empathy_individual_store_set_sort_criterium (EmpathyIndividualStore *self,
-    EmpathyIndividualStoreSort sort_criterium)
+static void
+individual_store_apply_sort_criterium (EmpathyIndividualStore *self)
 {
-  g_return_if_fail (EMPATHY_IS_INDIVIDUAL_STORE (self));
-
-  self->priv->sort_criterium = sort_criterium;
-
-  switch (sort_criterium)
+  switch (self->priv->sort_criterium)
     {
     case EMPATHY_INDIVIDUAL_STORE_SORT_STATE:
       gtk_tree_sortable_set_sort_column_id (GTK_TREE_SORTABLE (self),
@@ -1642,10 +1731,66 @@ empathy_individual_store_set_sort_criterium (EmpathyIndividualStore *self,
     default:
       g_assert_not_reached ();
     }
+}
+
+void
+empathy_individual_store_set_sort_criterium (EmpathyIndividualStore *self,
+    EmpathyIndividualStoreSort sort_criterium)
+{
+  g_return_if_fail (EMPATHY_IS_INDIVIDUAL_STORE (self));
+
+  self->priv->sort_criterium = sort_criterium;
+
+  /* The store is sorted when the bulk load ends */
+  if (self->priv->bulk_load == 0)
+    individual_store_apply_sort_criterium (self);
 
   g_object_notify (G_OBJECT (self), "sort-criterium");
 }
 
+gboolean
+empathy_individual_store_is_bulk_loading (EmpathyIndividualStore *self)
+{
+  g_return_val_if_fail (EMPATHY_IS_INDIVIDUAL_STORE (self), FALSE);
+
+  return self->priv->bulk_load > 0;
+}
+
+/* Between these calls rows are inserted unsorted, and views are expected to
+ * detach from the store (see the "bulk-loading" property). The whole store
+ * is then sorted once, instead of re-sorting it after each insertion. */
+void
+empathy_individual_store_begin_bulk_load (EmpathyIndividualStore *self)
+{
+  g_return_if_fail (EMPATHY_IS_INDIVIDUAL_STORE (self));
+
+  if (self->priv->bulk_load++ > 0)
+    return;
+
+  DEBUG ("Starting bulk load");
+
+  gtk_tree_sortable_set_sort_column_id (GTK_TREE_SORTABLE (self),
+      GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID, GTK_SORT_ASCENDING);
+
+  g_object_notify (G_OBJECT (self), "bulk-loading");
+}
+
+void
+empathy_individual_store_end_bulk_load (EmpathyIndividualStore *self)
+{
+  g_return_if_fail (EMPATHY_IS_INDIVIDUAL_STORE (self));
+  g_return_if_fail (self->priv->bulk_load > 0);
+
+  if (--self->priv->bulk_load > 0)
+    return;
+
+  DEBUG ("Bulk load finished, sorting");
+
+  individual_store_apply_sort_criterium (self);
+
+  g_object_notify (G_OBJECT (self), "bulk-loading");
+}
+
 gboolean
 empathy_individual_store_row_separator_func (GtkTreeModel *model,
     GtkTreeIter *iter,
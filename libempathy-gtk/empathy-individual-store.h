@@ -131,6 +131,9 @@ void empathy_individual_store_set_sort_criterium (
     EmpathyIndividualStore *store,
     EmpathyIndividualStoreSort sort_criterium);
 
+gboolean empathy_individual_store_is_bulk_loading (
+    EmpathyIndividualStore *store);
+
 gboolean empathy_individual_store_row_separator_func (GtkTreeModel *model,
     GtkTreeIter *iter,
     gpointer data);
@@ -166,5 +169,9 @@ void empathy_individual_store_add_individual (EmpathyIndividualStore *self,
 void empathy_individual_store_refresh_individual (EmpathyIndividualStore *self,
     FolksIndividual *individual);
 
+void empathy_individual_store_begin_bulk_load (EmpathyIndividualStore *self);
+
+void empathy_individual_store_end_bulk_load (EmpathyIndividualStore *self);
+
 G_END_DECLS
 #endif /* __EMPATHY_INDIVIDUAL_STORE_H__ */
@@ -78,6 +78,20 @@ typedef struct
   GtkTreeModelFilter *filter;
   GtkWidget *search_widget;
 
+  /* Text of the live search that search_results applies to */
+  gchar *search_text;
+  /* owned FolksIndividual -> bool (whether it matches search_text) */
+  GHashTable *search_results;
+
+  /* The visibilities computed since the last refilter, so each row is only
+   * evaluated once by a refilter even though its group row looks at it too.
+   * Entries are dropped when their row changes.
+   * owned FolksIndividual -> VisibilityFlags */
+  GHashTable *visibility;
+  /* owned string (group name) -> bool (whether one of its individuals is
+   * visible) */
+  GHashTable *group_visibility;
+
   guint expand_groups_idle_handler;
   /* owned string (group name) -> bool (whether to expand/contract) */
   GHashTable *expand_groups;
@@ -92,6 +106,16 @@ typedef struct
   gpointer custom_filter_data;
 } EmpathyIndividualViewPriv;
 
+typedef enum
+{
+  /* Visible in a regular group */
+  VISIBILITY_VISIBLE = 1 << 0,
+  /* Visible in the fake favorite group */
+  VISIBILITY_FAVORITE = 1 << 1,
+  /* Computed while searching */
+  VISIBILITY_SEARCHING = 1 << 2,
+} VisibilityFlags;
+
 typedef struct
 {
   EmpathyIndividualView *view;
@@ -160,6 +184,11 @@ static guint signals[LAST_SIGNAL];
 G_DEFINE_TYPE (EmpathyIndividualView, empathy_individual_view,
     GTK_TYPE_TREE_VIEW);
 
+static void individual_view_store_bulk_loading_cb (
+    EmpathyIndividualStore *store,
+    GParamSpec *pspec,
+    EmpathyIndividualView *self);
+
 static void
 individual_view_tooltip_destroy_cb (GtkWidget *widget,
     EmpathyIndividualView *view)
@@ -1349,7 +1378,7 @@ individual_view_search_text_notify_cb (EmpathyLiveSearch *search,
   GtkTreeIter iter;
   gboolean set_cursor = FALSE;
 
-  gtk_tree_model_filter_refilter (priv->filter);
+  empathy_individual_view_refilter (view);
 
   /* Set cursor on the first contact. If it is already set on a group,
    * set it on its first child contact. Note that first child of a group
@@ -1643,30 +1672,175 @@ individual_view_row_has_child_toggled_cb (GtkTreeModel *model,
 }
 
 static gboolean
-individual_view_is_visible_individual (EmpathyIndividualView *self,
+search_result_is_match (gpointer key,
+    gpointer value,
+    gpointer user_data)
+{
+  return GPOINTER_TO_INT (value);
+}
+
+/* Whether @individual matches the text of the live search. Results are
+ * remembered until the text changes. If the user only appended to the text,
+ * individuals which did not match before can't match now, so only the
+ * previous matches are tested again; everything is re-tested when text is
+ * deleted. */
+static gboolean
+individual_view_individual_matches_search (EmpathyIndividualView *self,
+    FolksIndividual *individual)
+{
+  EmpathyIndividualViewPriv *priv = GET_PRIV (self);
+  EmpathyLiveSearch *live = EMPATHY_LIVE_SEARCH (priv->search_widget);
+  const gchar *text;
+  gpointer result;
+  gboolean match;
+
+  text = empathy_live_search_get_text (live);
+
+  if (tp_strdiff (text, priv->search_text))
+    {
+      if (!EMP_STR_EMPTY (priv->search_text) &&
+          g_str_has_prefix (text, priv->search_text))
+        g_hash_table_foreach_remove (priv->search_results,
+            search_result_is_match, NULL);
+      else
+        g_hash_table_remove_all (priv->search_results);
+
+      g_free (priv->search_text);
+      priv->search_text = g_strdup (text);
+    }
+
+  if (g_hash_table_lookup_extended (priv->search_results, individual, NULL,
+        &result))
+    return GPOINTER_TO_INT (result);
+
+  match = empathy_individual_match_string (individual, text,
+      empathy_live_search_get_words (live));
+
+  g_hash_table_insert (priv->search_results, g_object_ref (individual),
+      GINT_TO_POINTER (match));
+
+  return match;
+}
+
+static gchar *
+get_group (GtkTreeModel *model,
+    GtkTreeIter *iter,
+    gboolean *is_fake)
+{
+  GtkTreeIter parent_iter;
+  gchar *name = NULL;
+
+  *is_fake = FALSE;
+
+  if (!gtk_tree_model_iter_parent (model, &parent_iter, iter))
+    return NULL;
+
+  gtk_tree_model_get (model, &parent_iter,
+      EMPATHY_INDIVIDUAL_STORE_COL_NAME, &name,
+      EMPATHY_INDIVIDUAL_STORE_COL_IS_FAKE_GROUP, is_fake,
+      -1);
+
+  return name;
+}
+
+static void
+individual_view_store_row_changed_cb (GtkTreeModel *model,
+    GtkTreePath *path,
+    GtkTreeIter *iter,
+    EmpathyIndividualView *self)
+{
+  EmpathyIndividualViewPriv *priv = GET_PRIV (self);
+  FolksIndividual *individual;
+  gboolean is_group, is_fake;
+  gchar *name;
+
+  gtk_tree_model_get (model, iter,
+      EMPATHY_INDIVIDUAL_STORE_COL_INDIVIDUAL, &individual,
+      EMPATHY_INDIVIDUAL_STORE_COL_IS_GROUP, &is_group,
+      -1);
+
+  if (individual == NULL)
+    {
+      if (is_group)
+        {
+          gtk_tree_model_get (model, iter,
+              EMPATHY_INDIVIDUAL_STORE_COL_NAME, &name,
+              -1);
+
+          if (name != NULL)
+            g_hash_table_remove (priv->group_visibility, name);
+
+          g_free (name);
+        }
+
+      return;
+    }
+
+  /* Its alias, personas or presence may have changed, test it again next
+   * time, as well as the group it is in. This handler is connected before
+   * the filter's one so the row is re-filtered with up to date results. */
+  g_hash_table_remove (priv->search_results, individual);
+  g_hash_table_remove (priv->visibility, individual);
+
+  name = get_group (model, iter, &is_fake);
+  if (name != NULL)
+    g_hash_table_remove (priv->group_visibility, name);
+
+  g_free (name);
+  g_object_unref (individual);
+}
+
+static void
+individual_view_store_row_deleted_cb (GtkTreeModel *model,
+    GtkTreePath *path,
+    EmpathyIndividualView *self)
+{
+  EmpathyIndividualViewPriv *priv = GET_PRIV (self);
+  GtkTreePath *parent_path;
+  GtkTreeIter parent_iter;
+
+  /* The group may have lost its last visible individual */
+  parent_path = gtk_tree_path_copy (path);
+
+  if (gtk_tree_path_up (parent_path) &&
+      gtk_tree_path_get_depth (parent_path) > 0 &&
+      gtk_tree_model_get_iter (model, &parent_iter, parent_path))
+    {
+      gchar *name;
+
+      gtk_tree_model_get (model, &parent_iter,
+          EMPATHY_INDIVIDUAL_STORE_COL_NAME, &name,
+          -1);
+
+      if (name != NULL)
+        g_hash_table_remove (priv->group_visibility, name);
+
+      g_free (name);
+    }
+
+  gtk_tree_path_free (parent_path);
+}
+
+static VisibilityFlags
+individual_view_compute_visibility (EmpathyIndividualView *self,
     FolksIndividual *individual,
     gboolean is_online,
-    gboolean is_searching,
-    const gchar *group,
-    gboolean is_fake_group,
-    guint event_count)
+    gboolean is_searching)
 {
   EmpathyIndividualViewPriv *priv = GET_PRIV (self);
-  EmpathyLiveSearch *live = EMPATHY_LIVE_SEARCH (priv->search_widget);
+  VisibilityFlags flags = 0;
   GeeSet *personas;
   GeeIterator *iter;
-  gboolean is_favorite;
 
-  /* Always display individuals having pending events */
-  if (event_count > 0)
-    return TRUE;
+  if (is_searching)
+    flags |= VISIBILITY_SEARCHING;
 
   /* We're only giving the visibility wrt filtering here, not things like
    * presence. */
   if (!priv->show_untrusted &&
       folks_individual_get_trust_level (individual) == FOLKS_TRUST_LEVEL_NONE)
     {
-      return FALSE;
+      return flags;
     }
 
   if (!priv->show_uninteresting)
@@ -1689,46 +1863,132 @@ individual_view_is_visible_individual (EmpathyIndividualView *self,
       g_clear_object (&iter);
 
       if (!contains_interesting_persona)
-        return FALSE;
+        return flags;
     }
 
-  is_favorite = folks_favourite_details_get_is_favourite (
-      FOLKS_FAVOURITE_DETAILS (individual));
   if (!is_searching) {
-    if (is_favorite && is_fake_group &&
-        !tp_strdiff (group, EMPATHY_INDIVIDUAL_STORE_FAVORITE))
-        /* Always display favorite contacts in the favorite group */
-        return TRUE;
+    /* Always display favorite contacts in the favorite group */
+    if (folks_favourite_details_get_is_favourite (
+          FOLKS_FAVOURITE_DETAILS (individual)))
+      flags |= VISIBILITY_FAVORITE;
 
-    return (priv->show_offline || is_online);
+    if (priv->show_offline || is_online)
+      flags |= VISIBILITY_VISIBLE | VISIBILITY_FAVORITE;
+
+    return flags;
   }
 
-  return empathy_individual_match_string (individual,
-      empathy_live_search_get_text (live),
-      empathy_live_search_get_words (live));
+  if (individual_view_individual_matches_search (self, individual))
+    flags |= VISIBILITY_VISIBLE | VISIBILITY_FAVORITE;
+
+  return flags;
 }
 
-static gchar *
-get_group (GtkTreeModel *model,
+static gboolean
+individual_view_is_visible_individual (EmpathyIndividualView *self,
+    GtkTreeModel *model,
     GtkTreeIter *iter,
-    gboolean *is_fake)
+    FolksIndividual *individual,
+    gboolean is_online,
+    gboolean is_searching,
+    guint event_count)
 {
-  GtkTreeIter parent_iter;
-  gchar *name = NULL;
+  EmpathyIndividualViewPriv *priv = GET_PRIV (self);
+  VisibilityFlags flags;
+  gpointer cached;
+  gchar *group;
+  gboolean is_fake_group, visible;
 
-  *is_fake = FALSE;
+  /* Always display individuals having pending events */
+  if (event_count > 0)
+    return TRUE;
 
-  if (!gtk_tree_model_iter_parent (model, &parent_iter, iter))
-    return NULL;
+  if (g_hash_table_lookup_extended (priv->visibility, individual, NULL,
+        &cached) &&
+      (GPOINTER_TO_UINT (cached) & VISIBILITY_SEARCHING) ==
+        (is_searching ? VISIBILITY_SEARCHING : 0))
+    {
+      flags = GPOINTER_TO_UINT (cached);
+    }
+  else
+    {
+      flags = individual_view_compute_visibility (self, individual,
+          is_online, is_searching);
+      g_hash_table_insert (priv->visibility, g_object_ref (individual),
+          GUINT_TO_POINTER (flags));
+    }
 
-  gtk_tree_model_get (model, &parent_iter,
+  if ((flags & VISIBILITY_VISIBLE) != 0)
+    return TRUE;
+
+  if ((flags & VISIBILITY_FAVORITE) == 0)
+    return FALSE;
+
+  /* Only look at the group of the few individuals it matters for */
+  group = get_group (model, iter, &is_fake_group);
+  visible = is_fake_group &&
+      !tp_strdiff (group, EMPATHY_INDIVIDUAL_STORE_FAVORITE);
+  g_free (group);
+
+  return visible;
+}
+
+static gboolean
+individual_view_is_visible_group (EmpathyIndividualView *self,
+    GtkTreeModel *model,
+    GtkTreeIter *iter,
+    gboolean is_searching)
+{
+  EmpathyIndividualViewPriv *priv = GET_PRIV (self);
+  GtkTreeIter child_iter;
+  gboolean valid, visible = FALSE;
+  gpointer cached;
+  gchar *name;
+
+  gtk_tree_model_get (model, iter,
       EMPATHY_INDIVIDUAL_STORE_COL_NAME, &name,
-      EMPATHY_INDIVIDUAL_STORE_COL_IS_FAKE_GROUP, is_fake,
       -1);
 
-  return name;
-}
+  if (name != NULL &&
+      g_hash_table_lookup_extended (priv->group_visibility, name, NULL,
+        &cached))
+    {
+      g_free (name);
+      return GPOINTER_TO_INT (cached);
+    }
+
+  /* only show groups which are not empty. The visibilities of the
+   * individuals are kept, so they are not computed again when their own
+   * row is filtered. */
+  for (valid = gtk_tree_model_iter_children (model, &child_iter, iter);
+       valid && !visible; valid = gtk_tree_model_iter_next (model, &child_iter))
+    {
+      FolksIndividual *individual;
+      gboolean is_online;
+      guint event_count;
 
+      gtk_tree_model_get (model, &child_iter,
+        EMPATHY_INDIVIDUAL_STORE_COL_INDIVIDUAL, &individual,
+        EMPATHY_INDIVIDUAL_STORE_COL_IS_ONLINE, &is_online,
+        EMPATHY_INDIVIDUAL_STORE_COL_EVENT_COUNT, &event_count,
+        -1);
+
+      if (individual == NULL)
+        continue;
+
+      /* show group if it has at least one visible contact in it */
+      visible = individual_view_is_visible_individual (self, model,
+          &child_iter, individual, is_online, is_searching, event_count);
+
+      g_object_unref (individual);
+    }
+
+  if (name != NULL)
+    g_hash_table_insert (priv->group_visibility, name,
+        GINT_TO_POINTER (visible));
+
+  return visible;
+}
 
 static gboolean
 individual_view_filter_visible_func (GtkTreeModel *model,
@@ -1738,8 +1998,7 @@ individual_view_filter_visible_func (GtkTreeModel *model,
   EmpathyIndividualView *self = EMPATHY_INDIVIDUAL_VIEW (user_data);
   EmpathyIndividualViewPriv *priv = GET_PRIV (self);
   FolksIndividual *individual = NULL;
-  gboolean is_group, is_separator, valid;
-  GtkTreeIter child_iter;
+  gboolean is_group, is_separator;
   gboolean visible, is_online;
   gboolean is_searching = TRUE;
   guint event_count;
@@ -1761,16 +2020,10 @@ individual_view_filter_visible_func (GtkTreeModel *model,
 
   if (individual != NULL)
     {
-      gchar *group;
-      gboolean is_fake_group;
-
-      group = get_group (model, iter, &is_fake_group);
-
-      visible = individual_view_is_visible_individual (self, individual,
-          is_online, is_searching, group, is_fake_group, event_count);
+      visible = individual_view_is_visible_individual (self, model, iter,
+          individual, is_online, is_searching, event_count);
 
       g_object_unref (individual);
-      g_free (group);
 
       return visible;
     }
@@ -1781,36 +2034,7 @@ individual_view_filter_visible_func (GtkTreeModel *model,
   /* Not a contact, not a separator, must be a group */
   g_return_val_if_fail (is_group, FALSE);
 
-  /* only show groups which are not empty */
-  for (valid = gtk_tree_model_iter_children (model, &child_iter, iter);
-       valid; valid = gtk_tree_model_iter_next (model, &child_iter))
-    {
-      gchar *group;
-      gboolean is_fake_group;
-
-      gtk_tree_model_get (model, &child_iter,
-        EMPATHY_INDIVIDUAL_STORE_COL_INDIVIDUAL, &individual,
-        EMPATHY_INDIVIDUAL_STORE_COL_IS_ONLINE, &is_online,
-        EMPATHY_INDIVIDUAL_STORE_COL_EVENT_COUNT, &event_count,
-        -1);
-
-      if (individual == NULL)
-        continue;
-
-      group = get_group (model, &child_iter, &is_fake_group);
-
-      visible = individual_view_is_visible_individual (self, individual,
-          is_online, is_searching, group, is_fake_group, event_count);
-
-      g_object_unref (individual);
-      g_free (group);
-
-      /* show group if it has at least one visible contact in it */
-      if (visible)
-        return TRUE;
-    }
-
-  return FALSE;
+  return individual_view_is_visible_group (self, model, iter, is_searching);
 }
 
 static void
@@ -1982,6 +2206,16 @@ individual_view_dispose (GObject *object)
   EmpathyIndividualView *view = EMPATHY_INDIVIDUAL_VIEW (object);
   EmpathyIndividualViewPriv *priv = GET_PRIV (view);
 
+  if (priv->store != NULL)
+    {
+      g_signal_handlers_disconnect_by_func (priv->store,
+          individual_view_store_row_changed_cb, view);
+      g_signal_handlers_disconnect_by_func (priv->store,
+          individual_view_store_row_deleted_cb, view);
+      g_signal_handlers_disconnect_by_func (priv->store,
+          individual_view_store_bulk_loading_cb, view);
+    }
+
   tp_clear_object (&priv->store);
   tp_clear_object (&priv->filter);
   tp_clear_object (&priv->tooltip_widget);
@@ -1999,6 +2233,10 @@ individual_view_finalize (GObject *object)
   if (priv->expand_groups_idle_handler != 0)
     g_source_remove (priv->expand_groups_idle_handler);
   g_hash_table_unref (priv->expand_groups);
+  g_hash_table_unref (priv->search_results);
+  g_hash_table_unref (priv->visibility);
+  g_hash_table_unref (priv->group_visibility);
+  g_free (priv->search_text);
 
   G_OBJECT_CLASS (empathy_individual_view_parent_class)->finalize (object);
 }
@@ -2183,6 +2421,12 @@ empathy_individual_view_init (EmpathyIndividualView *view)
 
   priv->expand_groups = g_hash_table_new_full (g_str_hash, g_str_equal,
       (GDestroyNotify) g_free, NULL);
+  priv->search_results = g_hash_table_new_full (NULL, NULL,
+      g_object_unref, NULL);
+  priv->visibility = g_hash_table_new_full (NULL, NULL,
+      g_object_unref, NULL);
+  priv->group_visibility = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, NULL);
 
   gtk_tree_view_set_row_separator_func (GTK_TREE_VIEW (view),
       empathy_individual_store_row_separator_func, NULL, NULL);
@@ -2701,7 +2945,7 @@ empathy_individual_view_set_show_offline (EmpathyIndividualView *self,
   priv->show_offline = show_offline;
 
   g_object_notify (G_OBJECT (self), "show-offline");
-  gtk_tree_model_filter_refilter (priv->filter);
+  empathy_individual_view_refilter (self);
 }
 
 gboolean
@@ -2725,7 +2969,7 @@ empathy_individual_view_set_show_untrusted (EmpathyIndividualView *self,
   priv->show_untrusted = show_untrusted;
 
   g_object_notify (G_OBJECT (self), "show-untrusted");
-  gtk_tree_model_filter_refilter (priv->filter);
+  empathy_individual_view_refilter (self);
 }
 
 EmpathyIndividualStore *
@@ -2736,6 +2980,81 @@ empathy_individual_view_get_store (EmpathyIndividualView *self)
   return GET_PRIV (self)->store;
 }
 
+static void
+individual_view_create_filter (EmpathyIndividualView *self)
+{
+  EmpathyIndividualViewPriv *priv = GET_PRIV (self);
+
+  priv->filter = GTK_TREE_MODEL_FILTER (gtk_tree_model_filter_new (
+      GTK_TREE_MODEL (priv->store), NULL));
+  gtk_tree_model_filter_set_visible_func (priv->filter,
+      individual_view_filter_visible_func, self, NULL);
+
+  g_signal_connect (priv->filter, "row-has-child-toggled",
+      G_CALLBACK (individual_view_row_has_child_toggled_cb), self);
+
+  gtk_tree_view_set_model (GTK_TREE_VIEW (self),
+      GTK_TREE_MODEL (priv->filter));
+}
+
+static void
+individual_view_destroy_filter (EmpathyIndividualView *self)
+{
+  EmpathyIndividualViewPriv *priv = GET_PRIV (self);
+
+  if (priv->filter == NULL)
+    return;
+
+  g_signal_handlers_disconnect_by_func (priv->filter,
+      individual_view_row_has_child_toggled_cb, self);
+
+  gtk_tree_view_set_model (GTK_TREE_VIEW (self), NULL);
+  tp_clear_object (&priv->filter);
+}
+
+static void
+individual_view_store_bulk_loading_cb (EmpathyIndividualStore *store,
+    GParamSpec *pspec,
+    EmpathyIndividualView *self)
+{
+  EmpathyIndividualViewPriv *priv = GET_PRIV (self);
+  GtkTreeModel *model;
+  GtkTreeIter iter;
+  gboolean valid;
+
+  /* Don't let the view nor the filter follow each row insertion and
+   * re-sort: the filter is built again once the store is complete */
+  if (empathy_individual_store_is_bulk_loading (store))
+    {
+      individual_view_destroy_filter (self);
+      return;
+    }
+
+  if (priv->filter != NULL)
+    return;
+
+  g_hash_table_remove_all (priv->visibility);
+  g_hash_table_remove_all (priv->group_visibility);
+
+  individual_view_create_filter (self);
+  model = GTK_TREE_MODEL (priv->filter);
+
+  /* Setting the model again collapsed all the groups */
+  for (valid = gtk_tree_model_get_iter_first (model, &iter);
+       valid;
+       valid = gtk_tree_model_iter_next (model, &iter))
+    {
+      GtkTreePath *path;
+
+      if (!gtk_tree_model_iter_has_child (model, &iter))
+        continue;
+
+      path = gtk_tree_model_get_path (model, &iter);
+      individual_view_row_has_child_toggled_cb (model, path, &iter, self);
+      gtk_tree_path_free (path);
+    }
+}
+
 void
 empathy_individual_view_set_store (EmpathyIndividualView *self,
     EmpathyIndividualStore *store)
@@ -2748,15 +3067,22 @@ empathy_individual_view_set_store (EmpathyIndividualView *self,
   priv = GET_PRIV (self);
 
   /* Destroy the old filter and remove the old store */
+  individual_view_destroy_filter (self);
+
   if (priv->store != NULL)
     {
-      g_signal_handlers_disconnect_by_func (priv->filter,
-          individual_view_row_has_child_toggled_cb, self);
-
-      gtk_tree_view_set_model (GTK_TREE_VIEW (self), NULL);
+      g_signal_handlers_disconnect_by_func (priv->store,
+          individual_view_store_row_changed_cb, self);
+      g_signal_handlers_disconnect_by_func (priv->store,
+          individual_view_store_row_deleted_cb, self);
+      g_signal_handlers_disconnect_by_func (priv->store,
+          individual_view_store_bulk_loading_cb, self);
     }
 
-  tp_clear_object (&priv->filter);
+  g_hash_table_remove_all (priv->search_results);
+  g_hash_table_remove_all (priv->visibility);
+  g_hash_table_remove_all (priv->group_visibility);
+
   tp_clear_object (&priv->store);
 
   /* Set the new store */
@@ -2766,16 +3092,20 @@ empathy_individual_view_set_store (EmpathyIndividualView *self,
     {
       g_object_ref (store);
 
-      /* Create a new filter */
-      priv->filter = GTK_TREE_MODEL_FILTER (gtk_tree_model_filter_new (
-          GTK_TREE_MODEL (priv->store), NULL));
-      gtk_tree_model_filter_set_visible_func (priv->filter,
-          individual_view_filter_visible_func, self, NULL);
+      /* Must be connected before the filter is created so cached search
+       * results and visibilities are invalidated before the row is
+       * re-filtered */
+      g_signal_connect (priv->store, "row-changed",
+          G_CALLBACK (individual_view_store_row_changed_cb), self);
+      g_signal_connect (priv->store, "row-deleted",
+          G_CALLBACK (individual_view_store_row_deleted_cb), self);
+
+      g_signal_connect (priv->store, "notify::bulk-loading",
+          G_CALLBACK (individual_view_store_bulk_loading_cb), self);
 
-      g_signal_connect (priv->filter, "row-has-child-toggled",
-          G_CALLBACK (individual_view_row_has_child_toggled_cb), self);
-      gtk_tree_view_set_model (GTK_TREE_VIEW (self),
-          GTK_TREE_MODEL (priv->filter));
+      /* Create a new filter, unless the store is being filled */
+      if (!empathy_individual_store_is_bulk_loading (priv->store))
+        individual_view_create_filter (self);
     }
 }
 
@@ -2809,7 +3139,14 @@ empathy_individual_view_refilter (EmpathyIndividualView *self)
 {
   EmpathyIndividualViewPriv *priv = GET_PRIV (self);
 
-  gtk_tree_model_filter_refilter (priv->filter);
+  /* The visibilities are computed again, once per row */
+  g_hash_table_remove_all (priv->visibility);
+  g_hash_table_remove_all (priv->group_visibility);
+
+  /* There is no filter during a bulk load, it is built from scratch once
+   * it's done */
+  if (priv->filter != NULL)
+    gtk_tree_model_filter_refilter (priv->filter);
 }
 
 void
@@ -2818,9 +3155,10 @@ empathy_individual_view_select_first (EmpathyIndividualView *self)
   EmpathyIndividualViewPriv *priv = GET_PRIV (self);
   GtkTreeIter iter;
 
-  gtk_tree_model_filter_refilter (priv->filter);
+  empathy_individual_view_refilter (self);
 
-  if (gtk_tree_model_get_iter_first (GTK_TREE_MODEL (priv->filter), &iter))
+  if (priv->filter != NULL &&
+      gtk_tree_model_get_iter_first (GTK_TREE_MODEL (priv->filter), &iter))
     {
       GtkTreeSelection *selection = gtk_tree_view_get_selection (
           GTK_TREE_VIEW (self));
@@ -2842,5 +3180,5 @@ empathy_individual_view_set_show_uninteresting (EmpathyIndividualView *self,
   priv->show_uninteresting = show_uninteresting;
 
   g_object_notify (G_OBJECT (self), "show-uninteresting");
-  gtk_tree_model_filter_refilter (priv->filter);
+  empathy_individual_view_refilter (self);
 }
@@ -222,6 +222,131 @@ live_search_match_prefix (const gchar *string,
   return FALSE;
 }
 
+/**
+ * EmpathyLiveSearchKey:
+ *
+ * A pre-stripped, word-split version of a string. Matching a key against the
+ * words of a search only compares already stripped UTF-8 prefixes, so the
+ * unicode work done by stripped_char() happens once per string instead of
+ * once per keystroke.
+ **/
+struct _EmpathyLiveSearchKey
+{
+  gchar *source;
+  GPtrArray *words;
+};
+
+EmpathyLiveSearchKey *
+empathy_live_search_key_new (const gchar *string,
+    gssize len)
+{
+  EmpathyLiveSearchKey *key;
+
+  key = g_slice_new0 (EmpathyLiveSearchKey);
+  empathy_live_search_key_update (key, string, len);
+
+  return key;
+}
+
+void
+empathy_live_search_key_free (EmpathyLiveSearchKey *key)
+{
+  if (key == NULL)
+    return;
+
+  g_free (key->source);
+  if (key->words != NULL)
+    g_ptr_array_unref (key->words);
+
+  g_slice_free (EmpathyLiveSearchKey, key);
+}
+
+/**
+ * empathy_live_search_key_update:
+ * @key: a #EmpathyLiveSearchKey
+ * @string: (allow-none): the new string, must be valid UTF-8
+ * @len: the length of @string in bytes, or -1 if it is nul-terminated
+ *
+ * Make @key represent @string. The string is only stripped again if it
+ * differs from the one @key was built from.
+ *
+ * Returns: %TRUE if @key changed, %FALSE otherwise.
+ **/
+gboolean
+empathy_live_search_key_update (EmpathyLiveSearchKey *key,
+    const gchar *string,
+    gssize len)
+{
+  gchar *source;
+
+  g_return_val_if_fail (key != NULL, FALSE);
+
+  if (string == NULL)
+    {
+      len = 0;
+      string = "";
+    }
+  else if (len < 0)
+    {
+      len = strlen (string);
+    }
+
+  if (key->source != NULL && strlen (key->source) == (gsize) len &&
+      strncmp (key->source, string, len) == 0)
+    return FALSE;
+
+  source = g_strndup (string, len);
+
+  g_free (key->source);
+  key->source = source;
+
+  if (key->words != NULL)
+    g_ptr_array_unref (key->words);
+  key->words = empathy_live_search_strip_utf8_string (source);
+
+  return TRUE;
+}
+
+/**
+ * empathy_live_search_key_match:
+ * @key: a #EmpathyLiveSearchKey
+ * @words: (allow-none): the words to search, as returned by
+ *  empathy_live_search_strip_utf8_string()
+ *
+ * Same as empathy_live_search_match_words() but using the pre-stripped words
+ * of @key, so no unicode decomposition is done.
+ *
+ * Returns: %TRUE if each word of @words is the prefix of a word of @key.
+ **/
+gboolean
+empathy_live_search_key_match (EmpathyLiveSearchKey *key,
+    GPtrArray *words)
+{
+  guint i, j;
+
+  g_return_val_if_fail (key != NULL, FALSE);
+
+  if (words == NULL)
+    return TRUE;
+
+  if (key->words == NULL)
+    return FALSE;
+
+  for (i = 0; i < words->len; i++)
+    {
+      const gchar *prefix = g_ptr_array_index (words, i);
+      gboolean found = FALSE;
+
+      for (j = 0; !found && j < key->words->len; j++)
+        found = g_str_has_prefix (g_ptr_array_index (key->words, j), prefix);
+
+      if (!found)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
 gboolean
 empathy_live_search_match_words (const gchar *string,
     GPtrArray *words)
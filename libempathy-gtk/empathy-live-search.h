@@ -37,6 +37,7 @@ G_BEGIN_DECLS
 
 typedef struct _EmpathyLiveSearch      EmpathyLiveSearch;
 typedef struct _EmpathyLiveSearchClass EmpathyLiveSearchClass;
+typedef struct _EmpathyLiveSearchKey   EmpathyLiveSearchKey;
 
 struct _EmpathyLiveSearch {
   GtkHBox parent;
@@ -70,6 +71,15 @@ gboolean empathy_live_search_match_words (const gchar *string,
 
 GPtrArray * empathy_live_search_get_words (EmpathyLiveSearch *self);
 
+EmpathyLiveSearchKey * empathy_live_search_key_new (const gchar *string,
+    gssize len);
+void empathy_live_search_key_free (EmpathyLiveSearchKey *key);
+gboolean empathy_live_search_key_update (EmpathyLiveSearchKey *key,
+    const gchar *string,
+    gssize len);
+gboolean empathy_live_search_key_match (EmpathyLiveSearchKey *key,
+    GPtrArray *words);
+
 /* Made public for unit tests */
 gboolean empathy_live_search_match_string (const gchar *string,
    const gchar *prefix);
@@ -48,6 +48,7 @@
 #include <libempathy/empathy-chatroom-manager.h>
 #include <libempathy/empathy-chatroom.h>
 #include <libempathy/empathy-gsettings.h>
+#include <libempathy/empathy-log-index.h>
 #include <libempathy/empathy-message.h>
 #include <libempathy/empathy-request-util.h>
 #include <libempathy/empathy-utils.h>
@@ -101,6 +102,7 @@ struct _EmpathyLogWindowPriv
 
   TplActionChain *chain;
   TplLogManager *log_manager;
+  EmpathyLogIndex *log_index;
 
   /* Hash of TpChannel<->TpAccount for use by the observer until we can
    * get a TpAccount from a TpConnection or wherever */
@@ -116,7 +118,7 @@ struct _EmpathyLogWindowPriv
   /* Used to cancel logger calls when no longer needed */
   guint count;
 
-  /* List of owned TplLogSearchHits, free with tpl_log_search_hit_free */
+  /* List of owned SearchHits, free with search_hits_free */
   GList *hits;
   guint source;
 
@@ -157,6 +159,15 @@ static void log_window_create_observer           (EmpathyLogWindow *window);
 static gboolean log_window_events_button_press_event (GtkWidget *webview,
     GdkEventButton *event, EmpathyLogWindow *self);
 static void log_window_update_buttons_sensitivity (EmpathyLogWindow *self);
+static void log_window_append_message            (TplEvent         *event,
+                                                  EmpathyMessage   *message);
+static void log_window_scroll_to_last_row        (void);
+static void log_window_who_changed_cb            (GtkTreeSelection *selection,
+                                                  EmpathyLogWindow *self);
+static gboolean model_has_entity                 (GtkTreeModel     *model,
+                                                  GtkTreePath      *path,
+                                                  GtkTreeIter      *iter,
+                                                  gpointer          data);
 
 static void
 empathy_account_chooser_filter_has_logs (TpAccount *account,
@@ -236,6 +247,49 @@ typedef enum
   EVENT_CALL_ALL      = 1 << 3,
 } EventSubtype;
 
+/* The part of TplLogSearchHit we use, so hits can come either from our
+ * log index or from the logger */
+typedef struct
+{
+  TpAccount *account;
+  TplEntity *target;
+  GDate *date;
+} SearchHit;
+
+static void
+search_hit_free (SearchHit *hit)
+{
+  g_object_unref (hit->account);
+  g_object_unref (hit->target);
+  g_date_free (hit->date);
+  g_slice_free (SearchHit, hit);
+}
+
+static void
+search_hits_free (GList *hits)
+{
+  g_list_free_full (hits, (GDestroyNotify) search_hit_free);
+}
+
+/* Events are fetched newest first, so the first page the user sees is the
+ * end of the conversation */
+static gint
+compare_dates_newest_first (gconstpointer a,
+    gconstpointer b)
+{
+  return g_date_compare (b, a);
+}
+
+static gint
+compare_hits_newest_first (gconstpointer a,
+    gconstpointer b)
+{
+  const SearchHit *hit_a = a;
+  const SearchHit *hit_b = b;
+
+  return g_date_compare (hit_b->date, hit_a->date);
+}
+
 static gboolean
 log_window_get_selected (EmpathyLogWindow *window,
     GList **accounts,
@@ -554,9 +608,11 @@ empathy_log_window_dispose (GObject *object)
 
   tp_clear_pointer (&self->priv->chain, _tpl_action_chain_free);
   tp_clear_pointer (&self->priv->channels, g_hash_table_unref);
+  tp_clear_pointer (&self->priv->hits, search_hits_free);
 
   tp_clear_object (&self->priv->observer);
   tp_clear_object (&self->priv->log_manager);
+  tp_clear_object (&self->priv->log_index);
   tp_clear_object (&self->priv->selected_account);
   tp_clear_object (&self->priv->selected_contact);
   tp_clear_object (&self->priv->events_contact);
@@ -614,6 +670,7 @@ empathy_log_window_init (EmpathyLogWindow *self)
   self->priv->camera_monitor = empathy_camera_monitor_dup_singleton ();
 
   self->priv->log_manager = tpl_log_manager_dup_singleton ();
+  self->priv->log_index = empathy_log_index_dup_singleton ();
 
   self->priv->gsettings_chat = g_settings_new (EMPATHY_PREFS_CHAT_SCHEMA);
   self->priv->gsettings_desktop = g_settings_new (
@@ -845,8 +902,10 @@ is_same_confroom (TplEvent *e1,
       tpl_entity_get_identifier (room2));
 }
 
-static void
-maybe_refresh_logs (TpChannel *channel,
+/* Returns whether what is happening now in @channel belongs to the
+ * conversations shown in the events pane */
+static gboolean
+log_window_shows_channel (TpChannel *channel,
     TpAccount *account)
 {
   GList *accounts = NULL, *entities = NULL, *dates = NULL;
@@ -862,7 +921,7 @@ maybe_refresh_logs (TpChannel *channel,
       &accounts, &entities, &anyone, &dates, &event_mask, NULL))
     {
       DEBUG ("Could not get selected rows");
-      return;
+      return FALSE;
     }
 
   type = tp_channel_get_channel_type (channel);
@@ -918,14 +977,267 @@ maybe_refresh_logs (TpChannel *channel,
   g_list_free_full (entities, g_object_unref);
   g_list_free_full (dates, (GFreeFunc) g_date_free);
 
-  if (refresh)
+  return refresh;
+}
+
+static TplEntity *
+log_window_channel_dup_target (TpChannel *channel)
+{
+  TpHandleType handle_type;
+  TpContact *contact;
+
+  tp_channel_get_handle (channel, &handle_type);
+
+  if (handle_type == TP_HANDLE_TYPE_ROOM)
+    return tpl_entity_new_from_room_id (tp_channel_get_identifier (channel));
+
+  contact = tp_channel_get_target_contact (channel);
+  if (contact != NULL)
+    return tpl_entity_new_from_tp_contact (contact, TPL_ENTITY_CONTACT);
+
+  return tpl_entity_new (tp_channel_get_identifier (channel),
+      TPL_ENTITY_CONTACT, NULL, NULL);
+}
+
+/* Add the target of @channel to the Who pane if it's the first time we
+ * talk to them */
+static void
+log_window_maybe_add_entity (TpChannel *channel,
+    TpAccount *account)
+{
+  EmpathyAccountChooser *account_chooser;
+  TpAccount *selected_account;
+  GtkTreeView *view;
+  GtkTreeModel *model;
+  GtkTreeSelection *selection;
+  GtkListStore *store;
+  GtkTreeIter iter;
+  SearchHit hit;
+  EmpathyContact *contact;
+  const gchar *name;
+  gchar *sort_key;
+
+  /* The Who pane lists the search results */
+  if (log_window->priv->hits != NULL)
+    return;
+
+  account_chooser = EMPATHY_ACCOUNT_CHOOSER (log_window->priv->account_chooser);
+  selected_account = empathy_account_chooser_get_account (account_chooser);
+  if (selected_account != NULL && !account_equal (account, selected_account))
+    return;
+
+  view = GTK_TREE_VIEW (log_window->priv->treeview_who);
+  model = gtk_tree_view_get_model (view);
+  selection = gtk_tree_view_get_selection (view);
+  store = GTK_LIST_STORE (model);
+
+  hit.account = account;
+  hit.target = log_window_channel_dup_target (channel);
+  hit.date = NULL;
+
+  has_element = FALSE;
+  gtk_tree_model_foreach (model, model_has_entity, &hit);
+  if (has_element)
+    goto out;
+
+  DEBUG ("Adding %s to the Who pane", tpl_entity_get_identifier (hit.target));
+
+  contact = empathy_contact_from_tpl_contact (account, hit.target);
+  name = empathy_contact_get_alias (contact);
+  sort_key = g_utf8_collate_key (name, -1);
+
+  g_signal_handlers_block_by_func (selection,
+      log_window_who_changed_cb, log_window);
+
+  gtk_list_store_append (store, &iter);
+  gtk_list_store_set (store, &iter,
+      COL_WHO_TYPE, COL_TYPE_NORMAL,
+      COL_WHO_ICON, tpl_entity_get_entity_type (hit.target) == TPL_ENTITY_ROOM
+                        ? EMPATHY_IMAGE_GROUP_MESSAGE
+                        : EMPATHY_IMAGE_AVATAR_DEFAULT,
+      COL_WHO_NAME, name,
+      COL_WHO_NAME_SORT_KEY, sort_key,
+      COL_WHO_ID, tpl_entity_get_identifier (hit.target),
+      COL_WHO_ACCOUNT, account,
+      COL_WHO_TARGET, hit.target,
+      -1);
+
+  g_signal_handlers_unblock_by_func (selection,
+      log_window_who_changed_cb, log_window);
+
+  g_free (sort_key);
+  g_object_unref (contact);
+
+out:
+  g_object_unref (hit.target);
+}
+
+/* Builds the event the logger will store for @message, or returns NULL if
+ * we don't know enough about its sender or receiver yet */
+static TplEvent *
+log_window_event_from_message (TpChannel *channel,
+    TpAccount *account,
+    TpMessage *message,
+    gboolean outgoing)
+{
+  TpConnection *connection = tp_channel_borrow_connection (channel);
+  TpContact *self_contact = tp_connection_get_self_contact (connection);
+  TplEntity *sender = NULL, *receiver = NULL;
+  TpHandleType handle_type;
+  TplEvent *event = NULL;
+  gint64 timestamp;
+  gchar *text;
+
+  if (self_contact == NULL)
+    return NULL;
+
+  tp_channel_get_handle (channel, &handle_type);
+
+  if (outgoing)
     {
-      DEBUG ("Refreshing logs after received event");
+      sender = tpl_entity_new_from_tp_contact (self_contact, TPL_ENTITY_SELF);
+      receiver = log_window_channel_dup_target (channel);
+    }
+  else
+    {
+      TpContact *contact = tp_signalled_message_get_sender (message);
+
+      if (contact == NULL)
+        goto out;
+
+      sender = tpl_entity_new_from_tp_contact (contact, TPL_ENTITY_CONTACT);
+
+      if (handle_type == TP_HANDLE_TYPE_ROOM)
+        receiver = log_window_channel_dup_target (channel);
+      else
+        receiver = tpl_entity_new_from_tp_contact (self_contact,
+            TPL_ENTITY_SELF);
+    }
+
+  timestamp = tp_message_get_sent_timestamp (message);
+  if (timestamp == 0)
+    timestamp = tp_message_get_received_timestamp (message);
+  if (timestamp == 0)
+    timestamp = empathy_time_get_current ();
+
+  text = tp_message_to_text (message, NULL);
+
+  event = g_object_new (TPL_TYPE_TEXT_EVENT,
+      "account", account,
+      "sender", sender,
+      "receiver", receiver,
+      "timestamp", timestamp,
+      "message-type", tp_message_get_message_type (message),
+      "message", text,
+      NULL);
+
+  g_free (text);
+
+out:
+  tp_clear_object (&sender);
+  tp_clear_object (&receiver);
+
+  return event;
+}
+
+static void
+maybe_refresh_logs (TpChannel *channel,
+    TpAccount *account)
+{
+  log_window_maybe_add_entity (channel, account);
+
+  if (log_window_shows_channel (channel, account))
+    {
+      DEBUG ("Refreshing logs after ended call");
+      log_window_chats_get_messages (log_window, FALSE);
+    }
+}
+
+static void
+log_window_append_observed_message (TpChannel *channel,
+    TpAccount *account,
+    TpMessage *message,
+    gboolean outgoing)
+{
+  TplEvent *event = NULL;
+  EmpathyMessage *msg;
+  gboolean loading;
+
+  log_window_maybe_add_entity (channel, account);
+
+  if (!log_window_shows_channel (channel, account))
+    return;
+
+  /* Search results, and the logs being fetched, already or will include
+   * the message once it's logged: reload them */
+  g_object_get (log_window->priv->spinner, "active", &loading, NULL);
 
-      /* FIXME:  We need to populate the entities in case we
-       * didn't have any previous logs with this contact. */
+  if (log_window->priv->hits == NULL && !loading)
+    event = log_window_event_from_message (channel, account, message,
+        outgoing);
+
+  if (event == NULL)
+    {
+      DEBUG ("Refreshing logs after received event");
       log_window_chats_get_messages (log_window, FALSE);
+      return;
     }
+
+  msg = empathy_message_from_tpl_log_event (event);
+  log_window_append_message (event, msg);
+  log_window_scroll_to_last_row ();
+
+  g_object_unref (msg);
+  g_object_unref (event);
+}
+
+
+static void
+log_window_index_message (EmpathyLogWindow *self,
+    TpChannel *channel,
+    TpAccount *account,
+    TpMessage *message)
+{
+  TpHandleType handle_type;
+  TpContact *contact;
+  const gchar *alias = NULL;
+  GDateTime *datetime;
+  GDate *date;
+  gint64 timestamp;
+  gchar *text;
+
+  if (account == NULL)
+    return;
+
+  tp_channel_get_handle (channel, &handle_type);
+
+  contact = tp_channel_get_target_contact (channel);
+  if (contact != NULL)
+    alias = tp_contact_get_alias (contact);
+
+  /* The logger stores the events by UTC day of their timestamp */
+  timestamp = tp_message_get_sent_timestamp (message);
+  if (timestamp == 0)
+    timestamp = tp_message_get_received_timestamp (message);
+  if (timestamp == 0)
+    timestamp = empathy_time_get_current ();
+
+  datetime = g_date_time_new_from_unix_utc (timestamp);
+  date = g_date_new_dmy (g_date_time_get_day_of_month (datetime),
+      g_date_time_get_month (datetime),
+      g_date_time_get_year (datetime));
+
+  text = tp_message_to_text (message, NULL);
+
+  empathy_log_index_add_text (self->priv->log_index,
+      tp_proxy_get_object_path (account),
+      tp_channel_get_identifier (channel),
+      handle_type == TP_HANDLE_TYPE_ROOM ? TPL_ENTITY_ROOM : TPL_ENTITY_CONTACT,
+      alias, date, text);
+
+  g_free (text);
+  g_date_free (date);
+  g_date_time_unref (datetime);
 }
 
 static void
@@ -937,7 +1249,11 @@ on_msg_sent (TpTextChannel *channel,
 {
   TpAccount *account = g_hash_table_lookup (self->priv->channels, channel);
 
-  maybe_refresh_logs (TP_CHANNEL (channel), account);
+  log_window_index_message (self, TP_CHANNEL (channel), account,
+      TP_MESSAGE (message));
+
+  log_window_append_observed_message (TP_CHANNEL (channel), account,
+      TP_MESSAGE (message), TRUE);
 }
 
 static void
@@ -953,7 +1269,10 @@ on_msg_received (TpTextChannel *channel,
       type != TP_CHANNEL_TEXT_MESSAGE_TYPE_ACTION)
     return;
 
-  maybe_refresh_logs (TP_CHANNEL (channel), account);
+  log_window_index_message (self, TP_CHANNEL (channel), account, msg);
+
+  log_window_append_observed_message (TP_CHANNEL (channel), account, msg,
+      FALSE);
 }
 
 static void
@@ -1262,7 +1581,6 @@ log_window_append_chat_message (TplEvent *event,
   GtkTreeIter iter, parent;
   gchar *pretty_date, *alias, *body;
   GDateTime *date;
-  EmpathyStringParser *parsers;
   GString *msg;
 
   date = g_date_time_new_from_unix_local (
@@ -1276,13 +1594,12 @@ log_window_append_chat_message (TplEvent *event,
       tpl_entity_get_alias (tpl_event_get_sender (event)), -1);
 
   /* escape the text */
-  parsers = empathy_webkit_get_string_parser (
-      g_settings_get_boolean (log_window->priv->gsettings_chat,
-        EMPATHY_PREFS_CHAT_SHOW_SMILEYS));
   msg = g_string_new ("");
 
-  empathy_string_parser_substr (empathy_message_get_body (message), -1,
-      parsers, msg);
+  empathy_webkit_append_body (msg, empathy_message_get_body (message),
+      empathy_message_get_token (message),
+      g_settings_get_boolean (log_window->priv->gsettings_chat,
+        EMPATHY_PREFS_CHAT_SHOW_SMILEYS));
 
   if (tpl_text_event_get_message_type (TPL_TEXT_EVENT (event))
       == TP_CHANNEL_TEXT_MESSAGE_TYPE_ACTION)
@@ -1587,7 +1904,7 @@ model_has_entity (GtkTreeModel *model,
     GtkTreeIter *iter,
     gpointer data)
 {
-  TplLogSearchHit *hit = data;
+  SearchHit *hit = data;
   TplEntity *e;
   TpAccount *a;
   gboolean ret = FALSE;
@@ -1644,7 +1961,7 @@ populate_events_from_search_hits (GList *accounts,
   TplEventTypeMask event_mask;
   EventSubtype subtype;
   GDate *anytime;
-  GList *l;
+  GList *hits, *l;
   gboolean is_anytime = FALSE;
 
   if (!log_window_get_selected (log_window,
@@ -1655,9 +1972,12 @@ populate_events_from_search_hits (GList *accounts,
   if (g_list_find_custom (dates, anytime, (GCompareFunc) g_date_compare))
     is_anytime = TRUE;
 
-  for (l = log_window->priv->hits; l != NULL; l = l->next)
+  hits = g_list_sort (g_list_copy (log_window->priv->hits),
+      compare_hits_newest_first);
+
+  for (l = hits; l != NULL; l = l->next)
     {
-      TplLogSearchHit *hit = l->data;
+      SearchHit *hit = l->data;
       GList *acc, *targ;
       gboolean found = FALSE;
 
@@ -1696,6 +2016,7 @@ populate_events_from_search_hits (GList *accounts,
   start_spinner ();
   _tpl_action_chain_start (log_window->priv->chain);
 
+  g_list_free (hits);
   g_date_free (anytime);
 }
 
@@ -1769,7 +2090,7 @@ populate_dates_from_search_hits (GList *accounts,
 
   for (l = log_window->priv->hits; l != NULL; l = l->next)
     {
-      TplLogSearchHit *hit = l->data;
+      SearchHit *hit = l->data;
       GList *acc, *targ;
       gboolean found = FALSE;
 
@@ -1860,7 +2181,7 @@ populate_entities_from_search_hits (void)
 
   for (l = log_window->priv->hits; l; l = l->next)
     {
-      TplLogSearchHit *hit = l->data;
+      SearchHit *hit = l->data;
 
       /* Protect against invalid data (corrupt or old log files). */
       if (hit->account == NULL || hit->target == NULL)
@@ -1924,38 +2245,104 @@ populate_entities_from_search_hits (void)
     gtk_tree_selection_select_iter (selection, &iter);
 }
 
+static void
+log_window_set_search_hits (EmpathyLogWindow *self,
+    GList *hits)
+{
+  GtkTreeView *view;
+  GtkTreeSelection *selection;
+
+  tp_clear_pointer (&self->priv->hits, search_hits_free);
+  self->priv->hits = hits;
+
+  view = GTK_TREE_VIEW (self->priv->treeview_when);
+  selection = gtk_tree_view_get_selection (view);
+
+  g_signal_handlers_unblock_by_func (selection,
+      log_window_when_changed_cb,
+      self);
+
+  populate_entities_from_search_hits ();
+}
+
 static void
 log_manager_searched_new_cb (GObject *manager,
     GAsyncResult *result,
     gpointer user_data)
 {
-  GList *hits;
-  GtkTreeView *view;
-  GtkTreeSelection *selection;
+  GList *tpl_hits, *hits = NULL;
+  GList *l;
   GError *error = NULL;
 
   if (log_window == NULL)
     return;
 
   if (!tpl_log_manager_search_finish (TPL_LOG_MANAGER (manager),
-      result, &hits, &error))
+      result, &tpl_hits, &error))
     {
       DEBUG ("%s. Aborting", error->message);
       g_error_free (error);
       return;
     }
 
-  tp_clear_pointer (&log_window->priv->hits, tpl_log_manager_search_free);
-  log_window->priv->hits = hits;
+  for (l = tpl_hits; l != NULL; l = l->next)
+    {
+      TplLogSearchHit *tpl_hit = l->data;
+      SearchHit *hit;
 
-  view = GTK_TREE_VIEW (log_window->priv->treeview_when);
-  selection = gtk_tree_view_get_selection (view);
+      /* Protect against invalid data (corrupt or old log files). */
+      if (tpl_hit->account == NULL || tpl_hit->target == NULL)
+        continue;
 
-  g_signal_handlers_unblock_by_func (selection,
-      log_window_when_changed_cb,
-      log_window);
+      hit = g_slice_new (SearchHit);
+      hit->account = g_object_ref (tpl_hit->account);
+      hit->target = g_object_ref (tpl_hit->target);
+      hit->date = _date_copy (tpl_hit->date);
 
-  populate_entities_from_search_hits ();
+      hits = g_list_prepend (hits, hit);
+    }
+
+  tpl_log_manager_search_free (tpl_hits);
+
+  log_window_set_search_hits (log_window, g_list_reverse (hits));
+}
+
+static GList *
+log_window_search_index (EmpathyLogWindow *self,
+    const gchar *search_criteria)
+{
+  TpAccountManager *manager;
+  GList *index_hits, *hits = NULL;
+  GList *l;
+
+  manager = tp_account_manager_dup ();
+  index_hits = empathy_log_index_search (self->priv->log_index,
+      search_criteria);
+
+  for (l = index_hits; l != NULL; l = l->next)
+    {
+      EmpathyLogIndexHit *index_hit = l->data;
+      TpAccount *account;
+      SearchHit *hit;
+
+      account = tp_account_manager_ensure_account (manager,
+          index_hit->account_path);
+      if (account == NULL)
+        continue;
+
+      hit = g_slice_new (SearchHit);
+      hit->account = g_object_ref (account);
+      hit->target = tpl_entity_new (index_hit->entity_id,
+          index_hit->entity_type, index_hit->alias, NULL);
+      hit->date = _date_copy (index_hit->date);
+
+      hits = g_list_prepend (hits, hit);
+    }
+
+  empathy_log_index_search_free (index_hits);
+  g_object_unref (manager);
+
+  return hits;
 }
 
 static void
@@ -1984,7 +2371,7 @@ log_window_find_populate (EmpathyLogWindow *self,
 
   if (EMP_STR_EMPTY (search_criteria))
     {
-      tp_clear_pointer (&self->priv->hits, tpl_log_manager_search_free);
+      tp_clear_pointer (&self->priv->hits, search_hits_free);
       webkit_web_view_set_highlight_text_matches (
           WEBKIT_WEB_VIEW (self->priv->webview), FALSE);
       log_window_who_populate (self);
@@ -1999,6 +2386,14 @@ log_window_find_populate (EmpathyLogWindow *self,
   webkit_web_view_mark_text_matches (WEBKIT_WEB_VIEW (self->priv->webview),
       search_criteria, FALSE, 0);
 
+  /* Only fall back to grepping all the logs while they're being indexed */
+  if (empathy_log_index_is_ready (self->priv->log_index))
+    {
+      log_window_set_search_hits (self,
+          log_window_search_index (self, search_criteria));
+      return;
+    }
+
   tpl_log_manager_search_async (self->priv->log_manager,
       search_criteria, TPL_EVENT_MASK_ANY,
       log_manager_searched_new_cb, NULL);
@@ -3171,13 +3566,19 @@ show_spinner (gpointer data)
 }
 
 static void
-show_events (TplActionChain *chain,
-    gpointer user_data)
+log_window_show_events_page (void)
 {
-  log_window_maybe_expand_events ();
   gtk_spinner_stop (GTK_SPINNER (log_window->priv->spinner));
   gtk_notebook_set_current_page (GTK_NOTEBOOK (log_window->priv->notebook),
       PAGE_EVENTS);
+}
+
+static void
+show_events (TplActionChain *chain,
+    gpointer user_data)
+{
+  log_window_maybe_expand_events ();
+  log_window_show_events_page ();
 
   _tpl_action_chain_continue (chain);
 }
@@ -3193,18 +3594,48 @@ start_spinner (void)
   _tpl_action_chain_append (log_window->priv->chain, show_events, NULL);
 }
 
+static void
+log_window_scroll_to_last_row (void)
+{
+  GtkTreeModel *model;
+  GtkTreeIter iter;
+  gint n;
+
+  model = GTK_TREE_MODEL (log_window->priv->store_events);
+  n = gtk_tree_model_iter_n_children (model, NULL) - 1;
+
+  if (n >= 0 && gtk_tree_model_iter_nth_child (model, &iter, NULL, n))
+    {
+      GtkTreePath *path;
+      char *str, *script;
+
+      path = gtk_tree_model_get_path (model, &iter);
+      str = gtk_tree_path_to_string (path);
+
+      script = g_strdup_printf ("javascript:scrollToRow([%s]);",
+          g_strdelimit (str, ":", ','));
+
+      webkit_web_view_execute_script (
+          WEBKIT_WEB_VIEW (log_window->priv->webview),
+          script);
+
+      gtk_tree_path_free (path);
+      g_free (str);
+      g_free (script);
+    }
+}
+
 static void
 log_window_got_messages_for_date_cb (GObject *manager,
     GAsyncResult *result,
     gpointer user_data)
 {
   Ctx *ctx = user_data;
-  GtkTreeModel *model;
-  GtkTreeIter iter;
   GList *events;
   GList *l;
+  gboolean appended = FALSE;
+  gboolean loading;
   GError *error = NULL;
-  gint n;
 
   if (log_window == NULL)
     {
@@ -3212,6 +3643,9 @@ log_window_got_messages_for_date_cb (GObject *manager,
       return;
     }
 
+  /* The selection changed since. We can't cancel logger calls, but at least
+   * don't finish and render this one, and let the chain continue with the
+   * requests of the new selection. */
   if (log_window->priv->count != ctx->count)
     goto out;
 
@@ -3272,33 +3706,21 @@ log_window_got_messages_for_date_cb (GObject *manager,
           EmpathyMessage *msg = empathy_message_from_tpl_log_event (event);
           log_window_append_message (event, msg);
           tp_clear_object (&msg);
+          appended = TRUE;
         }
 
       g_object_unref (event);
     }
   g_list_free (events);
 
-  model = GTK_TREE_MODEL (log_window->priv->store_events);
-  n = gtk_tree_model_iter_n_children (model, NULL) - 1;
-
-  if (n >= 0 && gtk_tree_model_iter_nth_child (model, &iter, NULL, n))
+  /* Don't wait for the older dates to show the newest events. Only scroll
+   * down for this first page: the user may already be reading or scrolling
+   * when the older ones are added. */
+  g_object_get (log_window->priv->spinner, "active", &loading, NULL);
+  if (appended && loading)
     {
-      GtkTreePath *path;
-      char *str, *script;
-
-      path = gtk_tree_model_get_path (model, &iter);
-      str = gtk_tree_path_to_string (path);
-
-      script = g_strdup_printf ("javascript:scrollToRow([%s]);",
-          g_strdelimit (str, ":", ','));
-
-      webkit_web_view_execute_script (
-          WEBKIT_WEB_VIEW (log_window->priv->webview),
-          script);
-
-      gtk_tree_path_free (path);
-      g_free (str);
-      g_free (script);
+      log_window_show_events_page ();
+      log_window_scroll_to_last_row ();
     }
 
  out:
@@ -3324,9 +3746,10 @@ log_window_get_messages_for_dates (EmpathyLogWindow *self,
     GList *dates)
 {
   GList *accounts, *targets, *acc, *targ, *l;
+  GList *fetched_dates = NULL;
   TplEventTypeMask event_mask;
   EventSubtype subtype;
-  GDate *date, *anytime, *separator;
+  GDate *anytime, *separator;
 
   if (!log_window_get_selected (self,
       &accounts, &targets, NULL, NULL, &event_mask, &subtype))
@@ -3338,61 +3761,56 @@ log_window_get_messages_for_dates (EmpathyLogWindow *self,
   _tpl_action_chain_clear (self->priv->chain);
   self->priv->count++;
 
-  for (acc = accounts, targ = targets;
-       acc != NULL && targ != NULL;
-       acc = acc->next, targ = targ->next)
+  if (g_list_find_custom (dates, anytime, (GCompareFunc) g_date_compare))
     {
-      TpAccount *account = acc->data;
-      TplEntity *target = targ->data;
+      GtkTreeView *view = GTK_TREE_VIEW (self->priv->treeview_when);
+      GtkTreeModel *model = gtk_tree_view_get_model (view);
+      GtkTreeIter iter;
+      gboolean next;
+      GDate *d;
 
-      for (l = dates; l != NULL; l = l->next)
+      for (next = gtk_tree_model_get_iter_first (model, &iter);
+           next;
+           next = gtk_tree_model_iter_next (model, &iter))
         {
-          date = l->data;
-
-          /* Get events */
-          if (g_date_compare (date, anytime) != 0)
-            {
-              Ctx *ctx;
+          gtk_tree_model_get (model, &iter,
+              COL_WHEN_DATE, &d,
+              -1);
 
-              ctx = ctx_new (self, account, target, date, event_mask, subtype,
-                  self->priv->count);
-              _tpl_action_chain_append (self->priv->chain, get_events_for_date, ctx);
-            }
+          if (g_date_compare (d, anytime) != 0 &&
+              g_date_compare (d, separator) != 0)
+            fetched_dates = g_list_prepend (fetched_dates, d);
           else
-            {
-              GtkTreeView *view = GTK_TREE_VIEW (self->priv->treeview_when);
-              GtkTreeModel *model = gtk_tree_view_get_model (view);
-              GtkTreeIter iter;
-              gboolean next;
-              GDate *d;
-
-              for (next = gtk_tree_model_get_iter_first (model, &iter);
-                   next;
-                   next = gtk_tree_model_iter_next (model, &iter))
-                {
-                  Ctx *ctx;
+            g_date_free (d);
+        }
+    }
+  else
+    {
+      for (l = dates; l != NULL; l = l->next)
+        fetched_dates = g_list_prepend (fetched_dates, _date_copy (l->data));
+    }
 
-                  gtk_tree_model_get (model, &iter,
-                      COL_WHEN_DATE, &d,
-                      -1);
+  fetched_dates = g_list_sort (fetched_dates, compare_dates_newest_first);
 
-                  if (g_date_compare (d, anytime) != 0 &&
-                      g_date_compare (d, separator) != 0)
-                    {
-                      ctx = ctx_new (self, account, target, d,
-                          event_mask, subtype, self->priv->count);
-                      _tpl_action_chain_append (self->priv->chain, get_events_for_date, ctx);
-                    }
+  /* Get events, one page per date */
+  for (l = fetched_dates; l != NULL; l = l->next)
+    {
+      for (acc = accounts, targ = targets;
+           acc != NULL && targ != NULL;
+           acc = acc->next, targ = targ->next)
+        {
+          Ctx *ctx;
 
-                  g_date_free (d);
-                }
-            }
+          ctx = ctx_new (self, acc->data, targ->data, l->data, event_mask,
+              subtype, self->priv->count);
+          _tpl_action_chain_append (self->priv->chain, get_events_for_date, ctx);
         }
     }
 
   start_spinner ();
   _tpl_action_chain_start (self->priv->chain);
 
+  g_list_free_full (fetched_dates, (GDestroyNotify) g_date_free);
   g_list_free_full (accounts, g_object_unref);
   g_list_free_full (targets, g_object_unref);
   g_date_free (separator);
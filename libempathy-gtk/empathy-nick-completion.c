@@ -0,0 +1,345 @@
+/*
+ * Copyright (C) 2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include "empathy-nick-completion.h"
+
+/* The members of a chat, sorted by their normalized and casefolded alias so
+ * that the nicks starting with a prefix are next to each other. It is kept
+ * up to date as members join, leave or are renamed, instead of being built
+ * again each time the user completes a nick. */
+
+typedef struct
+{
+  /* NULL for the probe used to search a prefix */
+  EmpathyContact *contact;
+  gchar *key;
+  /* The value of the serial when the contact last spoke, 0 if never */
+  guint64 last_spoke;
+  gulong alias_changed_id;
+} NickEntry;
+
+struct _EmpathyNickCompletion
+{
+  /* owned NickEntry sorted by key */
+  GSequence *entries;
+  /* borrowed EmpathyContact -> GSequenceIter */
+  GHashTable *contacts;
+  guint64 serial;
+};
+
+static gchar *
+nick_completion_dup_key (const gchar *nick)
+{
+  gchar *tmp, *key;
+
+  tmp = g_utf8_normalize (nick != NULL ? nick : "", -1, G_NORMALIZE_DEFAULT);
+  key = g_utf8_casefold (tmp, -1);
+  g_free (tmp);
+
+  return key;
+}
+
+static gint
+nick_entry_compare (gconstpointer a,
+    gconstpointer b,
+    gpointer user_data)
+{
+  const NickEntry *entry1 = a;
+  const NickEntry *entry2 = b;
+  gint ret;
+
+  ret = strcmp (entry1->key, entry2->key);
+  if (ret != 0)
+    return ret;
+
+  /* The probe goes before the entries having the same key, so searching it
+   * points to the first one */
+  if (entry1->contact == NULL)
+    return entry2->contact == NULL ? 0 : -1;
+
+  if (entry2->contact == NULL)
+    return 1;
+
+  return 0;
+}
+
+static void
+nick_entry_free (NickEntry *entry)
+{
+  g_signal_handler_disconnect (entry->contact, entry->alias_changed_id);
+  g_object_unref (entry->contact);
+  g_free (entry->key);
+  g_slice_free (NickEntry, entry);
+}
+
+static void
+nick_completion_alias_changed_cb (EmpathyContact *contact,
+    GParamSpec *pspec,
+    EmpathyNickCompletion *self)
+{
+  GSequenceIter *iter;
+  NickEntry *entry;
+
+  iter = g_hash_table_lookup (self->contacts, contact);
+  if (iter == NULL)
+    return;
+
+  entry = g_sequence_get (iter);
+  g_free (entry->key);
+  entry->key = nick_completion_dup_key (empathy_contact_get_alias (contact));
+
+  g_sequence_sort_changed (iter, nick_entry_compare, NULL);
+}
+
+EmpathyNickCompletion *
+empathy_nick_completion_new (void)
+{
+  EmpathyNickCompletion *self;
+
+  self = g_slice_new0 (EmpathyNickCompletion);
+  self->entries = g_sequence_new ((GDestroyNotify) nick_entry_free);
+  self->contacts = g_hash_table_new (NULL, NULL);
+
+  return self;
+}
+
+void
+empathy_nick_completion_free (EmpathyNickCompletion *self)
+{
+  g_return_if_fail (self != NULL);
+
+  g_hash_table_unref (self->contacts);
+  g_sequence_free (self->entries);
+  g_slice_free (EmpathyNickCompletion, self);
+}
+
+void
+empathy_nick_completion_add (EmpathyNickCompletion *self,
+    EmpathyContact *contact)
+{
+  NickEntry *entry;
+  GSequenceIter *iter;
+
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (EMPATHY_IS_CONTACT (contact));
+
+  if (g_hash_table_lookup (self->contacts, contact) != NULL)
+    return;
+
+  entry = g_slice_new0 (NickEntry);
+  entry->contact = g_object_ref (contact);
+  entry->key = nick_completion_dup_key (empathy_contact_get_alias (contact));
+  entry->alias_changed_id = g_signal_connect (contact, "notify::alias",
+      G_CALLBACK (nick_completion_alias_changed_cb), self);
+
+  iter = g_sequence_insert_sorted (self->entries, entry, nick_entry_compare,
+      NULL);
+  g_hash_table_insert (self->contacts, contact, iter);
+}
+
+void
+empathy_nick_completion_remove (EmpathyNickCompletion *self,
+    EmpathyContact *contact)
+{
+  GSequenceIter *iter;
+
+  g_return_if_fail (self != NULL);
+
+  iter = g_hash_table_lookup (self->contacts, contact);
+  if (iter == NULL)
+    return;
+
+  g_hash_table_remove (self->contacts, contact);
+  g_sequence_remove (iter);
+}
+
+/* Replaces @old_contact with @new_contact, keeping its rank */
+void
+empathy_nick_completion_rename (EmpathyNickCompletion *self,
+    EmpathyContact *old_contact,
+    EmpathyContact *new_contact)
+{
+  GSequenceIter *iter;
+  guint64 last_spoke = 0;
+
+  g_return_if_fail (self != NULL);
+
+  iter = g_hash_table_lookup (self->contacts, old_contact);
+  if (iter != NULL)
+    {
+      NickEntry *entry = g_sequence_get (iter);
+
+      last_spoke = entry->last_spoke;
+      empathy_nick_completion_remove (self, old_contact);
+    }
+
+  empathy_nick_completion_add (self, new_contact);
+
+  iter = g_hash_table_lookup (self->contacts, new_contact);
+  ((NickEntry *) g_sequence_get (iter))->last_spoke = last_spoke;
+}
+
+void
+empathy_nick_completion_spoke (EmpathyNickCompletion *self,
+    EmpathyContact *contact)
+{
+  GSequenceIter *iter;
+
+  g_return_if_fail (self != NULL);
+
+  iter = g_hash_table_lookup (self->contacts, contact);
+  if (iter == NULL)
+    return;
+
+  ((NickEntry *) g_sequence_get (iter))->last_spoke = ++self->serial;
+}
+
+/* The most recent speakers first, then in alphabetical order */
+static gint
+nick_entry_compare_rank (gconstpointer a,
+    gconstpointer b)
+{
+  const NickEntry *entry1 = a;
+  const NickEntry *entry2 = b;
+
+  if (entry1->last_spoke != entry2->last_spoke)
+    return entry1->last_spoke > entry2->last_spoke ? -1 : 1;
+
+  return strcmp (entry1->key, entry2->key);
+}
+
+/* Returns the length in bytes of the longest beginning of @alias that all
+ * the keys of @entries start with, once normalized and casefolded the same
+ * way. Keys can't be compared to the alias character by character, as
+ * normalizing and casefolding change the number of characters. */
+static gsize
+nick_completion_common_length (GList *entries,
+    const gchar *alias)
+{
+  const gchar *p;
+  gsize len = 0;
+
+  for (p = alias; *p != '\0'; p = g_utf8_next_char (p))
+    {
+      const gchar *next = g_utf8_next_char (p);
+      gchar *prefix, *key;
+      gboolean common = TRUE;
+      GList *l;
+
+      prefix = g_strndup (alias, next - alias);
+      key = nick_completion_dup_key (prefix);
+
+      for (l = entries; l != NULL && common; l = l->next)
+        {
+          const gchar *entry_key = ((NickEntry *) l->data)->key;
+
+          /* "andre" is not the beginning of "andre\xcc\x81" (é) */
+          common = g_str_has_prefix (entry_key, key) &&
+              !g_unichar_ismark (g_utf8_get_char (entry_key + strlen (key)));
+        }
+
+      g_free (key);
+      g_free (prefix);
+
+      if (!common)
+        break;
+
+      len = next - alias;
+    }
+
+  return len;
+}
+
+/**
+ * empathy_nick_completion_complete:
+ * @self: an #EmpathyNickCompletion
+ * @prefix: the beginning of a nick, as typed by the user
+ * @completed: (out): return location for the text to replace @prefix with
+ *
+ * Finds the members whose alias starts with @prefix, ignoring the case.
+ * @completed is set to the alias of the only match, or to the common
+ * beginning of all the matches, or to %NULL when there is none.
+ *
+ * Returns: a list of the matching #EmpathyContact, the most recent speakers
+ * first. Free it with g_list_free(), the contacts are not referenced.
+ */
+GList *
+empathy_nick_completion_complete (EmpathyNickCompletion *self,
+    const gchar *prefix,
+    gchar **completed)
+{
+  NickEntry probe = { NULL, };
+  GSequenceIter *iter;
+  GList *entries = NULL;
+  GList *contacts = NULL;
+  GList *l;
+
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (completed != NULL, NULL);
+
+  *completed = NULL;
+
+  probe.key = nick_completion_dup_key (prefix);
+
+  for (iter = g_sequence_search (self->entries, &probe, nick_entry_compare,
+          NULL);
+      !g_sequence_iter_is_end (iter);
+      iter = g_sequence_iter_next (iter))
+    {
+      NickEntry *entry = g_sequence_get (iter);
+
+      if (!g_str_has_prefix (entry->key, probe.key))
+        break;
+
+      entries = g_list_prepend (entries, entry);
+    }
+
+  g_free (probe.key);
+
+  if (entries == NULL)
+    return NULL;
+
+  entries = g_list_sort (entries, nick_entry_compare_rank);
+
+  if (entries->next == NULL)
+    {
+      *completed = g_strdup (empathy_contact_get_alias (
+          ((NickEntry *) entries->data)->contact));
+    }
+  else
+    {
+      const gchar *alias;
+
+      /* Keep the case of the first match */
+      alias = empathy_contact_get_alias (
+          ((NickEntry *) entries->data)->contact);
+      *completed = g_strndup (alias,
+          nick_completion_common_length (entries, alias));
+    }
+
+  for (l = entries; l != NULL; l = l->next)
+    contacts = g_list_prepend (contacts, ((NickEntry *) l->data)->contact);
+
+  g_list_free (entries);
+
+  return g_list_reverse (contacts);
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __EMPATHY_NICK_COMPLETION_H__
+#define __EMPATHY_NICK_COMPLETION_H__
+
+#include <glib.h>
+
+#include <libempathy/empathy-contact.h>
+
+G_BEGIN_DECLS
+
+typedef struct _EmpathyNickCompletion EmpathyNickCompletion;
+
+EmpathyNickCompletion *empathy_nick_completion_new (void);
+void empathy_nick_completion_free (EmpathyNickCompletion *self);
+
+void empathy_nick_completion_add (EmpathyNickCompletion *self,
+    EmpathyContact *contact);
+void empathy_nick_completion_remove (EmpathyNickCompletion *self,
+    EmpathyContact *contact);
+void empathy_nick_completion_rename (EmpathyNickCompletion *self,
+    EmpathyContact *old_contact,
+    EmpathyContact *new_contact);
+
+void empathy_nick_completion_spoke (EmpathyNickCompletion *self,
+    EmpathyContact *contact);
+
+GList *empathy_nick_completion_complete (EmpathyNickCompletion *self,
+    const gchar *prefix,
+    gchar **completed);
+
+G_END_DECLS
+
+#endif /* __EMPATHY_NICK_COMPLETION_H__ */
@@ -28,58 +28,168 @@
 #include "empathy-smiley-manager.h"
 #include "empathy-ui-utils.h"
 
-typedef struct _SmileyManagerTree SmileyManagerTree;
+/* Smileys are matched by an Aho-Corasick automaton working on the UTF-8
+ * bytes of the text. Each state has a dense transition table in which the
+ * failure links are already folded, so parsing never backtracks on a
+ * failed partial match. The automaton is built lazily from the patterns
+ * the first time a text is parsed after smileys have been added. */
+typedef struct {
+	gchar     *str;
+	GdkPixbuf *pixbuf;
+	gchar     *path;
+} SmileyManagerPattern;
+
+typedef struct {
+	guint16               next[256];
+	guint16               fail;
+	/* State of the longest pattern that is a suffix of this one, 0 if
+	 * none. The root state is never a match, so 0 is safe. */
+	guint16               output;
+	guint                 depth;
+	SmileyManagerPattern *pattern;
+} SmileyManagerState;
 
 #define GET_PRIV(obj) EMPATHY_GET_PRIV (obj, EmpathySmileyManager)
 typedef struct {
-	SmileyManagerTree *tree;
+	GPtrArray         *patterns;
+	GArray            *states;
 	GSList            *smileys;
 } EmpathySmileyManagerPriv;
 
-struct _SmileyManagerTree {
-	gunichar     c;
-	GdkPixbuf   *pixbuf;
-	gchar       *path;
-	GSList      *childrens;
-};
-
 G_DEFINE_TYPE (EmpathySmileyManager, empathy_smiley_manager, G_TYPE_OBJECT);
 
 static EmpathySmileyManager *manager_singleton = NULL;
 
-static SmileyManagerTree *
-smiley_manager_tree_new (gunichar c)
+static SmileyManagerPattern *
+smiley_manager_pattern_new (GdkPixbuf   *pixbuf,
+			    const gchar *str,
+			    const gchar *path)
 {
-	SmileyManagerTree *tree;
+	SmileyManagerPattern *pattern;
 
-	tree = g_slice_new0 (SmileyManagerTree);
-	tree->c = c;
-	tree->pixbuf = NULL;
-	tree->childrens = NULL;
-	tree->path = NULL;
+	pattern = g_slice_new0 (SmileyManagerPattern);
+	pattern->str = g_strdup (str);
+	pattern->pixbuf = g_object_ref (pixbuf);
+	pattern->path = g_strdup (path);
 
-	return tree;
+	return pattern;
 }
 
 static void
-smiley_manager_tree_free (SmileyManagerTree *tree)
+smiley_manager_pattern_free (SmileyManagerPattern *pattern)
+{
+	g_free (pattern->str);
+	g_object_unref (pattern->pixbuf);
+	g_free (pattern->path);
+	g_slice_free (SmileyManagerPattern, pattern);
+}
+
+static guint16
+smiley_manager_states_add (GArray *states,
+			   guint   depth)
+{
+	SmileyManagerState state = { { 0, }, 0, 0, depth, NULL };
+
+	g_array_append_val (states, state);
+
+	return states->len - 1;
+}
+
+static GArray *
+smiley_manager_automaton_build (GPtrArray *patterns)
 {
-	GSList *l;
+	GArray  *states;
+	guint16 *queue;
+	guint    head = 0;
+	guint    tail = 0;
+	guint    i;
+	guint    c;
+
+	states = g_array_new (FALSE, FALSE, sizeof (SmileyManagerState));
+	smiley_manager_states_add (states, 0);
+
+	/* Build the trie. In this phase next[c] == 0 means there is no
+	 * child, the root can't be anyone's child. Later patterns win over
+	 * earlier ones using the same string. */
+	for (i = 0; i < patterns->len; i++) {
+		SmileyManagerPattern *pattern = g_ptr_array_index (patterns, i);
+		const guchar         *p;
+		guint16               cur = 0;
+
+		for (p = (const guchar *) pattern->str; *p != '\0'; p++) {
+			SmileyManagerState *state;
+
+			state = &g_array_index (states, SmileyManagerState, cur);
+			if (state->next[*p] == 0) {
+				guint depth = state->depth + 1;
+				guint16 child;
+
+				if (states->len > G_MAXUINT16) {
+					g_warning ("Too many smileys, ignoring '%s'",
+						   pattern->str);
+					break;
+				}
+
+				child = smiley_manager_states_add (states, depth);
+				/* states may have been reallocated */
+				state = &g_array_index (states, SmileyManagerState, cur);
+				state->next[*p] = child;
+			}
+			cur = state->next[*p];
+		}
 
-	if (!tree) {
-		return;
+		if (*p == '\0') {
+			g_array_index (states, SmileyManagerState, cur).pattern = pattern;
+		}
 	}
 
-	for (l = tree->childrens; l; l = l->next) {
-		smiley_manager_tree_free (l->data);
+	/* Compute failure links in breadth-first order, and fold them into the
+	 * transition tables so each input byte costs exactly one lookup. */
+	queue = g_new (guint16, states->len);
+	queue[tail++] = 0;
+
+	while (head < tail) {
+		guint16             id = queue[head++];
+		SmileyManagerState *state;
+		SmileyManagerState *fail;
+
+		state = &g_array_index (states, SmileyManagerState, id);
+		fail = &g_array_index (states, SmileyManagerState, state->fail);
+
+		if (state->pattern != NULL) {
+			state->output = id;
+		} else if (id != 0) {
+			state->output = fail->output;
+		}
+
+		for (c = 0; c < 256; c++) {
+			guint16 child = state->next[c];
+
+			if (child == 0) {
+				state->next[c] = (id == 0) ? 0 : fail->next[c];
+				continue;
+			}
+
+			g_array_index (states, SmileyManagerState, child).fail =
+				(id == 0) ? 0 : fail->next[c];
+			queue[tail++] = child;
+		}
 	}
 
-	if (tree->pixbuf) {
-		g_object_unref (tree->pixbuf);
+	g_free (queue);
+
+	return states;
+}
+
+static void
+smiley_manager_automaton_invalidate (EmpathySmileyManager *manager)
+{
+	EmpathySmileyManagerPriv *priv = GET_PRIV (manager);
+
+	if (priv->states != NULL) {
+		g_array_unref (priv->states);
+		priv->states = NULL;
 	}
-	g_slist_free (tree->childrens);
-	g_free (tree->path);
-	g_slice_free (SmileyManagerTree, tree);
 }
 
 static EmpathySmiley *
@@ -107,7 +217,8 @@ smiley_manager_finalize (GObject *object)
 {
 	EmpathySmileyManagerPriv *priv = GET_PRIV (object);
 
-	smiley_manager_tree_free (priv->tree);
+	smiley_manager_automaton_invalidate (EMPATHY_SMILEY_MANAGER (object));
+	g_ptr_array_unref (priv->patterns);
 	g_slist_foreach (priv->smileys, (GFunc) smiley_free, NULL);
 	g_slist_free (priv->smileys);
 }
@@ -150,7 +261,9 @@ empathy_smiley_manager_init (EmpathySmileyManager *manager)
 		EMPATHY_TYPE_SMILEY_MANAGER, EmpathySmileyManagerPriv);
 
 	manager->priv = priv;
-	priv->tree = smiley_manager_tree_new ('\0');
+	priv->patterns = g_ptr_array_new_with_free_func (
+		(GDestroyNotify) smiley_manager_pattern_free);
+	priv->states = NULL;
 	priv->smileys = NULL;
 
 	empathy_smiley_manager_load (manager);
@@ -162,57 +275,6 @@ empathy_smiley_manager_dup_singleton (void)
 	return g_object_new (EMPATHY_TYPE_SMILEY_MANAGER, NULL);
 }
 
-static SmileyManagerTree *
-smiley_manager_tree_find_child (SmileyManagerTree *tree, gunichar c)
-{
-	GSList *l;
-
-	for (l = tree->childrens; l; l = l->next) {
-		SmileyManagerTree *child = l->data;
-
-		if (child->c == c) {
-			return child;
-		}
-	}
-
-	return NULL;
-}
-
-static SmileyManagerTree *
-smiley_manager_tree_find_or_insert_child (SmileyManagerTree *tree, gunichar c)
-{
-	SmileyManagerTree *child;
-
-	child = smiley_manager_tree_find_child (tree, c);
-
-	if (!child) {
-		child = smiley_manager_tree_new (c);
-		tree->childrens = g_slist_prepend (tree->childrens, child);
-	}
-
-	return child;
-}
-
-static void
-smiley_manager_tree_insert (SmileyManagerTree *tree,
-			    GdkPixbuf         *pixbuf,
-			    const gchar       *str,
-			    const gchar       *path)
-{
-	SmileyManagerTree *child;
-
-	child = smiley_manager_tree_find_or_insert_child (tree, g_utf8_get_char (str));
-
-	str = g_utf8_next_char (str);
-	if (*str) {
-		smiley_manager_tree_insert (child, pixbuf, str, path);
-		return;
-	}
-
-	child->pixbuf = g_object_ref (pixbuf);
-	child->path = g_strdup (path);
-}
-
 static void
 smiley_manager_add_valist (EmpathySmileyManager *manager,
 			   GdkPixbuf            *pixbuf,
@@ -225,8 +287,13 @@ smiley_manager_add_valist (EmpathySmileyManager *manager,
 	EmpathySmiley            *smiley;
 
 	for (str = first_str; str; str = va_arg (var_args, gchar*)) {
-		smiley_manager_tree_insert (priv->tree, pixbuf, str, path);
+		if (EMP_STR_EMPTY (str)) {
+			continue;
+		}
+		g_ptr_array_add (priv->patterns,
+				 smiley_manager_pattern_new (pixbuf, str, path));
 	}
+	smiley_manager_automaton_invalidate (manager);
 
 	g_object_set_data_full (G_OBJECT (pixbuf), "smiley_str",
 				g_strdup (first_str), g_free);
@@ -289,20 +356,21 @@ empathy_smiley_manager_load (EmpathySmileyManager *manager)
 	empathy_smiley_manager_add (manager, "face-worried",    ":-S",   ":S",   ":-s", ":s", NULL);
 }
 
-static EmpathySmileyHit *
-smiley_hit_new (SmileyManagerTree *tree,
-		guint              start,
-		guint              end)
+static void
+smiley_manager_emit_hit (SmileyManagerPattern *pattern,
+			 guint                 start,
+			 guint                 end,
+			 EmpathySmileyHitFunc  func,
+			 gpointer              user_data)
 {
-	EmpathySmileyHit *hit;
+	EmpathySmileyHit hit;
 
-	hit = g_slice_new (EmpathySmileyHit);
-	hit->pixbuf = tree->pixbuf;
-	hit->path = tree->path;
-	hit->start = start;
-	hit->end = end;
+	hit.pixbuf = pattern->pixbuf;
+	hit.path = pattern->path;
+	hit.start = start;
+	hit.end = end;
 
-	return hit;
+	func (&hit, user_data);
 }
 
 void
@@ -313,93 +381,112 @@ empathy_smiley_hit_free (EmpathySmileyHit *hit)
 	g_slice_free (EmpathySmileyHit, hit);
 }
 
-GSList *
-empathy_smiley_manager_parse_len (EmpathySmileyManager *manager,
-				  const gchar          *text,
-				  gssize                len)
+/* Like empathy_smiley_manager_parse_len() but calls func for each hit instead
+ * of allocating a list. The hit is only valid during the call. */
+void
+empathy_smiley_manager_foreach_hit (EmpathySmileyManager *manager,
+				    const gchar          *text,
+				    gssize                len,
+				    EmpathySmileyHitFunc  func,
+				    gpointer              user_data)
 {
 	EmpathySmileyManagerPriv *priv = GET_PRIV (manager);
-	EmpathySmileyHit         *hit;
-	GSList                   *hits = NULL;
-	SmileyManagerTree        *cur_tree = priv->tree;
-	const gchar              *cur_str;
-	const gchar              *start = NULL;
+	const SmileyManagerState *states;
+	const guchar             *str = (const guchar *) text;
+	guint16                   cur = 0;
+	guint16                   match = 0;
+	gsize                     match_start = 0;
+	gsize                     match_end = 0;
+	gsize                     i;
 
-	g_return_val_if_fail (EMPATHY_IS_SMILEY_MANAGER (manager), NULL);
-	g_return_val_if_fail (text != NULL, NULL);
+	g_return_if_fail (EMPATHY_IS_SMILEY_MANAGER (manager));
+	g_return_if_fail (text != NULL);
+	g_return_if_fail (func != NULL);
 
 	/* If len is negative, parse the string until we find '\0' */
 	if (len < 0) {
 		len = G_MAXSSIZE;
 	}
 
+	if (priv->states == NULL) {
+		priv->states = smiley_manager_automaton_build (priv->patterns);
+	}
+	states = (const SmileyManagerState *) priv->states->data;
+
 	/* Parse the len first bytes of text to find smileys. Each time a smiley
-	 * is detected, append a EmpathySmileyHit struct to the returned list,
+	 * is detected, func is called with a EmpathySmileyHit struct
 	 * containing the smiley pixbuf and the position of the text to be
 	 * replaced by it.
-	 * cur_str is a pointer in the text showing the current position
-	 * of the parsing. It is always at the begining of an UTF-8 character,
-	 * because we support unicode smileys! For example we could want to
-	 * replace ™ by an image. */
-
-	for (cur_str = text;
-	     *cur_str != '\0' && cur_str - text < len;
-	     cur_str = g_utf8_next_char (cur_str)) {
-		SmileyManagerTree *child;
-		gunichar           c;
-
-		c = g_utf8_get_char (cur_str);
-		child = smiley_manager_tree_find_child (cur_tree, c);
-
-		/* If we have a child it means c is part of a smiley */
-		if (child) {
-			if (cur_tree == priv->tree) {
-				/* c is the first char of some smileys, keep
-				 * the begining position */
-				start = cur_str;
-			}
-			cur_tree = child;
+	 *
+	 * The leftmost smiley wins, and the longest one if several start at
+	 * the same position. For example ">:)" and ":(" are both valid
+	 * smileys, when parsing text ">:(" the automaton falls back from ">:"
+	 * to ":" and finds ":(" without going back in the text.
+	 *
+	 * Once a smiley has been found we keep going while the current state
+	 * could still extend it or find one starting earlier; as soon as the
+	 * current state starts after it, the smiley is final and we resume
+	 * right after it. That rescans at most the length of a smiley, so
+	 * parsing is linear in the length of the text. Patterns are UTF-8 so
+	 * matches always start and end at character boundaries. */
+
+	for (i = 0; str[i] != '\0' && i < (gsize) len; i++) {
+		const SmileyManagerState *state;
+
+		cur = states[cur].next[str[i]];
+		state = &states[cur];
+
+		if (match != 0 && i + 1 - state->depth > match_start) {
+			smiley_manager_emit_hit (states[match].pattern,
+						 match_start, match_end,
+						 func, user_data);
+
+			i = match_end - 1;
+			cur = 0;
+			match = 0;
 			continue;
 		}
 
-		/* c is not part of a smiley. let's check if we found a smiley
-		 * before it. */
-		if (cur_tree->pixbuf != NULL) {
-			/* found! */
-			hit = smiley_hit_new (cur_tree, start - text,
-					      cur_str - text);
-			hits = g_slist_prepend (hits, hit);
-
-			/* c was not part of this smiley, check if a new smiley
-			 * start with it. */
-			cur_tree = smiley_manager_tree_find_child (priv->tree, c);
-			if (cur_tree) {
-				start = cur_str;
-			} else {
-				cur_tree = priv->tree;
+		if (state->output != 0) {
+			gsize start = i + 1 - states[state->output].depth;
+
+			if (match == 0 || start <= match_start) {
+				match = state->output;
+				match_start = start;
+				match_end = i + 1;
 			}
-		} else if (cur_tree != priv->tree) {
-			/* We searched a smiley starting at 'start' but we ended
-			 * with no smiley. Look again starting from next char.
-			 *
-			 * For example ">:)" and ":(" are both valid smileys,
-			 * when parsing text ">:(" we first see '>' which could
-			 * be the start of a smiley. 'start' variable is set to
-			 * that position and we parse next char which is ':' and
-			 * is still potential smiley. Then we see '(' which is
-			 * NOT part of the smiley, ">:(" does not exist, so we
-			 * have to start again from ':' to find ":(" which is
-			 * correct smiley. */
-			cur_str = start;
-			cur_tree = priv->tree;
 		}
 	}
 
-	/* Check if last char of the text was the end of a smiley */
-	if (cur_tree->pixbuf != NULL) {
-		hit = smiley_hit_new (cur_tree, start - text, cur_str - text);
-		hits = g_slist_prepend (hits, hit);
+	/* Check if the text ended with a smiley */
+	if (match != 0) {
+		smiley_manager_emit_hit (states[match].pattern,
+					 match_start, match_end,
+					 func, user_data);
 	}
+}
+
+static void
+smiley_manager_prepend_hit (const EmpathySmileyHit *hit,
+			    gpointer                user_data)
+{
+	GSList **hits = user_data;
+
+	*hits = g_slist_prepend (*hits, g_slice_dup (EmpathySmileyHit, hit));
+}
+
+GSList *
+empathy_smiley_manager_parse_len (EmpathySmileyManager *manager,
+				  const gchar          *text,
+				  gssize                len)
+{
+	GSList *hits = NULL;
+
+	g_return_val_if_fail (EMPATHY_IS_SMILEY_MANAGER (manager), NULL);
+	g_return_val_if_fail (text != NULL, NULL);
+
+	empathy_smiley_manager_foreach_hit (manager, text, len,
+					    smiley_manager_prepend_hit, &hits);
 
 	return g_slist_reverse (hits);
 }
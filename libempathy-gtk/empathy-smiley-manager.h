@@ -59,6 +59,9 @@ typedef struct {
 	guint        end;
 } EmpathySmileyHit;
 
+typedef void (*EmpathySmileyHitFunc)  (const EmpathySmileyHit *hit,
+				       gpointer                user_data);
+
 typedef void (*EmpathySmileyMenuFunc) (EmpathySmileyManager *manager,
 				       EmpathySmiley        *smiley,
 				       gpointer              user_data);
@@ -74,6 +77,11 @@ GSList *              empathy_smiley_manager_get_all         (EmpathySmileyManag
 GSList *              empathy_smiley_manager_parse_len       (EmpathySmileyManager *manager,
 							      const gchar          *text,
 							      gssize                len);
+void                  empathy_smiley_manager_foreach_hit     (EmpathySmileyManager *manager,
+							      const gchar          *text,
+							      gssize                len,
+							      EmpathySmileyHitFunc  func,
+							      gpointer              user_data);
 GtkWidget *           empathy_smiley_menu_new                (EmpathySmileyManager *manager,
 							      EmpathySmileyMenuFunc func,
 							      gpointer              user_data);
@@ -40,11 +40,27 @@
 
 #ifdef HAVE_ENCHANT
 
+/* Number of words whose spelling is remembered for each language */
+#define SPELL_CACHE_MAX_WORDS 1024
+
 typedef struct {
 	EnchantBroker *config;
 	EnchantDict   *speller;
+	/* Results of the last words checked, the chat input checks the same
+	 * words again and again as the user types.
+	 * borrowed word -> owned SpellCacheEntry */
+	GHashTable    *cache;
+	/* borrowed SpellCacheEntry, the most recently used first */
+	GQueue         cache_lru;
 } SpellLanguage;
 
+typedef struct {
+	gchar    *word;
+	gboolean  correct;
+	/* link in cache_lru */
+	GList    *link;
+} SpellCacheEntry;
+
 #define ISO_CODES_DATADIR    ISO_CODES_PREFIX "/share/xml/iso-codes"
 #define ISO_CODES_LOCALESDIR ISO_CODES_PREFIX "/share/locale"
 
@@ -174,12 +190,60 @@ spell_notify_languages_cb (GSettings   *gsettings,
 	}
 }
 
+static void
+spell_cache_entry_free (SpellCacheEntry *entry)
+{
+	g_free (entry->word);
+	g_slice_free (SpellCacheEntry, entry);
+}
+
+static void
+spell_language_clear_cache (SpellLanguage *lang)
+{
+	g_hash_table_remove_all (lang->cache);
+	g_queue_clear (&lang->cache_lru);
+}
+
+static gboolean
+spell_language_check (SpellLanguage *lang,
+		      const gchar   *word,
+		      gint           len)
+{
+	SpellCacheEntry *entry;
+
+	entry = g_hash_table_lookup (lang->cache, word);
+	if (entry != NULL) {
+		g_queue_unlink (&lang->cache_lru, entry->link);
+		g_queue_push_head_link (&lang->cache_lru, entry->link);
+
+		return entry->correct;
+	}
+
+	if (lang->cache_lru.length >= SPELL_CACHE_MAX_WORDS) {
+		entry = g_queue_pop_tail (&lang->cache_lru);
+		g_hash_table_remove (lang->cache, entry->word);
+	}
+
+	entry = g_slice_new0 (SpellCacheEntry);
+	entry->word = g_strndup (word, len);
+	entry->correct = (enchant_dict_check (lang->speller, word, len) == 0);
+
+	g_queue_push_head (&lang->cache_lru, entry);
+	entry->link = lang->cache_lru.head;
+	g_hash_table_insert (lang->cache, entry->word, entry);
+
+	return entry->correct;
+}
+
 static void
 empathy_spell_free_language (SpellLanguage *lang)
 {
 	enchant_broker_free_dict (lang->config, lang->speller);
 	enchant_broker_free (lang->config);
 
+	spell_language_clear_cache (lang);
+	g_hash_table_unref (lang->cache);
+
 	g_slice_free (SpellLanguage, lang);
 }
 
@@ -224,6 +288,10 @@ spell_setup_languages (void)
 
 			lang->config = enchant_broker_init ();
 			lang->speller = enchant_broker_request_dict (lang->config, strv[i]);
+			lang->cache = g_hash_table_new_full (g_str_hash,
+				g_str_equal, NULL,
+				(GDestroyNotify) spell_cache_entry_free);
+			g_queue_init (&lang->cache_lru);
 
 			if (lang->speller == NULL) {
 				DEBUG ("language '%s' has no valid dict", strv[i]);
@@ -317,7 +385,7 @@ empathy_spell_free_language_codes (GList *codes)
 gboolean
 empathy_spell_check (const gchar *word)
 {
-	gint         enchant_result = 1;
+	gboolean     correct = FALSE;
 	const gchar *p;
 	gboolean     digit;
 	gunichar     c;
@@ -347,15 +415,12 @@ empathy_spell_check (const gchar *word)
 
 	len = strlen (word);
 	g_hash_table_iter_init (&iter, languages);
-	while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &lang)) {
-		enchant_result = enchant_dict_check (lang->speller, word, len);
-
-		if (enchant_result == 0) {
-			break;
-		}
+	while (!correct &&
+	       g_hash_table_iter_next (&iter, NULL, (gpointer *) &lang)) {
+		correct = spell_language_check (lang, word, len);
 	}
 
-	return (enchant_result == 0);
+	return correct;
 }
 
 GList *
@@ -428,6 +493,9 @@ empathy_spell_add_to_dictionary (const gchar *code,
 		return;
 
 	enchant_dict_add_to_pwl (lang->speller, word, strlen (word));
+
+	/* The dictionary may now accept other forms of the word too */
+	spell_language_clear_cache (lang);
 }
 
 #else /* not HAVE_ENCHANT */
@@ -56,6 +56,39 @@ uri_regex_dup_singleton (void)
 	return g_regex_ref (uri_regex);
 }
 
+/* Cheap check done before running URI_REGEX: every link it can match
+ * contains "://", "www.", "ftp." or '@'. */
+static gboolean
+string_may_contain_link (const gchar *text,
+			 gssize len)
+{
+	gssize i;
+
+	if (len < 0) {
+		len = strlen (text);
+	}
+
+	for (i = 0; i < len; i++) {
+		switch (text[i]) {
+		case '@':
+			return TRUE;
+		case ':':
+			if (i + 2 < len && text[i + 1] == '/' && text[i + 2] == '/')
+				return TRUE;
+			break;
+		case '.':
+			if (i >= 3 && (strncmp (text + i - 3, "www", 3) == 0 ||
+				       strncmp (text + i - 3, "ftp", 3) == 0))
+				return TRUE;
+			break;
+		case '\0':
+			return FALSE;
+		}
+	}
+
+	return FALSE;
+}
+
 void
 empathy_string_parser_substr (const gchar *text,
 			      gssize len,
@@ -81,6 +114,11 @@ empathy_string_match_link (const gchar *text,
 	gboolean    match;
 	gint        last = 0;
 
+	if (!string_may_contain_link (text, len)) {
+		empathy_string_parser_substr (text, len, sub_parsers, user_data);
+		return;
+	}
+
 	uri_regex = uri_regex_dup_singleton ();
 	if (uri_regex == NULL) {
 		empathy_string_parser_substr (text, len, sub_parsers, user_data);
@@ -165,6 +203,201 @@ empathy_string_match_all (const gchar *text,
 	replace_func (text, len, NULL, user_data);
 }
 
+typedef struct {
+	GArray *spans;
+	guint offset;
+	guint last;
+} TokenizeData;
+
+static void
+tokenize_append (GArray *spans,
+		 EmpathyStringSpanType type,
+		 guint start,
+		 guint end,
+		 GdkPixbuf *pixbuf,
+		 const gchar *path)
+{
+	EmpathyStringSpan span;
+
+	if (start >= end) {
+		return;
+	}
+
+	span.type = type;
+	span.start = start;
+	span.end = end;
+	span.pixbuf = pixbuf;
+	span.path = path;
+
+	g_array_append_val (spans, span);
+}
+
+static void
+tokenize_smiley_cb (const EmpathySmileyHit *hit,
+		    gpointer user_data)
+{
+	TokenizeData *data = user_data;
+	guint start = data->offset + hit->start;
+	guint end = data->offset + hit->end;
+
+	tokenize_append (data->spans, EMPATHY_STRING_SPAN_TEXT,
+			 data->last, start, NULL, NULL);
+	tokenize_append (data->spans, EMPATHY_STRING_SPAN_SMILEY,
+			 start, end, hit->pixbuf, hit->path);
+	data->last = end;
+}
+
+/* Append spans for text[start:end], which contains no link */
+static void
+tokenize_gap (TokenizeData *data,
+	      EmpathySmileyManager *smiley_manager,
+	      const gchar *text,
+	      guint start,
+	      guint end)
+{
+	data->offset = start;
+	data->last = start;
+
+	if (smiley_manager != NULL && end > start) {
+		empathy_smiley_manager_foreach_hit (smiley_manager,
+						    text + start, end - start,
+						    tokenize_smiley_cb, data);
+	}
+
+	tokenize_append (data->spans, EMPATHY_STRING_SPAN_TEXT,
+			 data->last, end, NULL, NULL);
+}
+
+void
+empathy_string_tokenize (const gchar *text,
+			 gssize len,
+			 gboolean smileys,
+			 GArray *spans)
+{
+	EmpathySmileyManager *smiley_manager = NULL;
+	TokenizeData data = { spans, 0, 0 };
+	GRegex *uri_regex = NULL;
+	guint last = 0;
+
+	g_return_if_fail (text != NULL);
+	g_return_if_fail (spans != NULL);
+
+	if (len < 0) {
+		len = strlen (text);
+	}
+
+	if (smileys) {
+		smiley_manager = empathy_smiley_manager_dup_singleton ();
+	}
+
+	if (string_may_contain_link (text, len)) {
+		uri_regex = uri_regex_dup_singleton ();
+	}
+
+	if (uri_regex != NULL) {
+		GMatchInfo *match_info;
+
+		g_regex_match_full (uri_regex, text, len, 0, 0, &match_info,
+				    NULL);
+		while (g_match_info_matches (match_info)) {
+			gint s = 0, e = 0;
+
+			g_match_info_fetch_pos (match_info, 0, &s, &e);
+
+			tokenize_gap (&data, smiley_manager, text, last, s);
+			tokenize_append (spans, EMPATHY_STRING_SPAN_LINK,
+					 s, e, NULL, NULL);
+			last = e;
+
+			g_match_info_next (match_info, NULL);
+		}
+
+		g_match_info_free (match_info);
+		g_regex_unref (uri_regex);
+	}
+
+	tokenize_gap (&data, smiley_manager, text, last, len);
+
+	if (smiley_manager != NULL) {
+		g_object_unref (smiley_manager);
+	}
+}
+
+/* Same escaping as g_markup_escape_text(), but appended directly to string
+ * without allocating a temporary string. '\r' are removed. */
+void
+empathy_string_append_escaped (GString *string,
+			       const gchar *text,
+			       gssize len)
+{
+	const gchar *p;
+	const gchar *end;
+	const gchar *run;
+
+	if (len < 0) {
+		len = strlen (text);
+	}
+
+	end = text + len;
+	for (p = run = text; p < end; p++) {
+		const gchar *replacement = NULL;
+		guchar c = *p;
+		gunichar control = 0;
+
+		switch (c) {
+		case '&':
+			replacement = "&amp;";
+			break;
+		case '<':
+			replacement = "&lt;";
+			break;
+		case '>':
+			replacement = "&gt;";
+			break;
+		case '\'':
+			replacement = "&apos;";
+			break;
+		case '"':
+			replacement = "&quot;";
+			break;
+		case '\r':
+			replacement = "";
+			break;
+		default:
+			/* Control chars, C1 controls are encoded as 0xc2 0x80-0x9f */
+			if ((c >= 0x1 && c <= 0x8) || c == 0xb || c == 0xc ||
+			    (c >= 0xe && c <= 0x1f) || c == 0x7f) {
+				control = c;
+			} else if (c == 0xc2 && p + 1 < end) {
+				guchar c2 = p[1];
+
+				if ((c2 >= 0x80 && c2 <= 0x84) ||
+				    (c2 >= 0x86 && c2 <= 0x9f))
+					control = c2;
+			}
+			break;
+		}
+
+		if (replacement == NULL && control == 0) {
+			continue;
+		}
+
+		g_string_append_len (string, run, p - run);
+
+		if (replacement != NULL) {
+			g_string_append (string, replacement);
+		} else {
+			g_string_append_printf (string, "&#x%x;", control);
+			if (control >= 0x80)
+				p++;
+		}
+
+		run = p + 1;
+	}
+
+	g_string_append_len (string, run, end - run);
+}
+
 void
 empathy_string_replace_link (const gchar *text,
                              gssize len,
@@ -199,26 +432,7 @@ empathy_string_replace_escaped (const gchar *text,
 				gpointer match_data,
 				gpointer user_data)
 {
-	GString *string = user_data;
-	gchar *escaped;
-	guint i;
-	gsize escaped_len, old_len;
-
-	escaped = g_markup_escape_text (text, len);
-	escaped_len = strlen (escaped);
-
-	/* Allocate more space to string (we really need a g_string_extend...) */
-	old_len = string->len;
-	g_string_set_size (string, old_len + escaped_len);
-	g_string_truncate (string, old_len);
-
-	/* Remove '\r' */
-	for (i = 0; i < escaped_len; i++) {
-		if (escaped[i] != '\r')
-			g_string_append_c (string, escaped[i]);
-	}
-
-	g_free (escaped);
+	empathy_string_append_escaped (user_data, text, len);
 }
 
 gchar *
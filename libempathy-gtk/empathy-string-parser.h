@@ -22,6 +22,7 @@
 #define __EMPATHY_STRING_PARSER_H__
 
 #include <glib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
 
 G_BEGIN_DECLS
 
@@ -42,6 +43,20 @@ struct _EmpathyStringParser {
 	EmpathyStringReplace replace_func;
 };
 
+typedef enum {
+	EMPATHY_STRING_SPAN_TEXT,
+	EMPATHY_STRING_SPAN_LINK,
+	EMPATHY_STRING_SPAN_SMILEY
+} EmpathyStringSpanType;
+
+typedef struct {
+	EmpathyStringSpanType type;
+	guint start;		/* text[start:end] is the span */
+	guint end;
+	GdkPixbuf *pixbuf;	/* Smiley spans only */
+	const gchar *path;	/* Smiley spans only */
+} EmpathyStringSpan;
+
 void
 empathy_string_parser_substr (const gchar *text,
 			      gssize len,
@@ -69,6 +84,20 @@ empathy_string_match_all (const gchar *text,
 			  EmpathyStringParser *sub_parsers,
 			  gpointer user_data);
 
+/* Single pass alternative to the link + smiley parsers: appends
+ * EmpathyStringSpan covering the whole text to @spans, which the caller
+ * should reuse between calls. */
+void
+empathy_string_tokenize (const gchar *text,
+			 gssize len,
+			 gboolean smileys,
+			 GArray *spans);
+
+void
+empathy_string_append_escaped (GString *string,
+			       const gchar *text,
+			       gssize len);
+
 /* Replace functions assume user_data is a GString */
 void
 empathy_string_replace_link (const gchar *text,
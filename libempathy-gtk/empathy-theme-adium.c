@@ -52,6 +52,33 @@
 /* "Join" consecutive messages with timestamps within five minutes */
 #define MESSAGE_JOIN_PERIOD 5*60
 
+/* Seconds to wait before pruning old messages, giving Template.html
+ * time to insert the coalesced ones */
+#define PRUNE_TIMEOUT 1
+
+/* Inserts messages paged back from the logs at the top of the
+ * conversation without moving the text the user is looking at. */
+static const gchar prepend_message_script[] =
+	"function empathyPrependMessage(html) {"
+	"	var chat = document.getElementById('Chat');"
+	"	var range = document.createRange();"
+	"	range.selectNode(chat);"
+	"	var fragment = range.createContextualFragment(html);"
+	"	var insert = fragment.querySelector('#insert');"
+	"	if (insert)"
+	"		insert.parentNode.removeChild(insert);"
+	"	var height = document.body.scrollHeight;"
+	"	chat.insertBefore(fragment, chat.firstChild);"
+	"	window.scrollBy(0, document.body.scrollHeight - height);"
+	"}";
+
+enum {
+	LOAD_OLDER_MESSAGES,
+	LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL] = { 0 };
+
 typedef struct {
 	EmpathyAdiumData     *data;
 	EmpathySmileyManager *smiley_manager;
@@ -74,8 +101,52 @@ typedef struct {
 	gboolean              allow_scrolling;
 	gchar                *variant;
 	gboolean              in_construction;
+	/* Scripts appended while a batch is open, executed all at once
+	 * by theme_adium_flush_batch() */
+	GString              *batch;
+	guint                 batch_depth;
+	/* Maximum number of messages kept in the DOM, 0 for no limit */
+	guint                 max_messages;
+	/* gint64 timestamps of the messages at the top level of #Chat,
+	 * oldest first */
+	GArray               *timestamps;
+	/* TRUE if messages were pruned and could be paged back */
+	gboolean              has_older;
+	gboolean              loading_older;
+	guint                 prune_id;
+	GtkAdjustment        *vadjustment;
 } EmpathyThemeAdiumPriv;
 
+typedef enum {
+	ADIUM_TEMPLATE_LITERAL,
+	ADIUM_TEMPLATE_USER_ICON_PATH,
+	ADIUM_TEMPLATE_SENDER_SCREEN_NAME,
+	ADIUM_TEMPLATE_SENDER,
+	ADIUM_TEMPLATE_SENDER_COLOR,
+	ADIUM_TEMPLATE_MESSAGE,
+	ADIUM_TEMPLATE_TIME,
+	ADIUM_TEMPLATE_SHORT_TIME,
+	ADIUM_TEMPLATE_SERVICE,
+	ADIUM_TEMPLATE_MESSAGE_CLASSES
+} AdiumTemplateSegmentType;
+
+typedef struct {
+	AdiumTemplateSegmentType type;
+	/* ADIUM_TEMPLATE_LITERAL: text already escaped for a javascript
+	 * string; ADIUM_TEMPLATE_TIME: strftime format, or NULL for the
+	 * default one */
+	gchar *str;
+	gsize len;
+} AdiumTemplateSegment;
+
+/* A message html file split once into literal runs and keywords, so
+ * rendering a message is a simple concatenation. */
+typedef struct {
+	GArray *segments;
+	/* Total length of the literal segments */
+	gsize literal_len;
+} AdiumTemplate;
+
 struct _EmpathyAdiumData {
 	gint  ref_count;
 	gchar *path;
@@ -106,6 +177,19 @@ struct _EmpathyAdiumData {
 	 * We do this because of fallbacks, some htmls could be pointing the
 	 * same string. */
 	GPtrArray *strings_to_free;
+
+	/* Compiled message htmls, owned by the templates table */
+	AdiumTemplate *in_content_template;
+	AdiumTemplate *in_context_template;
+	AdiumTemplate *in_nextcontent_template;
+	AdiumTemplate *in_nextcontext_template;
+	AdiumTemplate *out_content_template;
+	AdiumTemplate *out_context_template;
+	AdiumTemplate *out_nextcontent_template;
+	AdiumTemplate *out_nextcontext_template;
+	AdiumTemplate *status_template;
+	/* const gchar *html -> owned AdiumTemplate */
+	GHashTable *templates;
 };
 
 static void theme_adium_iface_init (EmpathyChatViewIface *iface);
@@ -254,6 +338,12 @@ theme_adium_load_template (EmpathyThemeAdium *theme)
 	gchar                 *template;
 
 	priv->pages_loading++;
+
+	/* The new document starts empty */
+	g_array_set_size (priv->timestamps, 0);
+	priv->has_older = FALSE;
+	priv->loading_older = FALSE;
+
 	basedir_uri = g_strconcat ("file://", priv->data->basedir, NULL);
 	variant_path = adium_info_dup_path_for_variant (priv->data->info,
 		priv->variant);
@@ -272,14 +362,8 @@ theme_adium_parse_body (EmpathyThemeAdium *self,
 	const gchar *token)
 {
 	EmpathyThemeAdiumPriv *priv = GET_PRIV (self);
-	EmpathyStringParser *parsers;
 	GString *string;
 
-	/* Check if we have to parse smileys */
-	parsers = empathy_webkit_get_string_parser (
-		g_settings_get_boolean (priv->gsettings_chat,
-			EMPATHY_PREFS_CHAT_SHOW_SMILEYS));
-
 	/* Parse text and construct string with links and smileys replaced
 	 * by html tags. Also escape text to make sure html code is
 	 * displayed verbatim. */
@@ -292,7 +376,9 @@ theme_adium_parse_body (EmpathyThemeAdium *self,
 			"<span id=\"message-token-%s\">",
 			token);
 
-	empathy_string_parser_substr (text, -1, parsers, string);
+	empathy_webkit_append_body (string, text, token,
+		g_settings_get_boolean (priv->gsettings_chat,
+			EMPATHY_PREFS_CHAT_SHOW_SMILEYS));
 
 	if (!tp_str_empty (token))
 		g_string_append (string, "</span>");
@@ -309,25 +395,41 @@ theme_adium_parse_body (EmpathyThemeAdium *self,
 static void
 escape_and_append_len (GString *string, const gchar *str, gint len)
 {
+	const gchar *run = str;
+
+	/* Plain runs are appended in one go */
 	while (str != NULL && *str != '\0' && len != 0) {
+		const gchar *escaped;
+
 		switch (*str) {
 		case '\\':
 			/* \ becomes \\ */
-			g_string_append (string, "\\\\");
+			escaped = "\\\\";
 			break;
 		case '\"':
 			/* " becomes \" */
-			g_string_append (string, "\\\"");
+			escaped = "\\\"";
 			break;
 		case '\n':
 			/* Remove end of lines */
+			escaped = "";
 			break;
 		default:
-			g_string_append_c (string, *str);
+			str++;
+			len--;
+			continue;
 		}
 
+		g_string_append_len (string, run, str - run);
+		g_string_append (string, escaped);
+
 		str++;
 		len--;
+		run = str;
+	}
+
+	if (run != NULL) {
+		g_string_append_len (string, run, str - run);
 	}
 }
 
@@ -532,66 +634,89 @@ nsdate_to_strftime (EmpathyAdiumData *data, const gchar *nsdate)
 	return g_string_free (string, FALSE);
 }
 
+static void
+adium_template_free (AdiumTemplate *tmpl)
+{
+	guint i;
+
+	for (i = 0; i < tmpl->segments->len; i++) {
+		g_free (g_array_index (tmpl->segments, AdiumTemplateSegment, i).str);
+	}
+
+	g_array_unref (tmpl->segments);
+	g_slice_free (AdiumTemplate, tmpl);
+}
 
 static void
-theme_adium_append_html (EmpathyThemeAdium *theme,
-			 const gchar       *func,
-			 const gchar       *html,
-		         const gchar       *message,
-		         const gchar       *avatar_filename,
-		         const gchar       *name,
-		         const gchar       *contact_id,
-		         const gchar       *service_name,
-		         const gchar       *message_classes,
-		         gint64             timestamp,
-		         gboolean           is_backlog,
-		         gboolean           outgoing)
+adium_template_add_segment (AdiumTemplate *tmpl,
+			    AdiumTemplateSegmentType type,
+			    const gchar *str)
 {
-	EmpathyThemeAdiumPriv *priv = GET_PRIV (theme);
-	GString     *string;
-	const gchar *cur = NULL;
-	gchar       *script;
+	AdiumTemplateSegment segment;
+
+	segment.type = type;
+	segment.str = g_strdup (str);
+	segment.len = str != NULL ? strlen (str) : 0;
+
+	g_array_append_val (tmpl->segments, segment);
+}
+
+static void
+adium_template_flush_literal (AdiumTemplate *tmpl,
+			      GString *literal)
+{
+	if (literal->len == 0) {
+		return;
+	}
+
+	adium_template_add_segment (tmpl, ADIUM_TEMPLATE_LITERAL, literal->str);
+	tmpl->literal_len += literal->len;
+	g_string_truncate (literal, 0);
+}
+
+static AdiumTemplate *
+adium_template_compile (EmpathyAdiumData *data,
+			const gchar *html)
+{
+	AdiumTemplate *tmpl;
+	GString       *literal;
+	const gchar   *cur;
+
+	tmpl = g_slice_new0 (AdiumTemplate);
+	tmpl->segments = g_array_new (FALSE, FALSE, sizeof (AdiumTemplateSegment));
+	literal = g_string_new (NULL);
 
-	/* Make some search-and-replace in the html code */
-	string = g_string_sized_new (strlen (html) + strlen (message));
-	g_string_append_printf (string, "%s(\"", func);
 	for (cur = html; *cur != '\0'; cur++) {
-		const gchar *replace = NULL;
-		gchar       *dup_replace = NULL;
+		AdiumTemplateSegmentType type;
+		const gchar *str = NULL;
 		gchar       *format = NULL;
 
 		/* Those are all well known keywords that needs replacement in
 		 * html files. Please keep them in the same order than the adium
 		 * spec. See http://trac.adium.im/wiki/CreatingMessageStyles */
 		if (theme_adium_match (&cur, "%userIconPath%")) {
-			replace = avatar_filename;
+			type = ADIUM_TEMPLATE_USER_ICON_PATH;
 		} else if (theme_adium_match (&cur, "%senderScreenName%")) {
-			replace = contact_id;
+			type = ADIUM_TEMPLATE_SENDER_SCREEN_NAME;
 		} else if (theme_adium_match (&cur, "%sender%")) {
-			replace = name;
+			type = ADIUM_TEMPLATE_SENDER;
 		} else if (theme_adium_match (&cur, "%senderColor%")) {
 			/* A color derived from the user's name.
 			 * FIXME: If a colon separated list of HTML colors is at
 			 * Incoming/SenderColors.txt it will be used instead of
 			 * the default colors.
 			 */
-
-			/* Ensure we always use the same color when sending messages
-			 * (bgo #658821) */
-			if (outgoing) {
-				replace = "inherit";
-			} else if (contact_id != NULL) {
-				guint hash = g_str_hash (contact_id);
-				replace = colors[hash % G_N_ELEMENTS (colors)];
-			}
+			type = ADIUM_TEMPLATE_SENDER_COLOR;
 		} else if (theme_adium_match (&cur, "%senderStatusIcon%")) {
 			/* FIXME: The path to the status icon of the sender
 			 * (available, away, etc...)
 			 */
+			continue;
 		} else if (theme_adium_match (&cur, "%messageDirection%")) {
 			/* FIXME: The text direction of the message
 			 * (either rtl or ltr)
 			 */
+			continue;
 		} else if (theme_adium_match (&cur, "%senderDisplayName%")) {
 			/* FIXME: The serverside (remotely set) name of the
 			 * sender, such as an MSN display name.
@@ -599,48 +724,39 @@ theme_adium_append_html (EmpathyThemeAdium *theme,
 			 *  We don't have access to that yet so we use
 			 * local alias instead.
 			 */
-			replace = name;
+			type = ADIUM_TEMPLATE_SENDER;
 		} else if (theme_adium_match_with_format (&cur, "%textbackgroundcolor{", &format)) {
 			/* FIXME: This keyword is used to represent the
 			 * highlight background color. "X" is the opacity of the
 			 * background, ranges from 0 to 1 and can be any decimal
 			 * between.
 			 */
+			g_free (format);
+			continue;
 		} else if (theme_adium_match (&cur, "%message%")) {
-			replace = message;
+			type = ADIUM_TEMPLATE_MESSAGE;
 		} else if (theme_adium_match (&cur, "%time%") ||
 			   theme_adium_match_with_format (&cur, "%time{", &format)) {
-			const gchar *strftime_format;
-
-			strftime_format = nsdate_to_strftime (priv->data, format);
-			if (is_backlog) {
-				dup_replace = empathy_time_to_string_local (timestamp,
-					strftime_format ? strftime_format :
-					EMPATHY_TIME_DATE_FORMAT_DISPLAY_SHORT);
-			} else {
-				dup_replace = empathy_time_to_string_local (timestamp,
-					strftime_format ? strftime_format :
-					EMPATHY_TIME_FORMAT_DISPLAY_SHORT);
-			}
-			replace = dup_replace;
+			type = ADIUM_TEMPLATE_TIME;
+			str = nsdate_to_strftime (data, format);
 		} else if (theme_adium_match (&cur, "%shortTime%")) {
-			dup_replace = empathy_time_to_string_local (timestamp,
-				EMPATHY_TIME_FORMAT_DISPLAY_SHORT);
-			replace = dup_replace;
+			type = ADIUM_TEMPLATE_SHORT_TIME;
 		} else if (theme_adium_match (&cur, "%service%")) {
-			replace = service_name;
+			type = ADIUM_TEMPLATE_SERVICE;
 		} else if (theme_adium_match (&cur, "%variant%")) {
 			/* FIXME: The name of the active message style variant,
 			 * with all spaces replaced with an underscore.
 			 * A variant named "Alternating Messages - Blue Red"
 			 * will become "Alternating_Messages_-_Blue_Red".
 			 */
+			continue;
 		} else if (theme_adium_match (&cur, "%userIcons%")) {
 			/* FIXME: mus t be "hideIcons" if use preference is set
 			 * to hide avatars */
-			replace = "showIcons";
+			g_string_append (literal, "showIcons");
+			continue;
 		} else if (theme_adium_match (&cur, "%messageClasses%")) {
-			replace = message_classes;
+			type = ADIUM_TEMPLATE_MESSAGE_CLASSES;
 		} else if (theme_adium_match (&cur, "%status%")) {
 			/* FIXME: A description of the status event. This is
 			 * neither in the user's local language nor expected to
@@ -668,24 +784,257 @@ theme_adium_append_html (EmpathyThemeAdium *theme,
 			 *	fileTransferStarted
 			 *	fileTransferCompleted
 			 */
+			continue;
 		} else {
-			escape_and_append_len (string, cur, 1);
+			escape_and_append_len (literal, cur, 1);
 			continue;
 		}
 
-		/* Here we have a replacement to make */
-		escape_and_append_len (string, replace, -1);
+		/* Here we have a keyword to replace when rendering */
+		adium_template_flush_literal (tmpl, literal);
+		adium_template_add_segment (tmpl, type, str);
 
-		g_free (dup_replace);
 		g_free (format);
 	}
+
+	adium_template_flush_literal (tmpl, literal);
+	g_string_free (literal, TRUE);
+
+	return tmpl;
+}
+
+/* Templates are shared between the htmls pointing to the same string */
+static AdiumTemplate *
+adium_data_dup_template (EmpathyAdiumData *data,
+			 const gchar *html)
+{
+	AdiumTemplate *tmpl;
+
+	if (html == NULL) {
+		return NULL;
+	}
+
+	tmpl = g_hash_table_lookup (data->templates, html);
+	if (tmpl == NULL) {
+		tmpl = adium_template_compile (data, html);
+		g_hash_table_insert (data->templates, (gpointer) html, tmpl);
+	}
+
+	return tmpl;
+}
+
+static gboolean
+theme_adium_is_scrolled_down (EmpathyThemeAdium *theme)
+{
+	EmpathyThemeAdiumPriv *priv = GET_PRIV (theme);
+	GtkAdjustment *adj = priv->vadjustment;
+
+	if (adj == NULL) {
+		return TRUE;
+	}
+
+	return gtk_adjustment_get_value (adj) + gtk_adjustment_get_page_size (adj) >=
+		gtk_adjustment_get_upper (adj) - 1;
+}
+
+static gboolean
+theme_adium_prune_cb (gpointer user_data)
+{
+	EmpathyThemeAdium *theme = user_data;
+	EmpathyThemeAdiumPriv *priv = GET_PRIV (theme);
+	WebKitDOMDocument *dom;
+	WebKitDOMElement *chat;
+	guint excess, i;
+
+	priv->prune_id = 0;
+
+	if (priv->max_messages == 0 ||
+	    priv->timestamps->len <= priv->max_messages) {
+		return FALSE;
+	}
+
+	/* Don't move the text the user is reading, we'll try again once
+	 * the view is scrolled down */
+	if (priv->pages_loading != 0 || priv->batch_depth > 0 ||
+	    !theme_adium_is_scrolled_down (theme)) {
+		return FALSE;
+	}
+
+	dom = webkit_web_view_get_dom_document (WEBKIT_WEB_VIEW (theme));
+	if (dom == NULL) {
+		return FALSE;
+	}
+
+	chat = webkit_dom_document_get_element_by_id (dom, "Chat");
+	if (chat == NULL) {
+		return FALSE;
+	}
+
+	excess = priv->timestamps->len - priv->max_messages;
+	for (i = 0; i < excess; i++) {
+		WebKitDOMElement *first;
+
+		first = webkit_dom_element_get_first_element_child (chat);
+		if (first == NULL) {
+			break;
+		}
+
+		webkit_dom_node_remove_child (WEBKIT_DOM_NODE (chat),
+					      WEBKIT_DOM_NODE (first), NULL);
+	}
+
+	if (i > 0) {
+		DEBUG ("Pruned %u old messages", i);
+		g_array_remove_range (priv->timestamps, 0, i);
+		priv->has_older = TRUE;
+	}
+
+	return FALSE;
+}
+
+static void
+theme_adium_schedule_prune (EmpathyThemeAdium *theme)
+{
+	EmpathyThemeAdiumPriv *priv = GET_PRIV (theme);
+
+	if (priv->prune_id != 0 || priv->max_messages == 0 ||
+	    priv->timestamps->len <= priv->max_messages) {
+		return;
+	}
+
+	priv->prune_id = g_timeout_add_seconds (PRUNE_TIMEOUT,
+						theme_adium_prune_cb, theme);
+}
+
+static void
+theme_adium_append_html (EmpathyThemeAdium *theme,
+			 const gchar       *func,
+			 AdiumTemplate     *tmpl,
+		         const gchar       *message,
+		         const gchar       *avatar_filename,
+		         const gchar       *name,
+		         const gchar       *contact_id,
+		         const gchar       *service_name,
+		         const gchar       *message_classes,
+		         gint64             timestamp,
+		         gboolean           is_backlog,
+		         gboolean           outgoing)
+{
+	EmpathyThemeAdiumPriv *priv = GET_PRIV (theme);
+	GString     *string;
+	gchar       *script;
+	guint        i;
+
+	if (tmpl == NULL) {
+		return;
+	}
+
+	/* Replace the keywords of the compiled template */
+	string = g_string_sized_new (strlen (func) + tmpl->literal_len +
+		strlen (message) + 256);
+	g_string_append (string, func);
+	g_string_append (string, "(\"");
+	for (i = 0; i < tmpl->segments->len; i++) {
+		const AdiumTemplateSegment *segment;
+		const gchar *replace = NULL;
+		gchar       *dup_replace = NULL;
+
+		segment = &g_array_index (tmpl->segments, AdiumTemplateSegment, i);
+
+		switch (segment->type) {
+		case ADIUM_TEMPLATE_LITERAL:
+			g_string_append_len (string, segment->str, segment->len);
+			continue;
+		case ADIUM_TEMPLATE_USER_ICON_PATH:
+			replace = avatar_filename;
+			break;
+		case ADIUM_TEMPLATE_SENDER_SCREEN_NAME:
+			replace = contact_id;
+			break;
+		case ADIUM_TEMPLATE_SENDER:
+			replace = name;
+			break;
+		case ADIUM_TEMPLATE_SENDER_COLOR:
+			/* Ensure we always use the same color when sending messages
+			 * (bgo #658821) */
+			if (outgoing) {
+				replace = "inherit";
+			} else if (contact_id != NULL) {
+				guint hash = g_str_hash (contact_id);
+				replace = colors[hash % G_N_ELEMENTS (colors)];
+			}
+			break;
+		case ADIUM_TEMPLATE_MESSAGE:
+			replace = message;
+			break;
+		case ADIUM_TEMPLATE_TIME:
+			if (segment->str != NULL) {
+				dup_replace = empathy_time_to_string_local (timestamp,
+					segment->str);
+			} else if (is_backlog) {
+				dup_replace = empathy_time_to_string_local (timestamp,
+					EMPATHY_TIME_DATE_FORMAT_DISPLAY_SHORT);
+			} else {
+				dup_replace = empathy_time_to_string_local (timestamp,
+					EMPATHY_TIME_FORMAT_DISPLAY_SHORT);
+			}
+			replace = dup_replace;
+			break;
+		case ADIUM_TEMPLATE_SHORT_TIME:
+			dup_replace = empathy_time_to_string_local (timestamp,
+				EMPATHY_TIME_FORMAT_DISPLAY_SHORT);
+			replace = dup_replace;
+			break;
+		case ADIUM_TEMPLATE_SERVICE:
+			replace = service_name;
+			break;
+		case ADIUM_TEMPLATE_MESSAGE_CLASSES:
+			replace = message_classes;
+			break;
+		}
+
+		escape_and_append_len (string, replace, -1);
+		g_free (dup_replace);
+	}
 	g_string_append (string, "\")");
 
+	/* Keep track of the messages at the top level of #Chat, the
+	 * consecutive ones are inserted inside the previous message */
+	if (g_str_has_prefix (func, "appendMessage")) {
+		g_array_append_val (priv->timestamps, timestamp);
+		theme_adium_schedule_prune (theme);
+	} else if (!tp_strdiff (func, "empathyPrependMessage")) {
+		g_array_prepend_val (priv->timestamps, timestamp);
+	}
+
+	if (priv->batch_depth > 0) {
+		/* Template.html coalesces all the fragments appended by
+		 * a single script, so the whole batch is laid out once. */
+		g_string_append_len (priv->batch, string->str, string->len);
+		g_string_append (priv->batch, ";\n");
+		g_string_free (string, TRUE);
+		return;
+	}
+
 	script = g_string_free (string, FALSE);
 	webkit_web_view_execute_script (WEBKIT_WEB_VIEW (theme), script);
 	g_free (script);
 }
 
+static void
+theme_adium_flush_batch (EmpathyThemeAdium *theme)
+{
+	EmpathyThemeAdiumPriv *priv = GET_PRIV (theme);
+
+	if (priv->batch == NULL || priv->batch->len == 0) {
+		return;
+	}
+
+	webkit_web_view_execute_script (WEBKIT_WEB_VIEW (theme),
+					priv->batch->str);
+	g_string_truncate (priv->batch, 0);
+}
+
 static void
 theme_adium_append_event_escaped (EmpathyChatView *view,
 				  const gchar     *escaped)
@@ -694,7 +1043,7 @@ theme_adium_append_event_escaped (EmpathyChatView *view,
 	EmpathyThemeAdiumPriv *priv = GET_PRIV (theme);
 
 	theme_adium_append_html (theme, "appendMessage",
-				 priv->data->status_html, escaped, NULL, NULL, NULL,
+				 priv->data->status_template, escaped, NULL, NULL, NULL,
 				 NULL, "event",
 				 empathy_time_get_current (), FALSE, FALSE);
 
@@ -759,6 +1108,8 @@ theme_adium_remove_all_focus_marks (EmpathyThemeAdium *theme)
 
 	priv->has_unread_message = FALSE;
 
+	theme_adium_flush_batch (theme);
+
 	dom = webkit_web_view_get_dom_document (WEBKIT_WEB_VIEW (theme));
 	if (dom == NULL) {
 		return;
@@ -776,12 +1127,14 @@ theme_adium_remove_all_focus_marks (EmpathyThemeAdium *theme)
 	theme_adium_remove_focus_marks (theme, nodes);
 }
 
+/* Messages are prepended when paged back from the logs; they are never
+ * joined with their neighbours and don't change the insertion state. */
 static void
-theme_adium_append_message (EmpathyChatView *view,
-			    EmpathyMessage  *msg,
-			    gboolean         should_highlight)
+theme_adium_add_message (EmpathyThemeAdium *theme,
+			 EmpathyMessage    *msg,
+			 gboolean           should_highlight,
+			 gboolean           prepend)
 {
-	EmpathyThemeAdium     *theme = EMPATHY_THEME_ADIUM (view);
 	EmpathyThemeAdiumPriv *priv = GET_PRIV (theme);
 	EmpathyContact        *sender;
 	TpMessage             *tp_msg;
@@ -792,7 +1145,7 @@ theme_adium_append_message (EmpathyChatView *view,
 	EmpathyAvatar         *avatar;
 	const gchar           *avatar_filename = NULL;
 	gint64                 timestamp;
-	const gchar           *html = NULL;
+	AdiumTemplate         *tmpl = NULL;
 	const gchar           *func;
 	const gchar           *service_name;
 	GString               *message_classes = NULL;
@@ -800,11 +1153,6 @@ theme_adium_append_message (EmpathyChatView *view,
 	gboolean               consecutive;
 	gboolean               action;
 
-	if (priv->pages_loading != 0) {
-		queue_item (&priv->message_queue, QUEUED_MESSAGE, msg, NULL, should_highlight);
-		return;
-	}
-
 	/* Get information */
 	sender = empathy_message_get_sender (msg);
 	account = empathy_contact_get_account (sender);
@@ -837,10 +1185,14 @@ theme_adium_append_message (EmpathyChatView *view,
 		body_escaped = str;
 	}
 
-	/* Get the avatar filename, or a fallback */
-	avatar = empathy_contact_get_avatar (sender);
-	if (avatar) {
-		avatar_filename = avatar->filename;
+	/* Get the avatar filename, or a fallback. The file is known before
+	 * the avatar has been loaded. */
+	avatar_filename = empathy_contact_get_avatar_path (sender);
+	if (!avatar_filename) {
+		avatar = empathy_contact_get_avatar (sender);
+		if (avatar) {
+			avatar_filename = avatar->filename;
+		}
 	}
 	if (!avatar_filename) {
 		if (empathy_contact_is_user (sender)) {
@@ -864,7 +1216,8 @@ theme_adium_append_message (EmpathyChatView *view,
 	 * - last message and this message both are/aren't backlog, and
 	 * - DisableCombineConsecutive is not set in theme's settings */
 	is_backlog = empathy_message_is_backlog (msg);
-	consecutive = empathy_contact_equal (priv->last_contact, sender) &&
+	consecutive = !prepend &&
+		empathy_contact_equal (priv->last_contact, sender) &&
 		(timestamp - priv->last_timestamp < MESSAGE_JOIN_PERIOD) &&
 		(is_backlog == priv->last_is_backlog) &&
 		!tp_asv_get_boolean (priv->data->info,
@@ -924,7 +1277,9 @@ theme_adium_append_message (EmpathyChatView *view,
 	}
 
 	/* Define javascript function to use */
-	if (consecutive) {
+	if (prepend) {
+		func = "empathyPrependMessage";
+	} else if (consecutive) {
 		func = priv->allow_scrolling ? "appendNextMessage" : "appendNextMessageNoScroll";
 	} else {
 		func = priv->allow_scrolling ? "appendMessage" : "appendMessageNoScroll";
@@ -934,43 +1289,63 @@ theme_adium_append_message (EmpathyChatView *view,
 		/* out */
 		if (is_backlog) {
 			/* context */
-			html = consecutive ? priv->data->out_nextcontext_html : priv->data->out_context_html;
+			tmpl = consecutive ? priv->data->out_nextcontext_template : priv->data->out_context_template;
 		} else {
 			/* content */
-			html = consecutive ? priv->data->out_nextcontent_html : priv->data->out_content_html;
+			tmpl = consecutive ? priv->data->out_nextcontent_template : priv->data->out_content_template;
 		}
 
 		/* remove all the unread marks when we are sending a message */
-		theme_adium_remove_all_focus_marks (theme);
+		if (!prepend) {
+			theme_adium_remove_all_focus_marks (theme);
+		}
 	} else {
 		/* in */
 		if (is_backlog) {
 			/* context */
-			html = consecutive ? priv->data->in_nextcontext_html : priv->data->in_context_html;
+			tmpl = consecutive ? priv->data->in_nextcontext_template : priv->data->in_context_template;
 		} else {
 			/* content */
-			html = consecutive ? priv->data->in_nextcontent_html : priv->data->in_content_html;
+			tmpl = consecutive ? priv->data->in_nextcontent_template : priv->data->in_content_template;
 		}
 	}
 
-	theme_adium_append_html (theme, func, html, body_escaped,
+	theme_adium_append_html (theme, func, tmpl, body_escaped,
 				 avatar_filename, name_escaped, contact_id,
 				 service_name, message_classes->str,
 				 timestamp, is_backlog, empathy_contact_is_user (sender));
 
 	/* Keep the sender of the last displayed message */
-	if (priv->last_contact) {
-		g_object_unref (priv->last_contact);
+	if (!prepend) {
+		if (priv->last_contact) {
+			g_object_unref (priv->last_contact);
+		}
+		priv->last_contact = g_object_ref (sender);
+		priv->last_timestamp = timestamp;
+		priv->last_is_backlog = is_backlog;
 	}
-	priv->last_contact = g_object_ref (sender);
-	priv->last_timestamp = timestamp;
-	priv->last_is_backlog = is_backlog;
 
 	g_free (body_escaped);
 	g_free (name_escaped);
 	g_string_free (message_classes, TRUE);
 }
 
+static void
+theme_adium_append_message (EmpathyChatView *view,
+			    EmpathyMessage  *msg,
+			    gboolean         should_highlight)
+{
+	EmpathyThemeAdiumPriv *priv = GET_PRIV (view);
+
+	if (priv->pages_loading != 0) {
+		queue_item (&priv->message_queue, QUEUED_MESSAGE, msg, NULL, should_highlight);
+		return;
+	}
+
+	theme_adium_add_message (EMPATHY_THEME_ADIUM (view), msg,
+				 should_highlight, FALSE);
+}
+
 static void
 theme_adium_append_event (EmpathyChatView *view,
 			  const gchar     *str)
@@ -1013,6 +1388,9 @@ theme_adium_edit_message (EmpathyChatView *view,
 		return;
 	}
 
+	/* The edited message may still be waiting in the batch */
+	theme_adium_flush_batch (EMPATHY_THEME_ADIUM (view));
+
 	id = g_strdup_printf ("message-token-%s",
 		empathy_message_get_supersedes (message));
 	/* we don't pass a token here, because doing so will return another
@@ -1109,6 +1487,7 @@ theme_adium_scroll (EmpathyChatView *view,
 static void
 theme_adium_scroll_down (EmpathyChatView *view)
 {
+	theme_adium_flush_batch (EMPATHY_THEME_ADIUM (view));
 	webkit_web_view_execute_script (WEBKIT_WEB_VIEW (view), "alignChat(true);");
 }
 
@@ -1123,6 +1502,11 @@ theme_adium_clear (EmpathyChatView *view)
 {
 	EmpathyThemeAdiumPriv *priv = GET_PRIV (view);
 
+	/* Pending scripts target the document being replaced */
+	if (priv->batch != NULL) {
+		g_string_truncate (priv->batch, 0);
+	}
+
 	theme_adium_load_template (EMPATHY_THEME_ADIUM (view));
 
 	/* Clear last contact to avoid trying to add a 'joined'
@@ -1199,6 +1583,8 @@ theme_adium_remove_mark_from_message (EmpathyThemeAdium *self,
 	gchar *class;
 	GError *error = NULL;
 
+	theme_adium_flush_batch (self);
+
 	dom = webkit_web_view_get_dom_document (WEBKIT_WEB_VIEW (self));
 	if (dom == NULL) {
 		return;
@@ -1284,6 +1670,90 @@ theme_adium_message_acknowledged (EmpathyChatView *view,
 	theme_adium_remove_mark_from_message (self, id);
 }
 
+static void
+theme_adium_begin_batch (EmpathyChatView *view)
+{
+	EmpathyThemeAdiumPriv *priv = GET_PRIV (view);
+
+	if (priv->batch == NULL) {
+		priv->batch = g_string_new (NULL);
+	}
+
+	priv->batch_depth++;
+}
+
+static void
+theme_adium_end_batch (EmpathyChatView *view)
+{
+	EmpathyThemeAdiumPriv *priv = GET_PRIV (view);
+
+	g_return_if_fail (priv->batch_depth > 0);
+
+	priv->batch_depth--;
+	if (priv->batch_depth == 0) {
+		theme_adium_flush_batch (EMPATHY_THEME_ADIUM (view));
+	}
+}
+
+static void
+theme_adium_vadjustment_value_changed_cb (GtkAdjustment     *adjustment,
+					  EmpathyThemeAdium *theme)
+{
+	EmpathyThemeAdiumPriv *priv = GET_PRIV (theme);
+
+	if (theme_adium_is_scrolled_down (theme)) {
+		theme_adium_schedule_prune (theme);
+		return;
+	}
+
+	if (!priv->has_older || priv->loading_older ||
+	    priv->timestamps->len == 0 ||
+	    gtk_adjustment_get_value (adjustment) > gtk_adjustment_get_lower (adjustment)) {
+		return;
+	}
+
+	/* The user reached the top of the pruned conversation, ask for
+	 * the messages sent before the oldest one we still display. */
+	priv->loading_older = TRUE;
+	g_signal_emit (theme, signals[LOAD_OLDER_MESSAGES], 0,
+		       g_array_index (priv->timestamps, gint64, 0));
+}
+
+static void
+theme_adium_notify_vadjustment_cb (GObject    *object,
+				   GParamSpec *pspec,
+				   gpointer    user_data)
+{
+	EmpathyThemeAdiumPriv *priv = GET_PRIV (object);
+
+	if (priv->vadjustment != NULL) {
+		g_signal_handlers_disconnect_by_func (priv->vadjustment,
+			theme_adium_vadjustment_value_changed_cb, object);
+		g_object_unref (priv->vadjustment);
+	}
+
+	priv->vadjustment = gtk_scrollable_get_vadjustment (GTK_SCROLLABLE (object));
+
+	if (priv->vadjustment != NULL) {
+		g_object_ref (priv->vadjustment);
+		g_signal_connect (priv->vadjustment, "value-changed",
+			G_CALLBACK (theme_adium_vadjustment_value_changed_cb),
+			object);
+	}
+}
+
+static void
+theme_adium_scrollback_length_changed_cb (GSettings   *gsettings,
+					  const gchar *key,
+					  gpointer     user_data)
+{
+	EmpathyThemeAdium *theme = user_data;
+	EmpathyThemeAdiumPriv *priv = GET_PRIV (theme);
+
+	priv->max_messages = MAX (0, g_settings_get_int (gsettings, key));
+	theme_adium_schedule_prune (theme);
+}
+
 static gboolean
 theme_adium_button_press_event (GtkWidget *widget, GdkEventButton *event)
 {
@@ -1325,6 +1795,8 @@ theme_adium_iface_init (EmpathyChatViewIface *iface)
 	iface->copy_clipboard = theme_adium_copy_clipboard;
 	iface->focus_toggled = theme_adium_focus_toggled;
 	iface->message_acknowledged = theme_adium_message_acknowledged;
+	iface->begin_batch = theme_adium_begin_batch;
+	iface->end_batch = theme_adium_end_batch;
 }
 
 static void
@@ -1342,7 +1814,10 @@ theme_adium_load_finished_cb (WebKitWebView  *view,
 	if (priv->pages_loading != 0)
 		return;
 
+	webkit_web_view_execute_script (view, prepend_message_script);
+
 	/* Display queued messages */
+	theme_adium_begin_batch (chat_view);
 	for (l = priv->message_queue.head; l != NULL; l = l->next) {
 		QueuedItem *item = l->data;
 
@@ -1364,6 +1839,7 @@ theme_adium_load_finished_cb (WebKitWebView  *view,
 
 		free_queued_item (item);
 	}
+	theme_adium_end_batch (chat_view);
 
 	g_queue_clear (&priv->message_queue);
 }
@@ -1375,6 +1851,12 @@ theme_adium_finalize (GObject *object)
 
 	empathy_adium_data_unref (priv->data);
 
+	if (priv->batch != NULL) {
+		g_string_free (priv->batch, TRUE);
+	}
+
+	g_array_unref (priv->timestamps);
+
 	g_object_unref (priv->gsettings_chat);
 	g_object_unref (priv->gsettings_desktop);
 
@@ -1405,6 +1887,18 @@ theme_adium_dispose (GObject *object)
 		g_queue_clear (&priv->acked_messages);
 	}
 
+	if (priv->prune_id != 0) {
+		g_source_remove (priv->prune_id);
+		priv->prune_id = 0;
+	}
+
+	if (priv->vadjustment != NULL) {
+		g_signal_handlers_disconnect_by_func (priv->vadjustment,
+			theme_adium_vadjustment_value_changed_cb, object);
+		g_object_unref (priv->vadjustment);
+		priv->vadjustment = NULL;
+	}
+
 	G_OBJECT_CLASS (empathy_theme_adium_parent_class)->dispose (object);
 }
 
@@ -1592,6 +2086,16 @@ empathy_theme_adium_class_init (EmpathyThemeAdiumClass *klass)
 							      G_PARAM_READWRITE |
 							      G_PARAM_STATIC_STRINGS));
 
+	signals[LOAD_OLDER_MESSAGES] =
+		g_signal_new ("load-older-messages",
+			      G_OBJECT_CLASS_TYPE (object_class),
+			      G_SIGNAL_RUN_LAST,
+			      0,
+			      NULL, NULL,
+			      g_cclosure_marshal_generic,
+			      G_TYPE_NONE,
+			      1, G_TYPE_INT64);
+
 	g_type_class_add_private (object_class, sizeof (EmpathyThemeAdiumPriv));
 }
 
@@ -1607,6 +2111,7 @@ empathy_theme_adium_init (EmpathyThemeAdium *theme)
 	g_queue_init (&priv->message_queue);
 	priv->allow_scrolling = TRUE;
 	priv->smiley_manager = empathy_smiley_manager_dup_singleton ();
+	priv->timestamps = g_array_new (FALSE, FALSE, sizeof (gint64));
 
 	g_signal_connect (theme, "load-finished",
 			  G_CALLBACK (theme_adium_load_finished_cb),
@@ -1614,6 +2119,9 @@ empathy_theme_adium_init (EmpathyThemeAdium *theme)
 	g_signal_connect (theme, "navigation-policy-decision-requested",
 			  G_CALLBACK (theme_adium_navigation_policy_decision_requested_cb),
 			  NULL);
+	g_signal_connect (theme, "notify::vadjustment",
+			  G_CALLBACK (theme_adium_notify_vadjustment_cb),
+			  NULL);
 
 	priv->gsettings_chat = g_settings_new (EMPATHY_PREFS_CHAT_SCHEMA);
 	priv->gsettings_desktop = g_settings_new (
@@ -1625,6 +2133,13 @@ empathy_theme_adium_init (EmpathyThemeAdium *theme)
 		theme);
 
 	theme_adium_update_enable_webkit_developer_tools (theme);
+
+	g_signal_connect (priv->gsettings_chat,
+		"changed::" EMPATHY_PREFS_CHAT_SCROLLBACK_LENGTH,
+		G_CALLBACK (theme_adium_scrollback_length_changed_cb),
+		theme);
+	theme_adium_scrollback_length_changed_cb (priv->gsettings_chat,
+		EMPATHY_PREFS_CHAT_SCROLLBACK_LENGTH, theme);
 }
 
 EmpathyThemeAdium *
@@ -1639,6 +2154,37 @@ empathy_theme_adium_new (EmpathyAdiumData *data,
 			     NULL);
 }
 
+/* @messages are the ones sent before the oldest displayed message,
+ * oldest first. An empty list means there is nothing older to show. */
+void
+empathy_theme_adium_prepend_messages (EmpathyThemeAdium *theme,
+				      GList             *messages)
+{
+	EmpathyThemeAdiumPriv *priv = GET_PRIV (theme);
+	GList *l;
+
+	g_return_if_fail (EMPATHY_IS_THEME_ADIUM (theme));
+
+	priv->loading_older = FALSE;
+
+	/* The document was replaced in the meantime */
+	if (priv->pages_loading != 0) {
+		return;
+	}
+
+	if (messages == NULL) {
+		priv->has_older = FALSE;
+		return;
+	}
+
+	/* Each message is inserted at the top, so start with the newest */
+	theme_adium_begin_batch (EMPATHY_CHAT_VIEW (theme));
+	for (l = g_list_last (messages); l != NULL; l = l->prev) {
+		theme_adium_add_message (theme, l->data, FALSE, TRUE);
+	}
+	theme_adium_end_batch (EMPATHY_CHAT_VIEW (theme));
+}
+
 void
 empathy_theme_adium_set_variant (EmpathyThemeAdium *theme,
 				 const gchar *variant)
@@ -2000,6 +2546,19 @@ empathy_adium_data_new_with_info (const gchar *path, GHashTable *info)
 	g_free (template_html);
 	g_free (footer_html);
 
+	/* Compile the message htmls once for all the views */
+	data->templates = g_hash_table_new_full (NULL, NULL, NULL,
+		(GDestroyNotify) adium_template_free);
+	data->in_content_template = adium_data_dup_template (data, data->in_content_html);
+	data->in_context_template = adium_data_dup_template (data, data->in_context_html);
+	data->in_nextcontent_template = adium_data_dup_template (data, data->in_nextcontent_html);
+	data->in_nextcontext_template = adium_data_dup_template (data, data->in_nextcontext_html);
+	data->out_content_template = adium_data_dup_template (data, data->out_content_html);
+	data->out_context_template = adium_data_dup_template (data, data->out_context_html);
+	data->out_nextcontent_template = adium_data_dup_template (data, data->out_nextcontent_html);
+	data->out_nextcontext_template = adium_data_dup_template (data, data->out_nextcontext_html);
+	data->status_template = adium_data_dup_template (data, data->status_html);
+
 	return data;
 }
 
@@ -2040,6 +2599,7 @@ empathy_adium_data_unref (EmpathyAdiumData *data)
 		g_hash_table_unref (data->info);
 		g_ptr_array_unref (data->strings_to_free);
 		tp_clear_pointer (&data->date_format_cache, g_hash_table_unref);
+		tp_clear_pointer (&data->templates, g_hash_table_unref);
 
 		g_slice_free (EmpathyAdiumData, data);
 	}
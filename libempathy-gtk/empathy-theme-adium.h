@@ -54,6 +54,8 @@ EmpathyThemeAdium *empathy_theme_adium_new      (EmpathyAdiumData *data,
 void               empathy_theme_adium_set_variant (EmpathyThemeAdium *theme,
 						    const gchar *variant);
 void               empathy_theme_adium_show_inspector (EmpathyThemeAdium *theme);
+void               empathy_theme_adium_prepend_messages (EmpathyThemeAdium *theme,
+							 GList *messages);
 
 gboolean           empathy_adium_path_is_valid (const gchar *path);
 
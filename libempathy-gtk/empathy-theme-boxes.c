@@ -123,15 +123,16 @@ static GdkPixbuf *
 theme_boxes_get_avatar_pixbuf_with_cache (EmpathyContact *contact)
 {
 	AvatarData        *data;
-	EmpathyAvatar     *avatar;
+	const gchar       *filename;
 	GdkPixbuf         *tmp_pixbuf;
 	GdkPixbuf         *pixbuf = NULL;
 
-	/* Check if avatar is in cache and if it's up to date */
-	avatar = empathy_contact_get_avatar (contact);
+	/* Check if avatar is in cache and if it's up to date. The file is
+	 * known before the avatar has been loaded. */
+	filename = empathy_contact_get_avatar_path (contact);
 	data = g_object_get_data (G_OBJECT (contact), "chat-view-avatar-cache");
 	if (data) {
-		if (avatar && !tp_strdiff (avatar->filename, data->filename)) {
+		if (filename && !tp_strdiff (filename, data->filename)) {
 			/* We have the avatar in cache */
 			return data->pixbuf;
 		}
@@ -151,7 +152,7 @@ theme_boxes_get_avatar_pixbuf_with_cache (EmpathyContact *contact)
 	 * for each version of an avatar, so we can use it to perform change
 	 * detection (as above). */
 	data = g_slice_new0 (AvatarData);
-	data->filename = g_strdup (avatar->filename);
+	data->filename = g_strdup (filename);
 	data->pixbuf = pixbuf;
 
 	g_object_set_data_full (G_OBJECT (contact), "chat-view-avatar-cache",
@@ -467,20 +467,316 @@ avatar_pixbuf_from_loader (GdkPixbufLoader *loader)
 	return pixbuf;
 }
 
-GdkPixbuf *
-empathy_pixbuf_from_avatar_scaled (EmpathyAvatar *avatar,
-				  gint          width,
-				  gint          height)
+/* Scaled and rounded avatars, shared by everything displaying them. They are
+ * keyed by the file of the avatar, its modification time and size, as some
+ * avatar files are overwritten in place when they change, and by the
+ * requested size. The least recently used ones are dropped once they take
+ * more than AVATAR_CACHE_MAX_BYTES. Each of them is also saved as a PNG
+ * thumbnail, so they don't have to be decoded again from the full-size
+ * image at the next start. Thumbnails not written for
+ * AVATAR_THUMBNAIL_MAX_AGE seconds are removed, which drops those of old
+ * avatars and makes the ones still used be created again. */
+#define AVATAR_CACHE_MAX_BYTES (8 * 1024 * 1024)
+#define AVATAR_THUMBNAIL_MAX_AGE (30 * 24 * 60 * 60)
+#define AVATAR_FILE_ATTRIBUTES \
+	G_FILE_ATTRIBUTE_TIME_MODIFIED "," \
+	G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC "," \
+	G_FILE_ATTRIBUTE_STANDARD_SIZE
+
+typedef struct {
+	gchar     *key;
+	GdkPixbuf *pixbuf;
+	/* link in avatar_cache_lru */
+	GList     *link;
+} AvatarCacheEntry;
+
+/* borrowed key -> owned AvatarCacheEntry */
+static GHashTable *avatar_cache = NULL;
+/* borrowed AvatarCacheEntry, the most recently used first */
+static GQueue avatar_cache_lru = G_QUEUE_INIT;
+static gsize avatar_cache_size = 0;
+
+static gsize
+avatar_cache_entry_get_size (AvatarCacheEntry *entry)
+{
+	return gdk_pixbuf_get_rowstride (entry->pixbuf) *
+		gdk_pixbuf_get_height (entry->pixbuf);
+}
+
+static void
+avatar_cache_entry_free (AvatarCacheEntry *entry)
+{
+	avatar_cache_size -= avatar_cache_entry_get_size (entry);
+	g_queue_delete_link (&avatar_cache_lru, entry->link);
+
+	g_object_unref (entry->pixbuf);
+	g_free (entry->key);
+	g_slice_free (AvatarCacheEntry, entry);
+}
+
+/* @info must have the AVATAR_FILE_ATTRIBUTES of @file */
+static gchar *
+avatar_cache_key_new (GFile     *file,
+		      GFileInfo *info,
+		      gint       width,
+		      gint       height)
+{
+	gchar *path, *key;
+
+	path = g_file_get_path (file);
+	key = g_strdup_printf ("%s\n%" G_GUINT64_FORMAT ".%u\n%"
+		G_GUINT64_FORMAT "\n%dx%d", path,
+		g_file_info_get_attribute_uint64 (info,
+			G_FILE_ATTRIBUTE_TIME_MODIFIED),
+		g_file_info_get_attribute_uint32 (info,
+			G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC),
+		g_file_info_get_attribute_uint64 (info,
+			G_FILE_ATTRIBUTE_STANDARD_SIZE),
+		width, height);
+	g_free (path);
+
+	return key;
+}
+
+/* Returns a borrowed pixbuf */
+static GdkPixbuf *
+avatar_cache_lookup (const gchar *key)
+{
+	AvatarCacheEntry *entry;
+
+	if (avatar_cache == NULL) {
+		return NULL;
+	}
+
+	entry = g_hash_table_lookup (avatar_cache, key);
+	if (entry == NULL) {
+		return NULL;
+	}
+
+	g_queue_unlink (&avatar_cache_lru, entry->link);
+	g_queue_push_head_link (&avatar_cache_lru, entry->link);
+
+	return entry->pixbuf;
+}
+
+static void
+avatar_cache_add (const gchar *key,
+		  GdkPixbuf   *pixbuf)
+{
+	AvatarCacheEntry *entry;
+
+	if (avatar_cache == NULL) {
+		avatar_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+			NULL, (GDestroyNotify) avatar_cache_entry_free);
+	}
+
+	entry = g_slice_new0 (AvatarCacheEntry);
+	entry->key = g_strdup (key);
+	entry->pixbuf = g_object_ref (pixbuf);
+	g_queue_push_head (&avatar_cache_lru, entry);
+	entry->link = avatar_cache_lru.head;
+	avatar_cache_size += avatar_cache_entry_get_size (entry);
+
+	/* Replaces and frees the previous entry, if any, along with its key */
+	g_hash_table_replace (avatar_cache, entry->key, entry);
+
+	while (avatar_cache_size > AVATAR_CACHE_MAX_BYTES &&
+	       avatar_cache_lru.length > 1) {
+		AvatarCacheEntry *last = g_queue_peek_tail (&avatar_cache_lru);
+
+		g_hash_table_remove (avatar_cache, last->key);
+	}
+}
+
+/* Returns the file of the thumbnail of the avatar for @key, or %NULL if it
+ * is not scaled */
+static gchar *
+avatar_thumbnails_dup_dir (void)
+{
+	return g_build_filename (g_get_user_cache_dir (), PACKAGE_NAME,
+				 "avatars", NULL);
+}
+
+static GFile *
+avatar_thumbnail_get_file (const gchar *key,
+			   gint         width,
+			   gint         height)
+{
+	GFile *file;
+	gchar *checksum, *name, *dir, *path;
+
+	if (key == NULL || width <= 0 || height <= 0) {
+		return NULL;
+	}
+
+	checksum = g_compute_checksum_for_string (G_CHECKSUM_MD5, key, -1);
+	name = g_strconcat (checksum, ".png", NULL);
+	dir = avatar_thumbnails_dup_dir ();
+	path = g_build_filename (dir, name, NULL);
+	file = g_file_new_for_path (path);
+
+	g_free (path);
+	g_free (dir);
+	g_free (name);
+	g_free (checksum);
+
+	return file;
+}
+
+static gboolean
+avatar_thumbnails_prune_job (GIOSchedulerJob *job,
+			     GCancellable    *cancellable,
+			     gpointer         user_data)
+{
+	GFile           *dir = user_data;
+	GFileEnumerator *enumerator;
+	GFileInfo       *info;
+	guint64          now;
+
+	enumerator = g_file_enumerate_children (dir,
+		G_FILE_ATTRIBUTE_STANDARD_NAME ","
+		G_FILE_ATTRIBUTE_TIME_MODIFIED,
+		G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, cancellable, NULL);
+	if (enumerator == NULL) {
+		return FALSE;
+	}
+
+	now = g_get_real_time () / G_USEC_PER_SEC;
+
+	while ((info = g_file_enumerator_next_file (enumerator, cancellable,
+						    NULL)) != NULL) {
+		guint64 mtime;
+
+		mtime = g_file_info_get_attribute_uint64 (info,
+			G_FILE_ATTRIBUTE_TIME_MODIFIED);
+
+		if (mtime + AVATAR_THUMBNAIL_MAX_AGE < now) {
+			GFile *file;
+
+			file = g_file_get_child (dir,
+				g_file_info_get_name (info));
+			g_file_delete (file, cancellable, NULL);
+			g_object_unref (file);
+		}
+
+		g_object_unref (info);
+	}
+
+	g_object_unref (enumerator);
+
+	return FALSE;
+}
+
+/* Removes the old thumbnails, once per run, in a thread */
+static void
+avatar_thumbnails_prune (void)
+{
+	static gboolean pruned = FALSE;
+	gchar *path;
+
+	if (pruned) {
+		return;
+	}
+
+	pruned = TRUE;
+
+	path = avatar_thumbnails_dup_dir ();
+	g_io_scheduler_push_job (avatar_thumbnails_prune_job,
+				 g_file_new_for_path (path), g_object_unref,
+				 G_PRIORITY_LOW, NULL);
+	g_free (path);
+}
+
+static GdkPixbuf *
+avatar_thumbnail_load (const gchar *key,
+		       gint         width,
+		       gint         height)
+{
+	GFile     *file;
+	GdkPixbuf *pixbuf = NULL;
+	gchar     *path;
+
+	file = avatar_thumbnail_get_file (key, width, height);
+	if (file == NULL) {
+		return NULL;
+	}
+
+	path = g_file_get_path (file);
+	if (g_file_test (path, G_FILE_TEST_EXISTS)) {
+		pixbuf = gdk_pixbuf_new_from_file (path, NULL);
+	}
+
+	g_free (path);
+	g_object_unref (file);
+
+	return pixbuf;
+}
+
+static void
+avatar_thumbnail_saved_cb (GObject      *object,
+			   GAsyncResult *result,
+			   gpointer      user_data)
+{
+	gchar  *buffer = user_data;
+	GError *error = NULL;
+
+	if (!g_file_replace_contents_finish (G_FILE (object), result, NULL,
+					     &error)) {
+		DEBUG ("Failed to save avatar thumbnail: %s", error->message);
+		g_error_free (error);
+	}
+
+	g_free (buffer);
+}
+
+static void
+avatar_thumbnail_save (const gchar *key,
+		       gint         width,
+		       gint         height,
+		       GdkPixbuf   *pixbuf)
+{
+	GFile  *file, *dir;
+	gchar  *buffer;
+	gsize   len;
+	GError *error = NULL;
+
+	file = avatar_thumbnail_get_file (key, width, height);
+	if (file == NULL) {
+		return;
+	}
+
+	if (!gdk_pixbuf_save_to_buffer (pixbuf, &buffer, &len, "png", &error,
+					NULL)) {
+		DEBUG ("Failed to encode avatar thumbnail: %s", error->message);
+		g_error_free (error);
+		g_object_unref (file);
+		return;
+	}
+
+	dir = g_file_get_parent (file);
+	g_file_make_directory_with_parents (dir, NULL, NULL);
+	g_object_unref (dir);
+
+	avatar_thumbnails_prune ();
+
+	g_file_replace_contents_async (file, buffer, len, NULL, FALSE,
+				       G_FILE_CREATE_PRIVATE, NULL,
+				       avatar_thumbnail_saved_cb, buffer);
+
+	g_object_unref (file);
+}
+
+static GdkPixbuf *
+pixbuf_from_avatar_data_scaled (const guchar *avatar_data,
+				gsize         len,
+				gint          width,
+				gint          height)
 {
 	GdkPixbuf        *pixbuf;
 	GdkPixbufLoader	 *loader;
 	struct SizeData   data;
 	GError           *error = NULL;
 
-	if (!avatar) {
-		return NULL;
-	}
-
 	data.width = width;
 	data.height = height;
 	data.preserve_aspect_ratio = TRUE;
@@ -491,13 +787,13 @@ empathy_pixbuf_from_avatar_scaled (EmpathyAvatar *avatar,
 			  G_CALLBACK (pixbuf_from_avatar_size_prepared_cb),
 			  &data);
 
-	if (avatar->len == 0) {
+	if (len == 0) {
 		g_warning ("Avatar has 0 length");
 		return NULL;
-	} else if (!gdk_pixbuf_loader_write (loader, avatar->data, avatar->len, &error)) {
+	} else if (!gdk_pixbuf_loader_write (loader, avatar_data, len, &error)) {
 		g_warning ("Couldn't write avatar image:%p with "
 			   "length:%" G_GSIZE_FORMAT " to pixbuf loader: %s",
-			   avatar->data, avatar->len, error->message);
+			   avatar_data, len, error->message);
 		g_error_free (error);
 		return NULL;
 	}
@@ -510,16 +806,125 @@ empathy_pixbuf_from_avatar_scaled (EmpathyAvatar *avatar,
 	return pixbuf;
 }
 
+/* Decodes @avatar, or the file @filename if its data hasn't been loaded */
+static GdkPixbuf *
+pixbuf_from_avatar_or_file_scaled (EmpathyAvatar *avatar,
+				   const gchar   *filename,
+				   gint           width,
+				   gint           height)
+{
+	GdkPixbuf *pixbuf;
+	gchar     *data;
+	gsize      len;
+	GError    *error = NULL;
+
+	if (avatar != NULL) {
+		return pixbuf_from_avatar_data_scaled (avatar->data,
+						       avatar->len,
+						       width, height);
+	}
+
+	if (!g_file_get_contents (filename, &data, &len, &error)) {
+		DEBUG ("Failed to read avatar %s: %s", filename,
+		       error->message);
+		g_error_free (error);
+		return NULL;
+	}
+
+	pixbuf = pixbuf_from_avatar_data_scaled ((guchar *) data, len,
+						 width, height);
+	g_free (data);
+
+	return pixbuf;
+}
+
+static GdkPixbuf *
+pixbuf_from_avatar_file_scaled (EmpathyAvatar *avatar,
+				const gchar   *filename,
+				gint           width,
+				gint           height)
+{
+	GdkPixbuf *pixbuf;
+	GFile     *file;
+	GFileInfo *info;
+	gchar     *key;
+
+	file = g_file_new_for_path (filename);
+	info = g_file_query_info (file, AVATAR_FILE_ATTRIBUTES,
+				  G_FILE_QUERY_INFO_NONE, NULL, NULL);
+	if (info == NULL) {
+		g_object_unref (file);
+		return pixbuf_from_avatar_or_file_scaled (avatar, filename,
+							  width, height);
+	}
+
+	key = avatar_cache_key_new (file, info, width, height);
+	g_object_unref (info);
+	g_object_unref (file);
+
+	pixbuf = avatar_cache_lookup (key);
+	if (pixbuf != NULL) {
+		g_free (key);
+		return g_object_ref (pixbuf);
+	}
+
+	pixbuf = avatar_thumbnail_load (key, width, height);
+	if (pixbuf == NULL) {
+		pixbuf = pixbuf_from_avatar_or_file_scaled (avatar, filename,
+							    width, height);
+		if (pixbuf != NULL) {
+			avatar_thumbnail_save (key, width, height, pixbuf);
+		}
+	}
+
+	if (pixbuf != NULL) {
+		avatar_cache_add (key, pixbuf);
+	}
+
+	g_free (key);
+
+	return pixbuf;
+}
+
+GdkPixbuf *
+empathy_pixbuf_from_avatar_scaled (EmpathyAvatar *avatar,
+				  gint          width,
+				  gint          height)
+{
+	if (!avatar) {
+		return NULL;
+	}
+
+	if (avatar->filename == NULL) {
+		return pixbuf_from_avatar_data_scaled (avatar->data,
+						       avatar->len,
+						       width, height);
+	}
+
+	return pixbuf_from_avatar_file_scaled (avatar, avatar->filename,
+					       width, height);
+}
+
 GdkPixbuf *
 empathy_pixbuf_avatar_from_contact_scaled (EmpathyContact *contact,
 					  gint           width,
 					  gint           height)
 {
 	EmpathyAvatar *avatar;
+	const gchar   *path;
 
 	g_return_val_if_fail (EMPATHY_IS_CONTACT (contact), NULL);
 
 	avatar = empathy_contact_get_avatar (contact);
+	path = empathy_contact_get_avatar_path (contact);
+
+	/* Don't render the previous avatar, or none, while the new one is
+	 * still being loaded */
+	if (path != NULL &&
+	    (avatar == NULL || tp_strdiff (avatar->filename, path))) {
+		return pixbuf_from_avatar_file_scaled (NULL, path,
+						       width, height);
+	}
 
 	return empathy_pixbuf_from_avatar_scaled (avatar, width, height);
 }
@@ -527,17 +932,23 @@ empathy_pixbuf_avatar_from_contact_scaled (EmpathyContact *contact,
 typedef struct {
 	FolksIndividual *individual;
 	GSimpleAsyncResult *result;
+	GLoadableIcon *icon;
 	guint width;
 	guint height;
 	struct SizeData size_data;
 	GdkPixbufLoader *loader;
 	GCancellable *cancellable;
+	/* NULL if the avatar can't be cached */
+	gchar *cache_key;
+	/* TRUE if reading the thumbnail rather than the avatar itself */
+	gboolean from_thumbnail;
 	guint8 data[512];
 } PixbufAvatarFromIndividualClosure;
 
 static PixbufAvatarFromIndividualClosure *
 pixbuf_avatar_from_individual_closure_new (FolksIndividual    *individual,
 					   GSimpleAsyncResult *result,
+					   GLoadableIcon      *icon,
 					   gint                width,
 					   gint                height,
 					   GCancellable       *cancellable)
@@ -550,6 +961,7 @@ pixbuf_avatar_from_individual_closure_new (FolksIndividual    *individual,
 	closure = g_new0 (PixbufAvatarFromIndividualClosure, 1);
 	closure->individual = g_object_ref (individual);
 	closure->result = g_object_ref (result);
+	closure->icon = g_object_ref (icon);
 	closure->width = width;
 	closure->height = height;
 	if (cancellable != NULL)
@@ -566,6 +978,8 @@ pixbuf_avatar_from_individual_closure_free (
 	tp_clear_object (&closure->loader);
 	g_object_unref (closure->individual);
 	g_object_unref (closure->result);
+	g_object_unref (closure->icon);
+	g_free (closure->cache_key);
 	g_free (closure);
 }
 
@@ -613,6 +1027,8 @@ avatar_icon_load_read_cb (GObject      *object,
 	}
 
 	if (n_read == 0) {
+		GdkPixbuf *pixbuf;
+
 		/* EOF? */
 		if (!gdk_pixbuf_loader_close (closure->loader, &error)) {
 			DEBUG ("Failed to close pixbuf loader: %s",
@@ -621,10 +1037,22 @@ avatar_icon_load_read_cb (GObject      *object,
 			goto out;
 		}
 
-		/* We're done. */
+		/* We're done. Thumbnails are already rounded. */
+		if (closure->from_thumbnail) {
+			pixbuf = g_object_ref (
+				gdk_pixbuf_loader_get_pixbuf (closure->loader));
+		} else {
+			pixbuf = avatar_pixbuf_from_loader (closure->loader);
+			avatar_thumbnail_save (closure->cache_key,
+				closure->width, closure->height, pixbuf);
+		}
+
+		if (closure->cache_key != NULL) {
+			avatar_cache_add (closure->cache_key, pixbuf);
+		}
+
 		g_simple_async_result_set_op_res_gpointer (closure->result,
-			avatar_pixbuf_from_loader (closure->loader),
-			g_object_unref);
+			pixbuf, g_object_unref);
 
 		goto out;
 	} else {
@@ -654,22 +1082,9 @@ out:
 }
 
 static void
-avatar_icon_load_cb (GObject      *object,
-                     GAsyncResult *result,
-                     gpointer      user_data)
+avatar_icon_load_stream (PixbufAvatarFromIndividualClosure *closure,
+			 GInputStream                      *stream)
 {
-	GLoadableIcon *icon = G_LOADABLE_ICON (object);
-	PixbufAvatarFromIndividualClosure *closure = user_data;
-	GInputStream *stream;
-	GError *error = NULL;
-
-	stream = g_loadable_icon_load_finish (icon, result, NULL, &error);
-	if (error != NULL) {
-		DEBUG ("Failed to open avatar stream: %s", error->message);
-		g_simple_async_result_set_from_error (closure->result, error);
-		goto out;
-	}
-
 	closure->size_data.width = closure->width;
 	closure->size_data.height = closure->height;
 	closure->size_data.preserve_aspect_ratio = TRUE;
@@ -686,7 +1101,26 @@ avatar_icon_load_cb (GObject      *object,
 			G_N_ELEMENTS (closure->data),
 			G_PRIORITY_DEFAULT, closure->cancellable,
 			avatar_icon_load_read_cb, closure);
+}
 
+static void
+avatar_icon_load_cb (GObject      *object,
+                     GAsyncResult *result,
+                     gpointer      user_data)
+{
+	GLoadableIcon *icon = G_LOADABLE_ICON (object);
+	PixbufAvatarFromIndividualClosure *closure = user_data;
+	GInputStream *stream;
+	GError *error = NULL;
+
+	stream = g_loadable_icon_load_finish (icon, result, NULL, &error);
+	if (error != NULL) {
+		DEBUG ("Failed to open avatar stream: %s", error->message);
+		g_simple_async_result_set_from_error (closure->result, error);
+		goto out;
+	}
+
+	avatar_icon_load_stream (closure, stream);
 	g_object_unref (stream);
 
 	return;
@@ -699,6 +1133,80 @@ out:
 	pixbuf_avatar_from_individual_closure_free (closure);
 }
 
+static void
+avatar_thumbnail_read_cb (GObject      *object,
+			  GAsyncResult *result,
+			  gpointer      user_data)
+{
+	PixbufAvatarFromIndividualClosure *closure = user_data;
+	GFileInputStream *stream;
+
+	stream = g_file_read_finish (G_FILE (object), result, NULL);
+	if (stream == NULL) {
+		/* No thumbnail yet, decode the avatar itself */
+		g_loadable_icon_load_async (closure->icon, closure->width,
+			closure->cancellable, avatar_icon_load_cb, closure);
+		return;
+	}
+
+	closure->from_thumbnail = TRUE;
+	avatar_icon_load_stream (closure, G_INPUT_STREAM (stream));
+	g_object_unref (stream);
+}
+
+/* Loads the avatar from the cache, its thumbnail or its file, in this
+ * order */
+static void
+avatar_icon_load_cached (PixbufAvatarFromIndividualClosure *closure)
+{
+	GdkPixbuf *pixbuf = NULL;
+	GFile *thumbnail;
+
+	if (closure->cache_key != NULL) {
+		pixbuf = avatar_cache_lookup (closure->cache_key);
+	}
+
+	if (pixbuf != NULL) {
+		g_simple_async_result_set_op_res_gpointer (closure->result,
+			g_object_ref (pixbuf), g_object_unref);
+
+		g_simple_async_result_complete_in_idle (closure->result);
+		pixbuf_avatar_from_individual_closure_free (closure);
+		return;
+	}
+
+	thumbnail = avatar_thumbnail_get_file (closure->cache_key,
+					       closure->width, closure->height);
+	if (thumbnail != NULL) {
+		g_file_read_async (thumbnail, G_PRIORITY_DEFAULT,
+				   closure->cancellable,
+				   avatar_thumbnail_read_cb, closure);
+		g_object_unref (thumbnail);
+	} else {
+		g_loadable_icon_load_async (closure->icon, closure->width,
+				closure->cancellable, avatar_icon_load_cb,
+				closure);
+	}
+}
+
+static void
+avatar_icon_query_info_cb (GObject      *object,
+			   GAsyncResult *result,
+			   gpointer      user_data)
+{
+	PixbufAvatarFromIndividualClosure *closure = user_data;
+	GFileInfo *info;
+
+	info = g_file_query_info_finish (G_FILE (object), result, NULL);
+	if (info != NULL) {
+		closure->cache_key = avatar_cache_key_new (G_FILE (object),
+			info, closure->width, closure->height);
+		g_object_unref (info);
+	}
+
+	avatar_icon_load_cached (closure);
+}
+
 void
 empathy_pixbuf_avatar_from_individual_scaled_async (
 		FolksIndividual     *individual,
@@ -728,13 +1236,23 @@ empathy_pixbuf_avatar_from_individual_scaled_async (
 	}
 
 	closure = pixbuf_avatar_from_individual_closure_new (individual, result,
+							     avatar_icon,
 							     width, height,
 							     cancellable);
 
 	g_return_if_fail (closure != NULL);
 
-	g_loadable_icon_load_async (avatar_icon, width, cancellable,
-			avatar_icon_load_cb, closure);
+	/* Only avatars stored in local files can be cached */
+	if (G_IS_FILE_ICON (avatar_icon) &&
+	    g_file_is_native (g_file_icon_get_file (G_FILE_ICON (avatar_icon)))) {
+		g_file_query_info_async (
+			g_file_icon_get_file (G_FILE_ICON (avatar_icon)),
+			AVATAR_FILE_ATTRIBUTES, G_FILE_QUERY_INFO_NONE,
+			G_PRIORITY_DEFAULT, cancellable,
+			avatar_icon_query_info_cb, closure);
+	} else {
+		avatar_icon_load_cached (closure);
+	}
 
 	g_object_unref (result);
 }
@@ -2063,6 +2581,32 @@ empathy_get_current_action_time (void)
   return (tp_user_action_time_from_x11 (gtk_get_current_event_time ()));
 }
 
+/* Returns the search key attached to @object, updated to match the first
+ * @len bytes of @str. Keys are only re-stripped when the string changed, so
+ * filtering the roster on each keystroke doesn't redo the unicode work. */
+static EmpathyLiveSearchKey *
+get_live_search_key (gpointer object,
+    const gchar *name,
+    const gchar *str,
+    gssize len)
+{
+  EmpathyLiveSearchKey *key;
+
+  key = g_object_get_data (G_OBJECT (object), name);
+  if (key == NULL)
+    {
+      key = empathy_live_search_key_new (str, len);
+      g_object_set_data_full (G_OBJECT (object), name, key,
+          (GDestroyNotify) empathy_live_search_key_free);
+    }
+  else
+    {
+      empathy_live_search_key_update (key, str, len);
+    }
+
+  return key;
+}
+
 /* @words = empathy_live_search_strip_utf8_string (@text);
  *
  * User has to pass both so we don't have to compute @words ourself each time
@@ -2076,11 +2620,14 @@ empathy_individual_match_string (FolksIndividual *individual,
   GeeSet *personas;
   GeeIterator *iter;
   gboolean retval = FALSE;
+  EmpathyLiveSearchKey *key;
 
   /* check alias name */
   str = folks_alias_details_get_alias (FOLKS_ALIAS_DETAILS (individual));
 
-  if (empathy_live_search_match_words (str, words))
+  key = get_live_search_key (individual, "empathy-live-search-alias-key",
+      str, -1);
+  if (empathy_live_search_key_match (key, words))
     return TRUE;
 
   personas = folks_individual_get_personas (individual);
@@ -2104,16 +2651,15 @@ empathy_individual_match_string (FolksIndividual *individual,
             }
           else
             {
-              gchar *dup_str = NULL;
-              gboolean visible;
+              gssize len = -1;
 
               p = strstr (str, "@");
               if (p != NULL)
-                str = dup_str = g_strndup (str, p - str);
+                len = p - str;
 
-              visible = empathy_live_search_match_words (str, words);
-              g_free (dup_str);
-              if (visible)
+              key = get_live_search_key (persona,
+                  "empathy-live-search-id-key", str, len);
+              if (empathy_live_search_key_match (key, words))
                 retval = TRUE;
             }
         }
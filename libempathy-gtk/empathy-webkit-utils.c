@@ -20,81 +20,183 @@
 
 #include "config.h"
 
+#include <string.h>
+
 #include <glib/gi18n.h>
 
+#include <telepathy-glib/util.h>
+
+#include <libempathy/empathy-utils.h>
+
 #include "empathy-webkit-utils.h"
 #include "empathy-smiley-manager.h"
 #include "empathy-ui-utils.h"
 
 #define BORING_DPI_DEFAULT 96
 
+/* Bounds of the cache of rendered message bodies */
+#define BODY_CACHE_MAX_ENTRIES 2000
+#define BODY_CACHE_MAX_BYTES (4 * 1024 * 1024)
+
+typedef struct
+{
+  /* "<smileys>:<token>", owned, also the key in body_cache */
+  gchar *key;
+  gchar *text;
+  gchar *html;
+  gsize size;
+  /* Link in body_cache_lru, most recently used first */
+  GList *link;
+} BodyCacheEntry;
+
+/* gchar *key -> BodyCacheEntry, owned */
+static GHashTable *body_cache = NULL;
+static GQueue body_cache_lru = G_QUEUE_INIT;
+static gsize body_cache_bytes = 0;
+
+/* Append text, escaped, with \n replaced by <br/> */
 static void
-empathy_webkit_match_newline (const gchar *text,
-    gssize len,
-    EmpathyStringReplace replace_func,
-    EmpathyStringParser *sub_parsers,
-    gpointer user_data)
+webkit_append_text (GString *string,
+    const gchar *text,
+    gsize len)
 {
-  GString *string = user_data;
-  gint i;
-  gint prev = 0;
+  const gchar *end = text + len;
+  const gchar *newline;
 
-  if (len < 0)
-    len = G_MAXSSIZE;
+  while ((newline = memchr (text, '\n', end - text)) != NULL)
+    {
+      empathy_string_append_escaped (string, text, newline - text);
+      g_string_append (string, "<br/>");
+      text = newline + 1;
+    }
+
+  empathy_string_append_escaped (string, text, end - text);
+}
 
-  /* Replace \n by <br/> */
-  for (i = 0; i < len && text[i] != '\0'; i++)
+static void
+webkit_append_body_uncached (GString *string,
+    const gchar *text,
+    gboolean smileys)
+{
+  GArray *spans;
+  guint i;
+
+  spans = g_array_new (FALSE, FALSE, sizeof (EmpathyStringSpan));
+  empathy_string_tokenize (text, -1, smileys, spans);
+
+  for (i = 0; i < spans->len; i++)
     {
-      if (text[i] == '\n')
+      EmpathyStringSpan *span = &g_array_index (spans, EmpathyStringSpan, i);
+      const gchar *str = text + span->start;
+      gint len = span->end - span->start;
+
+      switch (span->type)
         {
-          empathy_string_parser_substr (text + prev, i - prev,
-              sub_parsers, user_data);
-          g_string_append (string, "<br/>");
-          prev = i + 1;
+          case EMPATHY_STRING_SPAN_LINK:
+            empathy_string_replace_link (str, len, NULL, string);
+            break;
+          case EMPATHY_STRING_SPAN_SMILEY:
+            /* Replace smiley by a <img/> tag */
+            g_string_append_printf (string,
+                "<img src=\"%s\" alt=\"%.*s\" title=\"%.*s\"/>",
+                span->path, len, str, len, str);
+            break;
+          case EMPATHY_STRING_SPAN_TEXT:
+          default:
+            webkit_append_text (string, str, len);
+            break;
         }
     }
 
-  empathy_string_parser_substr (text + prev, i - prev,
-              sub_parsers, user_data);
+  g_array_unref (spans);
 }
 
 static void
-empathy_webkit_replace_smiley (const gchar *text,
-    gssize len,
-    gpointer match_data,
-    gpointer user_data)
+body_cache_entry_free (BodyCacheEntry *entry)
 {
-  EmpathySmileyHit *hit = match_data;
-  GString *string = user_data;
+  g_free (entry->key);
+  g_free (entry->text);
+  g_free (entry->html);
+  g_slice_free (BodyCacheEntry, entry);
+}
 
-  /* Replace smiley by a <img/> tag */
-  g_string_append_printf (string,
-      "<img src=\"%s\" alt=\"%.*s\" title=\"%.*s\"/>",
-      hit->path, (int)len, text, (int)len, text);
+static void
+body_cache_remove (BodyCacheEntry *entry)
+{
+  g_queue_delete_link (&body_cache_lru, entry->link);
+  body_cache_bytes -= entry->size;
+  /* frees entry */
+  g_hash_table_remove (body_cache, entry->key);
 }
 
-static EmpathyStringParser string_parsers[] = {
-  { empathy_string_match_link, empathy_string_replace_link },
-  { empathy_webkit_match_newline, NULL },
-  { empathy_string_match_all, empathy_string_replace_escaped },
-  { NULL, NULL}
-};
-
-static EmpathyStringParser string_parsers_with_smiley[] = {
-  { empathy_string_match_link, empathy_string_replace_link },
-  { empathy_string_match_smiley, empathy_webkit_replace_smiley },
-  { empathy_webkit_match_newline, NULL },
-  { empathy_string_match_all, empathy_string_replace_escaped },
-  { NULL, NULL }
-};
-
-EmpathyStringParser *
-empathy_webkit_get_string_parser (gboolean smileys)
+/* Append text to string as HTML, in a single pass: links are replaced by <a/>
+ * tags, smileys by <img/> tags, new lines by <br/> and the rest is escaped.
+ *
+ * Messages having a token are rendered once: the result is kept in a bounded
+ * LRU cache keyed by the token and the parser configuration, so replaying
+ * backlog when a chat is reopened or the theme changes doesn't detect links
+ * and smileys again. */
+void
+empathy_webkit_append_body (GString *string,
+    const gchar *text,
+    const gchar *token,
+    gboolean smileys)
 {
-  if (smileys)
-    return string_parsers_with_smiley;
-  else
-    return string_parsers;
+  BodyCacheEntry *entry;
+  gchar *key;
+  gsize old_len;
+
+  if (EMP_STR_EMPTY (token))
+    {
+      webkit_append_body_uncached (string, text, smileys);
+      return;
+    }
+
+  if (body_cache == NULL)
+    body_cache = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+        (GDestroyNotify) body_cache_entry_free);
+
+  key = g_strdup_printf ("%d:%s", smileys ? 1 : 0, token);
+  entry = g_hash_table_lookup (body_cache, key);
+
+  /* Tokens are only unique per protocol, make sure it's the same text */
+  if (entry != NULL && !tp_strdiff (entry->text, text))
+    {
+      g_queue_unlink (&body_cache_lru, entry->link);
+      g_queue_push_head_link (&body_cache_lru, entry->link);
+
+      g_string_append (string, entry->html);
+      g_free (key);
+      return;
+    }
+
+  if (entry != NULL)
+    body_cache_remove (entry);
+
+  old_len = string->len;
+  webkit_append_body_uncached (string, text, smileys);
+
+  entry = g_slice_new0 (BodyCacheEntry);
+  entry->key = key;
+  entry->text = g_strdup (text);
+  entry->html = g_strndup (string->str + old_len, string->len - old_len);
+  entry->size = strlen (entry->text) + (string->len - old_len);
+
+  /* Don't let one huge message evict everything else */
+  if (entry->size > BODY_CACHE_MAX_BYTES / 4)
+    {
+      body_cache_entry_free (entry);
+      return;
+    }
+
+  g_queue_push_head (&body_cache_lru, entry);
+  entry->link = body_cache_lru.head;
+  body_cache_bytes += entry->size;
+  g_hash_table_insert (body_cache, entry->key, entry);
+
+  while (body_cache_lru.length > BODY_CACHE_MAX_ENTRIES ||
+      body_cache_bytes > BODY_CACHE_MAX_BYTES)
+    body_cache_remove (g_queue_peek_tail (&body_cache_lru));
 }
 
 static gboolean
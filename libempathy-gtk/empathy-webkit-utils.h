@@ -31,7 +31,8 @@ typedef enum {
     EMPATHY_WEBKIT_MENU_CLEAR = 1 << 0,
 } EmpathyWebKitMenuFlags;
 
-EmpathyStringParser *empathy_webkit_get_string_parser (gboolean smileys);
+void empathy_webkit_append_body (GString *string, const gchar *text,
+    const gchar *token, gboolean smileys);
 void empathy_webkit_bind_font_setting (WebKitWebView *webview,
     GSettings *gsettings, const char *key);
 void empathy_webkit_context_menu_for_event (WebKitWebView *view,
@@ -58,6 +58,8 @@ typedef struct {
   gchar *alias;
   gchar *logged_alias;
   EmpathyAvatar *avatar;
+  /* Path of the avatar being loaded or last loaded, NULL if none */
+  gchar *avatar_path;
   TpConnectionPresenceType presence;
   guint handle;
   EmpathyCapabilities capabilities;
@@ -97,7 +99,10 @@ static void set_capabilities_from_tp_caps (EmpathyContact *self,
 static void contact_set_avatar (EmpathyContact *contact,
     EmpathyAvatar *avatar);
 static void contact_set_avatar_from_tp_contact (EmpathyContact *contact);
-static gboolean contact_load_avatar_cache (EmpathyContact *contact,
+static void contact_load_avatar (EmpathyContact *contact,
+    GFile *file,
+    const gchar *format);
+static void contact_load_avatar_cache (EmpathyContact *contact,
     const gchar *token);
 
 G_DEFINE_TYPE (EmpathyContact, empathy_contact, G_TYPE_OBJECT);
@@ -130,6 +135,9 @@ static guint signals[LAST_SIGNAL];
 
 /* TpContact* -> EmpathyContact*, both borrowed ref */
 static GHashTable *contacts_table = NULL;
+/* owned "account path\nidentifier" -> borrowed EmpathyContact*, indexing
+ * the contacts of contacts_table to find the one of a logged entity */
+static GHashTable *contacts_by_id = NULL;
 
 static void
 tp_contact_notify_cb (TpContact *tp_contact,
@@ -437,6 +445,7 @@ contact_finalize (GObject *object)
   g_clear_object (&priv->groups);
   g_free (priv->alias);
   g_free (priv->id);
+  g_free (priv->avatar_path);
   g_strfreev (priv->client_types);
 
   G_OBJECT_CLASS (empathy_contact_parent_class)->finalize (object);
@@ -670,28 +679,48 @@ empathy_contact_new (TpContact *tp_contact)
   return retval;
 }
 
-typedef struct
+static gchar *
+contact_dup_index_key (TpAccount *account,
+    const gchar *id)
 {
-  TplEntity *entity;
-  TpAccount *account;
-} FindContactData;
+  return g_strdup_printf ("%s\n%s", tp_proxy_get_object_path (account), id);
+}
 
-static gboolean
-contact_is_tpl_entity (gpointer key,
-    gpointer value,
-    gpointer user_data)
+static void
+remove_indexed_contact (gpointer data,
+    GObject *object)
 {
-  EmpathyContact *contact = value;
-  FindContactData *data = user_data;
-  TpAccount *account = empathy_contact_get_account (contact);
-  const gchar *path = NULL;
+  gchar *key = data;
+
+  /* It may have been replaced by a newer contact having the same id */
+  if (g_hash_table_lookup (contacts_by_id, key) == (gpointer) object)
+    g_hash_table_remove (contacts_by_id, key);
+
+  g_free (key);
+}
+
+static void
+contact_add_to_index (EmpathyContact *contact)
+{
+  TpAccount *account;
+  const gchar *id;
+  gchar *key;
+
+  account = empathy_contact_get_account (contact);
+  id = empathy_contact_get_id (contact);
+
+  if (account == NULL || id == NULL)
+    return;
 
-  if (account != NULL)
-    path = tp_proxy_get_object_path (account);
+  if (contacts_by_id == NULL)
+    contacts_by_id = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, NULL);
 
-  return !tp_strdiff (empathy_contact_get_id (contact),
-              tpl_entity_get_identifier (data->entity)) &&
-         !tp_strdiff (tp_proxy_get_object_path (data->account), path);
+  key = contact_dup_index_key (account, id);
+  g_hash_table_replace (contacts_by_id, key, contact);
+
+  g_object_weak_ref (G_OBJECT (contact), remove_indexed_contact,
+      g_strdup (key));
 }
 
 static void
@@ -732,15 +761,14 @@ empathy_contact_from_tpl_contact (TpAccount *account,
 
   g_return_val_if_fail (TPL_IS_ENTITY (tpl_entity), NULL);
 
-  if (contacts_table != NULL)
+  if (contacts_by_id != NULL)
     {
-      FindContactData data;
-
-      data.entity = tpl_entity;
-      data.account = account;
+      gchar *key;
 
-      existing_contact = g_hash_table_find (contacts_table,
-        contact_is_tpl_entity, &data);
+      key = contact_dup_index_key (account,
+          tpl_entity_get_identifier (tpl_entity));
+      existing_contact = g_hash_table_lookup (contacts_by_id, key);
+      g_free (key);
     }
 
   if (existing_contact != NULL)
@@ -945,6 +973,28 @@ empathy_contact_get_avatar (EmpathyContact *contact)
   return priv->avatar;
 }
 
+/**
+ * empathy_contact_get_avatar_path:
+ * @contact: an #EmpathyContact
+ *
+ * Returns the file of the avatar of @contact. It is known as soon as the
+ * avatar changes, so it can differ from the filename of
+ * empathy_contact_get_avatar() while the new avatar is being loaded.
+ *
+ * Returns: the path of the avatar file, or %NULL if it has none
+ */
+const gchar *
+empathy_contact_get_avatar_path (EmpathyContact *contact)
+{
+  EmpathyContactPriv *priv;
+
+  g_return_val_if_fail (EMPATHY_IS_CONTACT (contact), NULL);
+
+  priv = GET_PRIV (contact);
+
+  return priv->avatar_path;
+}
+
 static void
 contact_set_avatar (EmpathyContact *contact,
                     EmpathyAvatar *avatar)
@@ -1339,7 +1389,6 @@ contact_get_avatar_filename (EmpathyContact *contact,
                              const gchar *token)
 {
   TpAccount *account;
-  gchar *avatar_path;
   gchar *avatar_file;
   gchar *token_escaped;
 
@@ -1349,59 +1398,245 @@ contact_get_avatar_filename (EmpathyContact *contact,
   token_escaped = tp_escape_as_identifier (token);
   account = empathy_contact_get_account (contact);
 
-  avatar_path = g_build_filename (g_get_user_cache_dir (),
+  /* The directory is created by telepathy-glib when it saves an avatar, we
+   * only read from it */
+  avatar_file = g_build_filename (g_get_user_cache_dir (),
       "telepathy",
       "avatars",
       tp_account_get_connection_manager (account),
       tp_account_get_protocol (account),
+      token_escaped,
       NULL);
-  g_mkdir_with_parents (avatar_path, 0700);
-
-  avatar_file = g_build_filename (avatar_path, token_escaped, NULL);
 
   g_free (token_escaped);
-  g_free (avatar_path);
 
   return avatar_file;
 }
 
-static gboolean
-contact_load_avatar_cache (EmpathyContact *contact,
-                           const gchar *token)
+/* Avatars are loaded from the cache of telepathy-glib, where their files are
+ * named after their token. Contacts having the same avatar share the same
+ * EmpathyAvatar rather than each loading a copy of it.
+ * borrowed path -> borrowed EmpathyAvatar, removed when it is freed */
+static GHashTable *loaded_avatars = NULL;
+/* owned path -> owned GPtrArray of owned EmpathyContact waiting for it */
+static GHashTable *loading_avatars = NULL;
+/* owned EmpathyAvatar, the most recently used first. Keeps the avatars of
+ * short lived contacts, like the ones of logged events, loaded between
+ * them */
+static GQueue recent_avatars = G_QUEUE_INIT;
+#define RECENT_AVATARS_MAX 64
+
+typedef struct
+{
+  gchar *path;
+  gchar *format;
+} AvatarLoadData;
+
+static void
+contact_avatar_used (EmpathyAvatar *avatar)
+{
+  GList *l;
+
+  l = g_queue_find (&recent_avatars, avatar);
+  if (l != NULL)
+    {
+      g_queue_unlink (&recent_avatars, l);
+      g_queue_push_head_link (&recent_avatars, l);
+      return;
+    }
+
+  g_queue_push_head (&recent_avatars, empathy_avatar_ref (avatar));
+
+  if (recent_avatars.length > RECENT_AVATARS_MAX)
+    empathy_avatar_unref (g_queue_pop_tail (&recent_avatars));
+}
+
+static EmpathyAvatar *
+avatar_new_take (guchar *data,
+    gsize len,
+    const gchar *format,
+    const gchar *filename)
+{
+  EmpathyAvatar *avatar;
+
+  avatar = g_slice_new0 (EmpathyAvatar);
+  avatar->data = data;
+  avatar->len = len;
+  avatar->format = g_strdup (format);
+  avatar->filename = g_strdup (filename);
+  avatar->refcount = 1;
+
+  return avatar;
+}
+
+/* Keeps the current avatar of @contact when loading the one in
+ * @failed_path failed, or goes back to the avatar of its TpContact if
+ * loading it was replaced by this one */
+static void
+contact_avatar_load_failed (EmpathyContact *contact,
+    const gchar *failed_path)
+{
+  EmpathyContactPriv *priv = GET_PRIV (contact);
+  GFile *file;
+  gchar *path;
+
+  g_free (priv->avatar_path);
+  priv->avatar_path = NULL;
+
+  if (priv->avatar != NULL)
+    priv->avatar_path = g_strdup (priv->avatar->filename);
+
+  if (priv->tp_contact == NULL)
+    return;
+
+  file = tp_contact_get_avatar_file (priv->tp_contact);
+  if (file == NULL)
+    return;
+
+  path = g_file_get_path (file);
+
+  if (tp_strdiff (path, failed_path) && tp_strdiff (path, priv->avatar_path))
+    contact_load_avatar (contact, file,
+        tp_contact_get_avatar_mime_type (priv->tp_contact));
+
+  g_free (path);
+}
+
+static void
+contact_avatar_loaded_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
 {
+  AvatarLoadData *load = user_data;
   EmpathyAvatar *avatar = NULL;
-  gchar *filename;
-  gchar *data = NULL;
+  GPtrArray *contacts;
+  gchar *data;
   gsize len;
+  guint i;
   GError *error = NULL;
 
-  g_return_val_if_fail (EMPATHY_IS_CONTACT (contact), FALSE);
-  g_return_val_if_fail (!EMP_STR_EMPTY (token), FALSE);
+  if (g_file_load_contents_finish (G_FILE (source), result, &data, &len,
+        NULL, &error))
+    {
+      /* The loaded buffer is used as is */
+      avatar = avatar_new_take ((guchar *) data, len, load->format,
+          load->path);
 
-  /* Load the avatar from file if it exists */
-  filename = contact_get_avatar_filename (contact, token);
-  if (filename && g_file_test (filename, G_FILE_TEST_EXISTS))
+      if (loaded_avatars == NULL)
+        loaded_avatars = g_hash_table_new (g_str_hash, g_str_equal);
+
+      g_hash_table_replace (loaded_avatars, avatar->filename, avatar);
+      contact_avatar_used (avatar);
+    }
+  else
     {
-      if (!g_file_get_contents (filename, &data, &len, &error))
-        {
-          DEBUG ("Failed to load avatar from cache: %s",
-            error ? error->message : "No error given");
-          g_clear_error (&error);
-        }
+      DEBUG ("Failed to load avatar %s: %s", load->path, error->message);
+      g_error_free (error);
+    }
+
+  contacts = g_ptr_array_ref (g_hash_table_lookup (loading_avatars,
+        load->path));
+  g_hash_table_remove (loading_avatars, load->path);
+
+  for (i = 0; i < contacts->len; i++)
+    {
+      EmpathyContact *contact = g_ptr_array_index (contacts, i);
+      EmpathyContactPriv *priv = GET_PRIV (contact);
+
+      /* Its avatar may have changed again in the meantime */
+      if (tp_strdiff (priv->avatar_path, load->path))
+        continue;
+
+      if (avatar != NULL)
+        contact_set_avatar (contact, avatar);
+      else
+        contact_avatar_load_failed (contact, load->path);
     }
 
-  if (data != NULL)
+  g_ptr_array_unref (contacts);
+
+  if (avatar != NULL)
+    empathy_avatar_unref (avatar);
+
+  g_free (load->path);
+  g_free (load->format);
+  g_slice_free (AvatarLoadData, load);
+}
+
+/* Sets the avatar of @contact to the one in @file once it has been loaded,
+ * without blocking on the disk, unless another contact already has it */
+static void
+contact_load_avatar (EmpathyContact *contact,
+    GFile *file,
+    const gchar *format)
+{
+  EmpathyContactPriv *priv = GET_PRIV (contact);
+  EmpathyAvatar *avatar = NULL;
+  GPtrArray *contacts;
+
+  g_free (priv->avatar_path);
+  priv->avatar_path = g_file_get_path (file);
+
+  if (priv->avatar_path == NULL)
+    {
+      DEBUG ("Avatar is not a local file");
+      contact_set_avatar (contact, NULL);
+      return;
+    }
+
+  if (loaded_avatars != NULL)
+    avatar = g_hash_table_lookup (loaded_avatars, priv->avatar_path);
+
+  if (avatar != NULL)
     {
-      DEBUG ("Avatar loaded from %s", filename);
-      avatar = empathy_avatar_new ((guchar *) data, len, NULL, filename);
+      contact_avatar_used (avatar);
       contact_set_avatar (contact, avatar);
-      empathy_avatar_unref (avatar);
+      return;
     }
 
-  g_free (data);
-  g_free (filename);
+  if (loading_avatars == NULL)
+    loading_avatars = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, (GDestroyNotify) g_ptr_array_unref);
+
+  contacts = g_hash_table_lookup (loading_avatars, priv->avatar_path);
+
+  if (contacts == NULL)
+    {
+      AvatarLoadData *load;
+
+      contacts = g_ptr_array_new_with_free_func (g_object_unref);
+      g_hash_table_insert (loading_avatars, g_strdup (priv->avatar_path),
+          contacts);
+
+      load = g_slice_new0 (AvatarLoadData);
+      load->path = g_strdup (priv->avatar_path);
+      load->format = g_strdup (format);
+
+      g_file_load_contents_async (file, NULL, contact_avatar_loaded_cb, load);
+    }
+
+  g_ptr_array_add (contacts, g_object_ref (contact));
+}
+
+static void
+contact_load_avatar_cache (EmpathyContact *contact,
+                           const gchar *token)
+{
+  gchar *filename;
+  GFile *file;
+
+  g_return_if_fail (EMPATHY_IS_CONTACT (contact));
+  g_return_if_fail (!EMP_STR_EMPTY (token));
+
+  filename = contact_get_avatar_filename (contact, token);
+  if (filename == NULL)
+    return;
+
+  file = g_file_new_for_path (filename);
+  contact_load_avatar (contact, file, NULL);
 
-  return data != NULL;
+  g_object_unref (file);
+  g_free (filename);
 }
 
 GType
@@ -1436,16 +1671,7 @@ empathy_avatar_new (const guchar *data,
                     const gchar *format,
                     const gchar *filename)
 {
-  EmpathyAvatar *avatar;
-
-  avatar = g_slice_new0 (EmpathyAvatar);
-  avatar->data = g_memdup (data, len);
-  avatar->len = len;
-  avatar->format = g_strdup (format);
-  avatar->filename = g_strdup (filename);
-  avatar->refcount = 1;
-
-  return avatar;
+  return avatar_new_take (g_memdup (data, len), len, format, filename);
 }
 
 void
@@ -1456,6 +1682,10 @@ empathy_avatar_unref (EmpathyAvatar *avatar)
   avatar->refcount--;
   if (avatar->refcount == 0)
     {
+      if (avatar->filename != NULL && loaded_avatars != NULL &&
+          g_hash_table_lookup (loaded_avatars, avatar->filename) == avatar)
+        g_hash_table_remove (loaded_avatars, avatar->filename);
+
       g_free (avatar->data);
       g_free (avatar->format);
       g_free (avatar->filename);
@@ -1814,40 +2044,18 @@ static void
 contact_set_avatar_from_tp_contact (EmpathyContact *contact)
 {
   EmpathyContactPriv *priv = GET_PRIV (contact);
-  const gchar *mime;
   GFile *file;
 
-  mime = tp_contact_get_avatar_mime_type (priv->tp_contact);
   file = tp_contact_get_avatar_file (priv->tp_contact);
 
   if (file != NULL)
     {
-      EmpathyAvatar *avatar;
-      gchar *data;
-      gsize len;
-      gchar *path;
-      GError *error = NULL;
-
-      if (!g_file_load_contents (file, NULL, &data, &len, NULL, &error))
-        {
-          DEBUG ("Failed to load avatar: %s", error->message);
-
-          g_error_free (error);
-          contact_set_avatar (contact, NULL);
-          return;
-        }
-
-      path = g_file_get_path (file);
-
-      avatar = empathy_avatar_new ((guchar *) data, len, mime, path);
-
-      contact_set_avatar (contact, avatar);
-      empathy_avatar_unref (avatar);
-      g_free (path);
-      g_free (data);
+      contact_load_avatar (contact, file,
+          tp_contact_get_avatar_mime_type (priv->tp_contact));
     }
   else
     {
+      tp_clear_pointer (&priv->avatar_path, g_free);
       contact_set_avatar (contact, NULL);
     }
 }
@@ -1872,6 +2080,7 @@ empathy_contact_dup_from_tp_contact (TpContact *tp_contact)
        * contact keeps a ref to tp_contact, and is removed from the table in
        * contact_dispose() */
       g_hash_table_insert (contacts_table, tp_contact, contact);
+      contact_add_to_index (contact);
     }
   else
     {
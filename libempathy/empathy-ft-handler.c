@@ -21,8 +21,16 @@
 
 /* empathy-ft-handler.c */
 
+#include <config.h>
+
+#include <sys/stat.h>
+
 #include <glib.h>
 #include <glib/gi18n.h>
+#ifdef G_OS_UNIX
+#include <fcntl.h>
+#include <gio/gfiledescriptorbased.h>
+#endif
 #include <telepathy-glib/account-channel-request.h>
 #include <telepathy-glib/util.h>
 #include <telepathy-glib/dbus.h>
@@ -73,7 +81,16 @@ G_DEFINE_TYPE (EmpathyFTHandler, empathy_ft_handler, G_TYPE_OBJECT)
 
 #define GET_PRIV(obj) EMPATHY_GET_PRIV (obj, EmpathyFTHandler)
 
-#define BUFFER_SIZE 4096
+/* Hashing reads the whole file with a single buffer of this size */
+#define BUFFER_SIZE (1024 * 1024)
+/* Minimum microseconds between two ::hashing-progress signals */
+#define HASHING_PROGRESS_INTERVAL (G_USEC_PER_SEC / 4)
+
+/* The hashes of the last sent files are kept in this file of the user cache
+ * directory, so that they don't have to be computed again when the same file
+ * is sent again. */
+#define HASH_CACHE_FILENAME "ft-hash-cache"
+#define HASH_CACHE_MAX_FILES 64
 
 enum {
   PROP_CHANNEL = 1,
@@ -104,11 +121,19 @@ typedef struct {
   GError *error /* comment to make the style checker happy */;
   guchar *buffer;
   GChecksum *checksum;
-  gssize total_read;
+  guint64 total_read;
   guint64 total_bytes;
+  gint64 last_progress_time;
   EmpathyFTHandler *handler;
 } HashingData;
 
+/* A snapshot of the progress, as the hashing thread carries on meanwhile */
+typedef struct {
+  EmpathyFTHandler *handler;
+  guint64 total_read;
+  guint64 total_bytes;
+} HashingProgress;
+
 typedef struct {
   EmpathyFTHandlerReadyCallback callback;
   gpointer user_data;
@@ -135,6 +160,9 @@ typedef struct {
   guint64 total_bytes;
   guint64 transferred_bytes;
   guint64 mtime;
+  /* identifies the version of an outgoing file in the hash cache, NULL if
+   * it can't be cached */
+  gchar *file_stamp;
   gchar *content_hash;
   TpFileHashType content_hash_type;
 
@@ -146,12 +174,23 @@ typedef struct {
   gint64 last_update_time;
 
   gboolean is_completed;
+
+  /* incoming files are hashed while they are being received */
+  HashingData *incoming_hash;
+  gchar *incoming_hash_stream_id;
+  gchar *incoming_hash_target_id;
+  gboolean incoming_hash_target_checked;
+  gboolean incoming_hash_reading;
+  gboolean incoming_hash_finishing;
 } EmpathyFTHandlerPriv;
 
 static guint signals[LAST_SIGNAL] = { 0 };
 
 static gboolean do_hash_job_incoming (GIOSchedulerJob *job,
     GCancellable *cancellable, gpointer user_data);
+static gboolean hash_job_done (gpointer user_data);
+static void hash_stream_advise_sequential (GInputStream *stream);
+static void incoming_hash_stop (EmpathyFTHandler *handler);
 
 /* GObject implementations */
 static void
@@ -254,6 +293,8 @@ do_dispose (GObject *object)
 
   priv->dispose_run = TRUE;
 
+  incoming_hash_stop (EMPATHY_FT_HANDLER (object));
+
   if (priv->contact != NULL) {
     g_object_unref (priv->contact);
     priv->contact = NULL;
@@ -303,6 +344,9 @@ do_finalize (GObject *object)
   g_free (priv->content_hash);
   priv->content_hash = NULL;
 
+  g_free (priv->file_stamp);
+  priv->file_stamp = NULL;
+
   G_OBJECT_CLASS (empathy_ft_handler_parent_class)->finalize (object);
 }
 
@@ -599,25 +643,539 @@ tp_file_hash_to_g_checksum (TpFileHashType type)
   return retval;
 }
 
+static const gchar *
+tp_file_hash_to_cache_key (TpFileHashType type)
+{
+  switch (type)
+    {
+      case TP_FILE_HASH_TYPE_MD5:
+        return "md5";
+      case TP_FILE_HASH_TYPE_SHA1:
+        return "sha1";
+      case TP_FILE_HASH_TYPE_SHA256:
+        return "sha256";
+      case TP_FILE_HASH_TYPE_NONE:
+      default:
+        g_assert_not_reached ();
+        return NULL;
+    }
+}
+
+static gchar *
+hash_cache_get_filename (void)
+{
+  return g_build_filename (g_get_user_cache_dir (), PACKAGE_NAME,
+      HASH_CACHE_FILENAME, NULL);
+}
+
+/* The cache has a group per file, named after the checksum of its path as
+ * paths can contain characters which aren't allowed in group names. It
+ * contains the path and the stamp of the file, and its hash for each type */
+static GKeyFile *
+hash_cache_get (void)
+{
+  static GKeyFile *cache = NULL;
+  gchar *filename;
+  GError *error = NULL;
+
+  if (cache != NULL)
+    return cache;
+
+  cache = g_key_file_new ();
+  filename = hash_cache_get_filename ();
+
+  if (!g_key_file_load_from_file (cache, filename, G_KEY_FILE_NONE, &error))
+    {
+      if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        DEBUG ("Failed to load the hash cache: %s", error->message);
+
+      g_error_free (error);
+    }
+
+  g_free (filename);
+
+  return cache;
+}
+
 static void
-check_hash_incoming (EmpathyFTHandler *handler)
+hash_cache_saved_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  gchar *data = user_data;
+  GError *error = NULL;
+
+  if (!g_file_replace_contents_finish (G_FILE (source), result, NULL,
+        &error))
+    {
+      DEBUG ("Failed to save the hash cache: %s", error->message);
+      g_error_free (error);
+    }
+
+  g_free (data);
+}
+
+static void
+hash_cache_save (GKeyFile *cache)
+{
+  gchar *filename, *dir, *data;
+  GFile *file;
+  gsize length;
+
+  filename = hash_cache_get_filename ();
+
+  dir = g_path_get_dirname (filename);
+  if (!g_file_test (dir, G_FILE_TEST_EXISTS | G_FILE_TEST_IS_DIR))
+    g_mkdir_with_parents (dir, S_IRUSR | S_IWUSR | S_IXUSR);
+
+  data = g_key_file_to_data (cache, &length, NULL);
+
+  /* data is freed once it has been written */
+  file = g_file_new_for_path (filename);
+  g_file_replace_contents_async (file, data, length, NULL, FALSE,
+      G_FILE_CREATE_PRIVATE, NULL, hash_cache_saved_cb, data);
+
+  g_object_unref (file);
+  g_free (dir);
+  g_free (filename);
+}
+
+static gchar *
+hash_cache_dup_group (const gchar *path)
+{
+  return g_compute_checksum_for_string (G_CHECKSUM_SHA1, path, -1);
+}
+
+/* Moves @group to the end of @cache, where the most recently used files
+ * are */
+static void
+hash_cache_touch (GKeyFile *cache,
+    const gchar *group)
+{
+  gchar **keys, **values;
+  gsize n_keys, i;
+
+  keys = g_key_file_get_keys (cache, group, &n_keys, NULL);
+  if (keys == NULL)
+    return;
+
+  values = g_new0 (gchar *, n_keys + 1);
+  for (i = 0; i < n_keys; i++)
+    values[i] = g_key_file_get_value (cache, group, keys[i], NULL);
+
+  g_key_file_remove_group (cache, group, NULL);
+
+  for (i = 0; i < n_keys; i++)
+    g_key_file_set_value (cache, group, keys[i], values[i]);
+
+  g_strfreev (values);
+  g_strfreev (keys);
+}
+
+/* Returns the hash of the outgoing file computed when it was last sent, if
+ * it didn't change since then. The file is marked as used in memory only,
+ * the caller saves the cache once the file is offered. */
+static gchar *
+hash_cache_lookup (EmpathyFTHandler *handler,
+    TpFileHashType type)
+{
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+  GKeyFile *cache;
+  gchar *path, *group, *cached_path, *stamp;
+  gchar *hash = NULL;
+
+  if (priv->file_stamp == NULL)
+    return NULL;
+
+  path = g_file_get_path (priv->gfile);
+  if (path == NULL)
+    return NULL;
+
+  cache = hash_cache_get ();
+  group = hash_cache_dup_group (path);
+  cached_path = g_key_file_get_string (cache, group, "path", NULL);
+  stamp = g_key_file_get_string (cache, group, "stamp", NULL);
+
+  if (!tp_strdiff (cached_path, path) &&
+      !tp_strdiff (stamp, priv->file_stamp))
+    hash = g_key_file_get_string (cache, group,
+        tp_file_hash_to_cache_key (type), NULL);
+
+  if (hash != NULL)
+    hash_cache_touch (cache, group);
+
+  g_free (stamp);
+  g_free (cached_path);
+  g_free (group);
+  g_free (path);
+
+  return hash;
+}
+
+static void
+hash_cache_store (EmpathyFTHandler *handler,
+    TpFileHashType type,
+    const gchar *hash)
+{
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+  GKeyFile *cache;
+  gchar *path, *group, *cached_path, *stamp;
+  gchar **groups;
+  gsize n_groups, i;
+
+  if (priv->file_stamp == NULL)
+    return;
+
+  path = g_file_get_path (priv->gfile);
+  if (path == NULL)
+    return;
+
+  cache = hash_cache_get ();
+  group = hash_cache_dup_group (path);
+
+  /* Forget the hashes of the previous version of the file */
+  cached_path = g_key_file_get_string (cache, group, "path", NULL);
+  stamp = g_key_file_get_string (cache, group, "stamp", NULL);
+  if (tp_strdiff (cached_path, path) || tp_strdiff (stamp, priv->file_stamp))
+    g_key_file_remove_group (cache, group, NULL);
+  else
+    hash_cache_touch (cache, group);
+
+  g_key_file_set_string (cache, group, "path", path);
+  g_key_file_set_string (cache, group, "stamp", priv->file_stamp);
+  g_key_file_set_string (cache, group, tp_file_hash_to_cache_key (type), hash);
+
+  /* Groups are kept from the least to the most recently used, drop the
+   * oldest ones */
+  groups = g_key_file_get_groups (cache, &n_groups);
+  for (i = 0; i + HASH_CACHE_MAX_FILES < n_groups; i++)
+    g_key_file_remove_group (cache, groups[i], NULL);
+
+  hash_cache_save (cache);
+
+  g_strfreev (groups);
+  g_free (stamp);
+  g_free (cached_path);
+  g_free (group);
+  g_free (path);
+}
+
+/* Reads the whole received file again and checks its hash */
+static void
+hash_incoming_file (EmpathyFTHandler *handler)
 {
   HashingData *hash_data;
   EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
 
-  if (!EMP_STR_EMPTY (priv->content_hash))
+  hash_data = g_slice_new0 (HashingData);
+  hash_data->total_bytes = priv->total_bytes;
+  hash_data->handler = g_object_ref (handler);
+  hash_data->checksum = g_checksum_new
+    (tp_file_hash_to_g_checksum (priv->content_hash_type));
+
+  g_io_scheduler_push_job (do_hash_job_incoming, hash_data, NULL,
+                           G_PRIORITY_DEFAULT, priv->cancellable);
+}
+
+/* While an incoming file is being received, each time the transferred bytes
+ * grow we read back what has already been written to the destination, so
+ * that once the transfer is completed only its tail is left to hash.
+ * priv->incoming_hash doesn't hold a reference on the handler, each pending
+ * operation does instead. */
+
+static void
+incoming_hash_stop (EmpathyFTHandler *handler)
+{
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+
+  tp_clear_pointer (&priv->incoming_hash, hash_data_free);
+  tp_clear_pointer (&priv->incoming_hash_stream_id, g_free);
+  tp_clear_pointer (&priv->incoming_hash_target_id, g_free);
+  priv->incoming_hash_target_checked = FALSE;
+  priv->incoming_hash_finishing = FALSE;
+}
+
+static void
+incoming_hash_fallback (EmpathyFTHandler *handler)
+{
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+
+  incoming_hash_stop (handler);
+
+  /* If the transfer isn't over yet, check_hash_incoming() will do it */
+  if (priv->is_completed)
+    hash_incoming_file (handler);
+}
+
+static void
+incoming_hash_done (EmpathyFTHandler *handler)
+{
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+  HashingData *hash_data = priv->incoming_hash;
+
+  priv->incoming_hash = NULL;
+  incoming_hash_stop (handler);
+
+  g_signal_emit (handler, signals[HASHING_PROGRESS], 0,
+      hash_data->total_read, hash_data->total_bytes);
+
+  /* hash_job_done() drops this reference along with hash_data */
+  hash_data->handler = g_object_ref (handler);
+  hash_job_done (hash_data);
+}
+
+static void incoming_hash_read (EmpathyFTHandler *handler);
+
+static void
+incoming_hash_maybe_finish (EmpathyFTHandler *handler)
+{
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+  HashingData *hash_data = priv->incoming_hash;
+
+  /* Wait for the stream to be opened and for the pending read */
+  if (hash_data == NULL || hash_data->stream == NULL ||
+      !priv->incoming_hash_target_checked || priv->incoming_hash_reading)
+    return;
+
+  /* When the destination already existed, GLib may have written the new file
+   * next to it and renamed it over the destination once done, in which case
+   * we have been reading the old one. */
+  if (priv->incoming_hash_stream_id == NULL ||
+      tp_strdiff (priv->incoming_hash_stream_id,
+          priv->incoming_hash_target_id))
     {
-      hash_data = g_slice_new0 (HashingData);
-      hash_data->total_bytes = priv->total_bytes;
-      hash_data->handler = g_object_ref (handler);
-      hash_data->checksum = g_checksum_new
-        (tp_file_hash_to_g_checksum (priv->content_hash_type));
+      DEBUG ("Destination has been replaced, hashing the whole file again");
+      incoming_hash_fallback (handler);
+      return;
+    }
 
-      g_signal_emit (handler, signals[HASHING_STARTED], 0);
+  priv->incoming_hash_finishing = TRUE;
+  incoming_hash_read (handler);
+}
 
-      g_io_scheduler_push_job (do_hash_job_incoming, hash_data, NULL,
-                               G_PRIORITY_DEFAULT, priv->cancellable);
+static void
+incoming_hash_read_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyFTHandler *handler = user_data;
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+  HashingData *hash_data = priv->incoming_hash;
+  gssize bytes_read;
+  GError *error = NULL;
+
+  priv->incoming_hash_reading = FALSE;
+
+  bytes_read = g_input_stream_read_finish (G_INPUT_STREAM (source), result,
+      &error);
+
+  if (bytes_read < 0)
+    {
+      if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        {
+          DEBUG ("Failed to read the file being received: %s",
+              error->message);
+          incoming_hash_fallback (handler);
+        }
+
+      g_error_free (error);
+      goto out;
     }
+
+  if (bytes_read > 0)
+    {
+      hash_data->total_read += bytes_read;
+      g_checksum_update (hash_data->checksum, hash_data->buffer, bytes_read);
+
+      if (priv->incoming_hash_finishing)
+        {
+          gint64 now = g_get_monotonic_time ();
+
+          if (now - hash_data->last_progress_time >=
+              HASHING_PROGRESS_INTERVAL)
+            {
+              hash_data->last_progress_time = now;
+              g_signal_emit (handler, signals[HASHING_PROGRESS], 0,
+                  hash_data->total_read, hash_data->total_bytes);
+            }
+        }
+    }
+
+  if (priv->incoming_hash_finishing)
+    {
+      if (bytes_read == 0)
+        incoming_hash_done (handler);
+      else
+        incoming_hash_read (handler);
+    }
+  else if (priv->incoming_hash_target_checked)
+    {
+      incoming_hash_maybe_finish (handler);
+    }
+  else if (bytes_read > 0)
+    {
+      /* Catch up with the transfer; at the end of what has been written so
+       * far, wait for the next transferred bytes notification. */
+      incoming_hash_read (handler);
+    }
+
+out:
+  g_object_unref (handler);
+}
+
+static void
+incoming_hash_read (EmpathyFTHandler *handler)
+{
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+  HashingData *hash_data = priv->incoming_hash;
+
+  if (hash_data == NULL || hash_data->stream == NULL ||
+      priv->incoming_hash_reading)
+    return;
+
+  if (!priv->incoming_hash_finishing &&
+      hash_data->total_read >= priv->transferred_bytes)
+    return;
+
+  priv->incoming_hash_reading = TRUE;
+
+  /* Short reads are fine, we only get what has reached the file */
+  g_input_stream_read_async (hash_data->stream, hash_data->buffer,
+      BUFFER_SIZE, G_PRIORITY_LOW, priv->cancellable,
+      incoming_hash_read_cb, g_object_ref (handler));
+}
+
+static void
+incoming_hash_open_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyFTHandler *handler = user_data;
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+  GFileInputStream *stream;
+  GFileInfo *info;
+  GError *error = NULL;
+
+  stream = g_file_read_finish (G_FILE (source), result, &error);
+  if (stream == NULL)
+    {
+      if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        {
+          DEBUG ("Failed to open the file being received: %s",
+              error->message);
+          incoming_hash_fallback (handler);
+        }
+
+      g_error_free (error);
+      goto out;
+    }
+
+  priv->incoming_hash->stream = G_INPUT_STREAM (stream);
+  hash_stream_advise_sequential (priv->incoming_hash->stream);
+
+  /* Remember which file we are reading, see incoming_hash_maybe_finish() */
+  info = g_file_input_stream_query_info (stream, G_FILE_ATTRIBUTE_ID_FILE,
+      NULL, NULL);
+  if (info != NULL)
+    {
+      priv->incoming_hash_stream_id = g_strdup (
+          g_file_info_get_attribute_string (info, G_FILE_ATTRIBUTE_ID_FILE));
+      g_object_unref (info);
+    }
+
+  if (priv->incoming_hash_target_checked)
+    incoming_hash_maybe_finish (handler);
+  else
+    incoming_hash_read (handler);
+
+out:
+  g_object_unref (handler);
+}
+
+static void
+incoming_hash_start (EmpathyFTHandler *handler)
+{
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+  HashingData *hash_data;
+
+  if (!priv->use_hash || EMP_STR_EMPTY (priv->content_hash) ||
+      priv->incoming_hash != NULL || priv->is_completed)
+    return;
+
+  DEBUG ("Hashing the incoming file while receiving it");
+
+  hash_data = g_slice_new0 (HashingData);
+  hash_data->total_bytes = priv->total_bytes;
+  hash_data->buffer = g_malloc (BUFFER_SIZE);
+  hash_data->checksum = g_checksum_new
+    (tp_file_hash_to_g_checksum (priv->content_hash_type));
+  priv->incoming_hash = hash_data;
+
+  g_file_read_async (priv->gfile, G_PRIORITY_LOW, priv->cancellable,
+      incoming_hash_open_cb, g_object_ref (handler));
+}
+
+static void
+incoming_hash_target_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyFTHandler *handler = user_data;
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+  GFileInfo *info;
+  GError *error = NULL;
+
+  info = g_file_query_info_finish (G_FILE (source), result, &error);
+  if (info == NULL)
+    {
+      if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        {
+          g_error_free (error);
+          goto out;
+        }
+
+      DEBUG ("Failed to query the received file: %s", error->message);
+      g_error_free (error);
+    }
+  else
+    {
+      priv->incoming_hash_target_id = g_strdup (
+          g_file_info_get_attribute_string (info, G_FILE_ATTRIBUTE_ID_FILE));
+      g_object_unref (info);
+    }
+
+  /* We may have fallen back to hashing the whole file meanwhile */
+  if (priv->incoming_hash == NULL)
+    goto out;
+
+  priv->incoming_hash_target_checked = TRUE;
+  incoming_hash_maybe_finish (handler);
+
+out:
+  g_object_unref (handler);
+}
+
+static void
+check_hash_incoming (EmpathyFTHandler *handler)
+{
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+
+  if (EMP_STR_EMPTY (priv->content_hash))
+    return;
+
+  g_signal_emit (handler, signals[HASHING_STARTED], 0);
+
+  if (priv->incoming_hash == NULL)
+    {
+      hash_incoming_file (handler);
+      return;
+    }
+
+  /* Most of the file has been hashed already, make sure it's the one which
+   * ended up at the destination before hashing the rest. */
+  g_file_query_info_async (priv->gfile, G_FILE_ATTRIBUTE_ID_FILE,
+      G_FILE_QUERY_INFO_NONE, G_PRIORITY_DEFAULT, priv->cancellable,
+      incoming_hash_target_cb, g_object_ref (handler));
 }
 
 static void
@@ -687,6 +1245,12 @@ ft_transfer_transferred_bytes_cb (TpFileTransferChannel *channel,
       g_signal_emit (handler, signals[TRANSFER_PROGRESS], 0,
           bytes, priv->total_bytes, priv->remaining_time,
           priv->speed);
+
+      if (empathy_ft_handler_is_incoming (handler))
+        {
+          incoming_hash_start (handler);
+          incoming_hash_read (handler);
+        }
     }
 }
 
@@ -932,6 +1496,9 @@ hash_job_done (gpointer user_data)
       tp_asv_set_string (priv->request,
           TP_PROP_CHANNEL_TYPE_FILE_TRANSFER_CONTENT_HASH,
           g_checksum_get_string (hash_data->checksum));
+
+      hash_cache_store (handler, TP_FILE_HASH_TYPE_MD5,
+          g_checksum_get_string (hash_data->checksum));
     }
 
 cleanup:
@@ -955,17 +1522,51 @@ cleanup:
   return FALSE;
 }
 
+static void
+hashing_progress_free (HashingProgress *progress)
+{
+  g_object_unref (progress->handler);
+  g_slice_free (HashingProgress, progress);
+}
+
 static gboolean
 emit_hashing_progress (gpointer user_data)
 {
-  HashingData *hash_data = user_data;
+  HashingProgress *progress = user_data;
 
-  g_signal_emit (hash_data->handler, signals[HASHING_PROGRESS], 0,
-      (guint64) hash_data->total_read, (guint64) hash_data->total_bytes);
+  g_signal_emit (progress->handler, signals[HASHING_PROGRESS], 0,
+      progress->total_read, progress->total_bytes);
 
   return FALSE;
 }
 
+static void
+send_hashing_progress (GIOSchedulerJob *job,
+    HashingData *hash_data)
+{
+  HashingProgress *progress;
+
+  progress = g_slice_new (HashingProgress);
+  progress->handler = g_object_ref (hash_data->handler);
+  progress->total_read = hash_data->total_read;
+  progress->total_bytes = hash_data->total_bytes;
+
+  g_io_scheduler_job_send_to_mainloop_async (job, emit_hashing_progress,
+      progress, (GDestroyNotify) hashing_progress_free);
+}
+
+static void
+hash_stream_advise_sequential (GInputStream *stream)
+{
+#if defined (G_OS_UNIX) && defined (POSIX_FADV_SEQUENTIAL)
+  /* Ask for a more aggressive read-ahead */
+  if (G_IS_FILE_DESCRIPTOR_BASED (stream))
+    posix_fadvise (
+        g_file_descriptor_based_get_fd (G_FILE_DESCRIPTOR_BASED (stream)),
+        0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+}
+
 static gboolean
 do_hash_job (GIOSchedulerJob *job,
     GCancellable *cancellable,
@@ -975,33 +1576,35 @@ do_hash_job (GIOSchedulerJob *job,
   gssize bytes_read;
   GError *error = NULL;
 
-again:
   if (hash_data->buffer == NULL)
-    hash_data->buffer = g_malloc0 (BUFFER_SIZE);
-
-  bytes_read = g_input_stream_read (hash_data->stream, hash_data->buffer,
-                                    BUFFER_SIZE, cancellable, &error);
-  if (error != NULL)
-    goto out;
+    hash_data->buffer = g_malloc (BUFFER_SIZE);
 
-  hash_data->total_read += bytes_read;
+  hash_stream_advise_sequential (hash_data->stream);
 
-  /* we now have the chunk */
-  if (bytes_read > 0)
+  while ((bytes_read = g_input_stream_read (hash_data->stream,
+      hash_data->buffer, BUFFER_SIZE, cancellable, &error)) > 0)
     {
-      g_checksum_update (hash_data->checksum, hash_data->buffer, bytes_read);
-      g_io_scheduler_job_send_to_mainloop_async (job, emit_hashing_progress,
-          hash_data, NULL);
+      gint64 now;
 
-      g_free (hash_data->buffer);
-      hash_data->buffer = NULL;
+      hash_data->total_read += bytes_read;
+      g_checksum_update (hash_data->checksum, hash_data->buffer, bytes_read);
 
-      goto again;
+      /* Only tell the main loop about the progress a few times a second */
+      now = g_get_monotonic_time ();
+      if (now - hash_data->last_progress_time >= HASHING_PROGRESS_INTERVAL)
+        {
+          hash_data->last_progress_time = now;
+          send_hashing_progress (job, hash_data);
+        }
     }
-  else
-  {
-    g_input_stream_close (hash_data->stream, cancellable, &error);
-  }
+
+  if (error != NULL)
+    goto out;
+
+  /* Always report the end of the file */
+  send_hashing_progress (job, hash_data);
+
+  g_input_stream_close (hash_data->stream, cancellable, &error);
 
 out:
   if (error != NULL)
@@ -1222,17 +1825,40 @@ static void
 ft_handler_complete_request (EmpathyFTHandler *handler)
 {
   EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+  gchar *hash;
 
   /* populate the request table with all the known properties */
   ft_handler_populate_outgoing_request (handler);
 
-  if (priv->use_hash)
-    /* start hashing the file */
-    g_file_read_async (priv->gfile, G_PRIORITY_DEFAULT,
-        priv->cancellable, ft_handler_read_async_cb, handler);
-  else
-    /* push directly the handler to the dispatcher */
-    ft_handler_push_to_dispatcher (handler);
+  if (!priv->use_hash)
+    {
+      /* push directly the handler to the dispatcher */
+      ft_handler_push_to_dispatcher (handler);
+      return;
+    }
+
+  /* FIXME: MD5 is the only ContentHashType supported right now */
+  hash = hash_cache_lookup (handler, TP_FILE_HASH_TYPE_MD5);
+  if (hash != NULL)
+    {
+      DEBUG ("File didn't change since it was hashed: %s", hash);
+
+      tp_asv_set_uint32 (priv->request,
+          TP_PROP_CHANNEL_TYPE_FILE_TRANSFER_CONTENT_HASH_TYPE,
+          TP_FILE_HASH_TYPE_MD5);
+      tp_asv_take_string (priv->request,
+          TP_PROP_CHANNEL_TYPE_FILE_TRANSFER_CONTENT_HASH, hash);
+
+      ft_handler_push_to_dispatcher (handler);
+
+      /* Save that the file has been used */
+      hash_cache_save (hash_cache_get ());
+      return;
+    }
+
+  /* start hashing the file */
+  g_file_read_async (priv->gfile, G_PRIORITY_DEFAULT,
+      priv->cancellable, ft_handler_read_async_cb, handler);
 }
 
 static void
@@ -1273,6 +1899,13 @@ ft_handler_gfile_ready_cb (GObject *source,
   priv->filename = g_strdup (g_file_info_get_display_name (info));
   g_file_info_get_modification_time (info, &mtime);
   priv->mtime = mtime.tv_sec;
+
+  if (g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_UNIX_INODE))
+    priv->file_stamp = g_strdup_printf ("%" G_GUINT64_FORMAT
+        " %" G_GUINT64_FORMAT " %ld.%06ld",
+        g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_UNIX_INODE),
+        priv->total_bytes, mtime.tv_sec, mtime.tv_usec);
+
   priv->transferred_bytes = 0;
   priv->description = NULL;
 
@@ -1404,7 +2037,9 @@ empathy_ft_handler_new_outgoing (EmpathyContact *contact,
       G_FILE_ATTRIBUTE_STANDARD_SIZE ","
       G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE ","
       G_FILE_ATTRIBUTE_STANDARD_TYPE ","
-      G_FILE_ATTRIBUTE_TIME_MODIFIED,
+      G_FILE_ATTRIBUTE_TIME_MODIFIED ","
+      G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC ","
+      G_FILE_ATTRIBUTE_UNIX_INODE,
       G_FILE_QUERY_INFO_NONE, G_PRIORITY_DEFAULT,
       NULL, (GAsyncReadyCallback) ft_handler_gfile_ready_cb, data);
 }
@@ -0,0 +1,1222 @@
+/*
+ * Copyright (C) 2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <telepathy-glib/telepathy-glib.h>
+#include <telepathy-logger/telepathy-logger.h>
+
+#include "empathy-log-index.h"
+#include "empathy-utils.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_OTHER
+#include "empathy-debug.h"
+
+/* The index maps each word of the logged text events to the conversations
+ * (account, entity, date) it appears in, which is the granularity of
+ * tpl_log_manager_search_async(). It is kept up to date by crawling the
+ * logs we didn't see yet when created, and by empathy_log_index_add_text()
+ * for the events happening meanwhile. */
+
+#define LOG_INDEX_FILENAME "log-index"
+#define LOG_INDEX_HEADER "empathy-log-index 1"
+/* The whole index is written at once, so it's only saved every few minutes
+ * while new text is added */
+#define SAVE_TIMER 300
+
+/* Shorter words are not indexed, but searched terms of any length are
+ * matched as prefixes */
+#define MIN_WORD_CHARS 2
+/* Longer words (and searched terms) are truncated */
+#define MAX_WORD_BYTES 64
+
+typedef struct
+{
+  gchar *account_path;
+  gchar *entity_id;
+  TplEntityType entity_type;
+  gchar *alias;
+  guint32 julian;
+} LogIndexDoc;
+
+typedef enum
+{
+  CRAWL_ENTITIES,
+  CRAWL_DATES,
+  CRAWL_EVENTS
+} CrawlType;
+
+typedef struct
+{
+  EmpathyLogIndex *self;
+  CrawlType type;
+  TpAccount *account;
+  TplEntity *target;
+  GDate *date;
+} CrawlJob;
+
+struct _EmpathyLogIndexPrivate
+{
+  gchar *file;
+
+  /* Owned LogIndexDoc, the index in the array is the doc id */
+  GPtrArray *docs;
+  /* owned key from log_index_doc_key () -> doc id + 1 */
+  GHashTable *doc_ids;
+  /* owned word -> owned GArray of sorted guint32 doc ids */
+  GHashTable *words;
+  /* The keys of words, sorted on demand for prefix lookups */
+  GPtrArray *sorted_words;
+  gboolean words_sorted;
+
+  /* owned "account\x1fentity" -> julian day of the last crawled date */
+  GHashTable *crawled;
+
+  TpAccountManager *account_manager;
+  TplLogManager *log_manager;
+  /* Queue of owned CrawlJob */
+  GQueue *crawl_jobs;
+  gboolean crawling;
+
+  gboolean ready;
+  guint save_timer_id;
+  /* The contents being written by log_index_save_async (), if any */
+  gchar *saving_data;
+};
+
+enum
+{
+  PROP_0,
+  PROP_FILE,
+  PROP_READY,
+};
+
+G_DEFINE_TYPE (EmpathyLogIndex, empathy_log_index, G_TYPE_OBJECT);
+
+static EmpathyLogIndex *index_singleton = NULL;
+
+static void
+log_index_doc_free (LogIndexDoc *doc)
+{
+  g_free (doc->account_path);
+  g_free (doc->entity_id);
+  g_free (doc->alias);
+  g_slice_free (LogIndexDoc, doc);
+}
+
+static gchar *
+log_index_doc_key (const gchar *account_path,
+    const gchar *entity_id,
+    TplEntityType entity_type,
+    guint32 julian)
+{
+  return g_strdup_printf ("%s\x1f%s\x1f%u\x1f%u", account_path, entity_id,
+      entity_type, julian);
+}
+
+static guint
+log_index_ensure_doc (EmpathyLogIndex *self,
+    const gchar *account_path,
+    const gchar *entity_id,
+    TplEntityType entity_type,
+    const gchar *alias,
+    guint32 julian)
+{
+  LogIndexDoc *doc;
+  gchar *key;
+  guint id;
+
+  key = log_index_doc_key (account_path, entity_id, entity_type, julian);
+  id = GPOINTER_TO_UINT (g_hash_table_lookup (self->priv->doc_ids, key));
+
+  if (id != 0)
+    {
+      doc = g_ptr_array_index (self->priv->docs, id - 1);
+      if (doc->alias == NULL)
+        doc->alias = g_strdup (alias);
+
+      g_free (key);
+      return id - 1;
+    }
+
+  doc = g_slice_new0 (LogIndexDoc);
+  doc->account_path = g_strdup (account_path);
+  doc->entity_id = g_strdup (entity_id);
+  doc->entity_type = entity_type;
+  doc->alias = g_strdup (alias);
+  doc->julian = julian;
+
+  id = self->priv->docs->len;
+  g_ptr_array_add (self->priv->docs, doc);
+  g_hash_table_insert (self->priv->doc_ids, key, GUINT_TO_POINTER (id + 1));
+
+  return id;
+}
+
+static void
+log_index_add_posting (EmpathyLogIndex *self,
+    const gchar *word,
+    guint32 id)
+{
+  GArray *postings;
+  guint lo, hi;
+
+  postings = g_hash_table_lookup (self->priv->words, word);
+  if (postings == NULL)
+    {
+      gchar *key = g_strdup (word);
+
+      postings = g_array_new (FALSE, FALSE, sizeof (guint32));
+      g_hash_table_insert (self->priv->words, key, postings);
+
+      g_ptr_array_add (self->priv->sorted_words, key);
+      self->priv->words_sorted = FALSE;
+    }
+
+  /* Docs are mostly created in order, so this is usually an append */
+  lo = 0;
+  hi = postings->len;
+  if (hi > 0 && g_array_index (postings, guint32, hi - 1) < id)
+    lo = hi;
+
+  while (lo < hi)
+    {
+      guint mid = (lo + hi) / 2;
+      guint32 cur = g_array_index (postings, guint32, mid);
+
+      if (cur == id)
+        return;
+
+      if (cur < id)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  g_array_insert_val (postings, lo, id);
+}
+
+static gchar *
+log_index_dup_word (const gchar *start,
+    gsize len)
+{
+  if (len > MAX_WORD_BYTES)
+    {
+      const gchar *end = start + MAX_WORD_BYTES;
+
+      /* Don't cut a character in half */
+      while (end > start && (*end & 0xc0) == 0x80)
+        end--;
+
+      len = end - start;
+    }
+
+  return g_strndup (start, len);
+}
+
+/* Returns the normalized words of @text having at least @min_chars
+ * characters */
+static GPtrArray *
+log_index_tokenize (const gchar *text,
+    guint min_chars)
+{
+  GPtrArray *words;
+  gchar *normalized, *folded;
+  const gchar *p, *start = NULL;
+  guint n_chars = 0;
+
+  words = g_ptr_array_new_with_free_func (g_free);
+
+  normalized = g_utf8_normalize (text, -1, G_NORMALIZE_ALL_COMPOSE);
+  if (normalized == NULL)
+    return words;
+
+  folded = g_utf8_casefold (normalized, -1);
+
+  for (p = folded; ; p = g_utf8_next_char (p))
+    {
+      gunichar c = g_utf8_get_char (p);
+
+      if (c != 0 && (g_unichar_isalnum (c) || g_unichar_ismark (c)))
+        {
+          if (start == NULL)
+            {
+              start = p;
+              n_chars = 0;
+            }
+
+          n_chars++;
+          continue;
+        }
+
+      if (start != NULL && n_chars >= min_chars)
+        g_ptr_array_add (words, log_index_dup_word (start, p - start));
+
+      start = NULL;
+
+      if (c == 0)
+        break;
+    }
+
+  g_free (folded);
+  g_free (normalized);
+
+  return words;
+}
+
+static void
+log_index_clear (EmpathyLogIndex *self)
+{
+  g_ptr_array_set_size (self->priv->sorted_words, 0);
+  g_hash_table_remove_all (self->priv->words);
+  g_hash_table_remove_all (self->priv->doc_ids);
+  g_ptr_array_set_size (self->priv->docs, 0);
+  g_hash_table_remove_all (self->priv->crawled);
+  self->priv->words_sorted = TRUE;
+  self->priv->ready = FALSE;
+}
+
+/*
+ * Saving and loading. The file starts with the LOG_INDEX_HEADER line,
+ * followed by lines of tab separated fields, in this order:
+ *   D  account  entity  entity-type  julian-day  alias
+ *   C  account\x1fentity  julian-day
+ *   W  word  space separated doc ids
+ * where the doc ids are the order of the D lines. Older files can also have
+ * an R line, with no other field, which is ignored: a loaded index misses
+ * the logs written since it was saved, so it is only ready once the crawl
+ * caught up with them.
+ */
+
+static void
+log_index_append_escaped (GString *string,
+    const gchar *str)
+{
+  gchar *escaped;
+
+  escaped = g_strescape (str != NULL ? str : "", NULL);
+  g_string_append (string, escaped);
+  g_free (escaped);
+}
+
+static GString *
+log_index_to_data (EmpathyLogIndex *self)
+{
+  GString *string;
+  GHashTableIter iter;
+  gpointer key, value;
+  guint i;
+
+  string = g_string_new (LOG_INDEX_HEADER "\n");
+
+  for (i = 0; i < self->priv->docs->len; i++)
+    {
+      LogIndexDoc *doc = g_ptr_array_index (self->priv->docs, i);
+
+      g_string_append (string, "D\t");
+      log_index_append_escaped (string, doc->account_path);
+      g_string_append_c (string, '\t');
+      log_index_append_escaped (string, doc->entity_id);
+      g_string_append_printf (string, "\t%u\t%u\t", doc->entity_type,
+          doc->julian);
+      log_index_append_escaped (string, doc->alias);
+      g_string_append_c (string, '\n');
+    }
+
+  g_hash_table_iter_init (&iter, self->priv->crawled);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      g_string_append (string, "C\t");
+      log_index_append_escaped (string, key);
+      g_string_append_printf (string, "\t%u\n", GPOINTER_TO_UINT (value));
+    }
+
+  g_hash_table_iter_init (&iter, self->priv->words);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      GArray *postings = value;
+
+      g_string_append_printf (string, "W\t%s\t", (const gchar *) key);
+
+      for (i = 0; i < postings->len; i++)
+        g_string_append_printf (string, i == 0 ? "%u" : " %u",
+            g_array_index (postings, guint32, i));
+
+      g_string_append_c (string, '\n');
+    }
+
+  return string;
+}
+
+gboolean
+empathy_log_index_save (EmpathyLogIndex *self,
+    GError **error)
+{
+  GString *string;
+  gboolean result;
+
+  g_return_val_if_fail (EMPATHY_IS_LOG_INDEX (self), FALSE);
+
+  string = log_index_to_data (self);
+
+  DEBUG ("Saving file:'%s'", self->priv->file);
+  result = g_file_set_contents (self->priv->file, string->str, string->len,
+      error);
+
+  g_string_free (string, TRUE);
+
+  return result;
+}
+
+static gboolean
+log_index_load_line (EmpathyLogIndex *self,
+    gchar *line)
+{
+  gchar **fields;
+  guint n_fields;
+  gboolean result = TRUE;
+
+  fields = g_strsplit (line, "\t", 0);
+  n_fields = g_strv_length (fields);
+
+  if (!tp_strdiff (fields[0], "R") && n_fields == 1)
+    {
+      /* Not ready until the logs written since have been crawled */
+    }
+  else if (!tp_strdiff (fields[0], "D") && n_fields == 6)
+    {
+      gchar *account_path = g_strcompress (fields[1]);
+      gchar *entity_id = g_strcompress (fields[2]);
+      gchar *alias = g_strcompress (fields[5]);
+      guint id;
+
+      id = log_index_ensure_doc (self, account_path, entity_id,
+          strtoul (fields[3], NULL, 10), EMP_STR_EMPTY (alias) ? NULL : alias,
+          strtoul (fields[4], NULL, 10));
+
+      /* Duplicated docs would shift the ids of all the following ones */
+      if (id != self->priv->docs->len - 1)
+        result = FALSE;
+
+      g_free (account_path);
+      g_free (entity_id);
+      g_free (alias);
+    }
+  else if (!tp_strdiff (fields[0], "C") && n_fields == 3)
+    {
+      g_hash_table_insert (self->priv->crawled, g_strcompress (fields[1]),
+          GUINT_TO_POINTER (strtoul (fields[2], NULL, 10)));
+    }
+  else if (!tp_strdiff (fields[0], "W") && n_fields == 3)
+    {
+      gchar *cur = fields[2];
+
+      while (result && *cur != '\0')
+        {
+          gchar *end;
+          gulong id;
+
+          id = strtoul (cur, &end, 10);
+          if (end == cur || id >= self->priv->docs->len)
+            result = FALSE;
+          else
+            log_index_add_posting (self, fields[1], id);
+
+          cur = end;
+          while (*cur == ' ')
+            cur++;
+        }
+    }
+  else
+    {
+      result = FALSE;
+    }
+
+  g_strfreev (fields);
+
+  return result;
+}
+
+static void
+log_index_load (EmpathyLogIndex *self)
+{
+  gchar *contents;
+  gchar *line, *next;
+  GError *error = NULL;
+
+  if (!g_file_get_contents (self->priv->file, &contents, NULL, &error))
+    {
+      if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        DEBUG ("Failed to load %s: %s", self->priv->file, error->message);
+
+      g_error_free (error);
+      return;
+    }
+
+  next = strchr (contents, '\n');
+  if (next == NULL ||
+      (gsize) (next - contents) != strlen (LOG_INDEX_HEADER) ||
+      strncmp (contents, LOG_INDEX_HEADER, next - contents) != 0)
+    {
+      DEBUG ("Ignoring %s: unknown format", self->priv->file);
+      goto out;
+    }
+
+  /* An incomplete last line is ignored, the crawl will fix it up */
+  for (line = next + 1; (next = strchr (line, '\n')) != NULL; line = next + 1)
+    {
+      *next = '\0';
+
+      if (!log_index_load_line (self, line))
+        {
+          DEBUG ("Ignoring %s: corrupted line '%s'", self->priv->file, line);
+          log_index_clear (self);
+          goto out;
+        }
+    }
+
+  DEBUG ("Loaded %u conversations, %u words", self->priv->docs->len,
+      g_hash_table_size (self->priv->words));
+
+out:
+  g_free (contents);
+}
+
+static void schedule_save (EmpathyLogIndex *self);
+
+static void
+log_index_saved_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyLogIndex *self = user_data;
+  GError *error = NULL;
+
+  if (!g_file_replace_contents_finish (G_FILE (source), result, NULL,
+        &error))
+    {
+      DEBUG ("Failed to save the log index: %s", error->message);
+      g_error_free (error);
+    }
+
+  tp_clear_pointer (&self->priv->saving_data, g_free);
+  g_object_unref (self);
+}
+
+/* Writes the index without blocking the main loop on the disk */
+static void
+log_index_save_async (EmpathyLogIndex *self)
+{
+  GString *string;
+  GFile *file;
+  gsize len;
+
+  /* Don't write the file twice at once, try again later */
+  if (self->priv->saving_data != NULL)
+    {
+      schedule_save (self);
+      return;
+    }
+
+  string = log_index_to_data (self);
+  len = string->len;
+  self->priv->saving_data = g_string_free (string, FALSE);
+
+  DEBUG ("Saving file:'%s'", self->priv->file);
+
+  file = g_file_new_for_path (self->priv->file);
+  g_file_replace_contents_async (file, self->priv->saving_data, len, NULL,
+      FALSE, G_FILE_CREATE_NONE, NULL, log_index_saved_cb,
+      g_object_ref (self));
+
+  g_object_unref (file);
+}
+
+static gboolean
+save_timeout (EmpathyLogIndex *self)
+{
+  self->priv->save_timer_id = 0;
+
+  log_index_save_async (self);
+
+  return FALSE;
+}
+
+/* Saves the index in SAVE_TIMER seconds, unless it is already planned */
+static void
+schedule_save (EmpathyLogIndex *self)
+{
+  if (self->priv->save_timer_id > 0)
+    return;
+
+  self->priv->save_timer_id = g_timeout_add_seconds (SAVE_TIMER,
+      (GSourceFunc) save_timeout, self);
+}
+
+/*
+ * Crawling of the logs we don't know about yet. Jobs are run one after the
+ * other, and the crawl keeps a ref on the index until it's done.
+ */
+
+static CrawlJob *
+crawl_job_new (EmpathyLogIndex *self,
+    CrawlType type,
+    TpAccount *account,
+    TplEntity *target,
+    const GDate *date)
+{
+  CrawlJob *job = g_slice_new0 (CrawlJob);
+
+  job->self = self;
+  job->type = type;
+  job->account = g_object_ref (account);
+  if (target != NULL)
+    job->target = g_object_ref (target);
+  if (date != NULL)
+    job->date = g_date_new_julian (g_date_get_julian (date));
+
+  return job;
+}
+
+static void
+crawl_job_free (CrawlJob *job)
+{
+  g_object_unref (job->account);
+  tp_clear_object (&job->target);
+  tp_clear_pointer (&job->date, g_date_free);
+  g_slice_free (CrawlJob, job);
+}
+
+static gchar *
+log_index_crawled_key (TpAccount *account,
+    TplEntity *target)
+{
+  return g_strdup_printf ("%s\x1f%s", tp_proxy_get_object_path (account),
+      tpl_entity_get_identifier (target));
+}
+
+static void log_index_crawl_next (EmpathyLogIndex *self);
+
+static void
+log_index_got_entities_cb (GObject *manager,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  CrawlJob *job = user_data;
+  EmpathyLogIndex *self = job->self;
+  GList *entities, *l;
+  GError *error = NULL;
+
+  if (!tpl_log_manager_get_entities_finish (TPL_LOG_MANAGER (manager),
+      result, &entities, &error))
+    {
+      DEBUG ("Failed to get entities: %s", error->message);
+      g_error_free (error);
+      goto out;
+    }
+
+  for (l = entities; l != NULL; l = g_list_next (l))
+    g_queue_push_tail (self->priv->crawl_jobs,
+        crawl_job_new (self, CRAWL_DATES, job->account, l->data, NULL));
+
+  g_list_free_full (entities, g_object_unref);
+
+out:
+  crawl_job_free (job);
+  log_index_crawl_next (self);
+}
+
+static void
+log_index_got_dates_cb (GObject *manager,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  CrawlJob *job = user_data;
+  EmpathyLogIndex *self = job->self;
+  GList *dates, *l;
+  gchar *key;
+  guint32 last;
+  GError *error = NULL;
+
+  if (!tpl_log_manager_get_dates_finish (TPL_LOG_MANAGER (manager),
+      result, &dates, &error))
+    {
+      DEBUG ("Failed to get dates: %s", error->message);
+      g_error_free (error);
+      goto out;
+    }
+
+  key = log_index_crawled_key (job->account, job->target);
+  last = GPOINTER_TO_UINT (g_hash_table_lookup (self->priv->crawled, key));
+  g_free (key);
+
+  /* The last crawled date may have got new events since */
+  for (l = dates; l != NULL; l = g_list_next (l))
+    {
+      if (g_date_get_julian (l->data) >= last)
+        g_queue_push_tail (self->priv->crawl_jobs, crawl_job_new (self,
+            CRAWL_EVENTS, job->account, job->target, l->data));
+    }
+
+  g_list_free_full (dates, (GDestroyNotify) g_date_free);
+
+out:
+  crawl_job_free (job);
+  log_index_crawl_next (self);
+}
+
+static void
+log_index_got_events_cb (GObject *manager,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  CrawlJob *job = user_data;
+  EmpathyLogIndex *self = job->self;
+  GList *events, *l;
+  guint32 julian, last;
+  gchar *key;
+  GError *error = NULL;
+
+  if (!tpl_log_manager_get_events_for_date_finish (TPL_LOG_MANAGER (manager),
+      result, &events, &error))
+    {
+      DEBUG ("Failed to get events: %s", error->message);
+      g_error_free (error);
+      goto out;
+    }
+
+  for (l = events; l != NULL; l = g_list_next (l))
+    {
+      if (!TPL_IS_TEXT_EVENT (l->data))
+        continue;
+
+      empathy_log_index_add_text (self,
+          tp_proxy_get_object_path (job->account),
+          tpl_entity_get_identifier (job->target),
+          tpl_entity_get_entity_type (job->target),
+          tpl_entity_get_alias (job->target),
+          job->date,
+          tpl_text_event_get_message (l->data));
+    }
+
+  g_list_free_full (events, g_object_unref);
+
+  key = log_index_crawled_key (job->account, job->target);
+  julian = g_date_get_julian (job->date);
+  last = GPOINTER_TO_UINT (g_hash_table_lookup (self->priv->crawled, key));
+
+  if (julian > last)
+    g_hash_table_insert (self->priv->crawled, key, GUINT_TO_POINTER (julian));
+  else
+    g_free (key);
+
+out:
+  crawl_job_free (job);
+  log_index_crawl_next (self);
+}
+
+static void
+log_index_crawl_next (EmpathyLogIndex *self)
+{
+  CrawlJob *job;
+
+  job = g_queue_pop_head (self->priv->crawl_jobs);
+  if (job == NULL)
+    {
+      DEBUG ("Log index up to date: %u conversations, %u words",
+          self->priv->docs->len, g_hash_table_size (self->priv->words));
+
+      self->priv->crawling = FALSE;
+
+      if (!self->priv->ready)
+        {
+          self->priv->ready = TRUE;
+          g_object_notify (G_OBJECT (self), "ready");
+        }
+
+      log_index_save_async (self);
+      g_object_unref (self);
+      return;
+    }
+
+  switch (job->type)
+    {
+      case CRAWL_ENTITIES:
+        tpl_log_manager_get_entities_async (self->priv->log_manager,
+            job->account, log_index_got_entities_cb, job);
+        break;
+      case CRAWL_DATES:
+        tpl_log_manager_get_dates_async (self->priv->log_manager,
+            job->account, job->target, TPL_EVENT_MASK_TEXT,
+            log_index_got_dates_cb, job);
+        break;
+      case CRAWL_EVENTS:
+        tpl_log_manager_get_events_for_date_async (self->priv->log_manager,
+            job->account, job->target, TPL_EVENT_MASK_TEXT, job->date,
+            log_index_got_events_cb, job);
+        break;
+    }
+}
+
+static void
+log_index_account_manager_prepared_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyLogIndex *self = user_data;
+  TpAccountManager *manager = TP_ACCOUNT_MANAGER (source);
+  GList *accounts, *l;
+  GError *error = NULL;
+
+  if (!tp_proxy_prepare_finish (manager, result, &error))
+    {
+      DEBUG ("Failed to prepare account manager: %s", error->message);
+      g_error_free (error);
+
+      self->priv->crawling = FALSE;
+      g_object_unref (self);
+      return;
+    }
+
+  accounts = tp_account_manager_get_valid_accounts (manager);
+  for (l = accounts; l != NULL; l = g_list_next (l))
+    g_queue_push_tail (self->priv->crawl_jobs,
+        crawl_job_new (self, CRAWL_ENTITIES, l->data, NULL, NULL));
+
+  g_list_free (accounts);
+
+  log_index_crawl_next (self);
+}
+
+static void
+log_index_start_crawl (EmpathyLogIndex *self)
+{
+  if (self->priv->crawling)
+    return;
+
+  self->priv->crawling = TRUE;
+
+  if (self->priv->account_manager == NULL)
+    self->priv->account_manager = tp_account_manager_dup ();
+  if (self->priv->log_manager == NULL)
+    self->priv->log_manager = tpl_log_manager_dup_singleton ();
+
+  tp_proxy_prepare_async (self->priv->account_manager, NULL,
+      log_index_account_manager_prepared_cb, g_object_ref (self));
+}
+
+static void
+log_index_get_property (GObject *object,
+    guint param_id,
+    GValue *value,
+    GParamSpec *pspec)
+{
+  EmpathyLogIndex *self = EMPATHY_LOG_INDEX (object);
+
+  switch (param_id)
+    {
+      case PROP_FILE:
+        g_value_set_string (value, self->priv->file);
+        break;
+      case PROP_READY:
+        g_value_set_boolean (value, self->priv->ready);
+        break;
+      default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, param_id, pspec);
+        break;
+    };
+}
+
+static void
+log_index_set_property (GObject *object,
+    guint param_id,
+    const GValue *value,
+    GParamSpec *pspec)
+{
+  EmpathyLogIndex *self = EMPATHY_LOG_INDEX (object);
+
+  switch (param_id)
+    {
+      case PROP_FILE:
+        g_free (self->priv->file);
+        self->priv->file = g_value_dup_string (value);
+        break;
+      default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, param_id, pspec);
+        break;
+    };
+}
+
+static void
+log_index_constructed (GObject *object)
+{
+  EmpathyLogIndex *self = EMPATHY_LOG_INDEX (object);
+
+  if (self->priv->file == NULL)
+    {
+      /* Set the default file path */
+      gchar *dir;
+
+      dir = g_build_filename (g_get_user_cache_dir (), PACKAGE_NAME, NULL);
+      if (!g_file_test (dir, G_FILE_TEST_EXISTS | G_FILE_TEST_IS_DIR))
+        g_mkdir_with_parents (dir, S_IRUSR | S_IWUSR | S_IXUSR);
+
+      self->priv->file = g_build_filename (dir, LOG_INDEX_FILENAME, NULL);
+      g_free (dir);
+    }
+
+  log_index_load (self);
+
+  if (G_OBJECT_CLASS (empathy_log_index_parent_class)->constructed != NULL)
+    G_OBJECT_CLASS (empathy_log_index_parent_class)->constructed (object);
+}
+
+static void
+log_index_dispose (GObject *object)
+{
+  EmpathyLogIndex *self = EMPATHY_LOG_INDEX (object);
+
+  tp_clear_object (&self->priv->account_manager);
+  tp_clear_object (&self->priv->log_manager);
+
+  G_OBJECT_CLASS (empathy_log_index_parent_class)->dispose (object);
+}
+
+static void
+log_index_finalize (GObject *object)
+{
+  EmpathyLogIndex *self = EMPATHY_LOG_INDEX (object);
+
+  if (self->priv->save_timer_id > 0)
+    {
+      GError *error = NULL;
+
+      /* have to save before destroy the object */
+      g_source_remove (self->priv->save_timer_id);
+
+      if (!empathy_log_index_save (self, &error))
+        {
+          DEBUG ("Failed to save the log index: %s", error->message);
+          g_error_free (error);
+        }
+    }
+
+  g_queue_foreach (self->priv->crawl_jobs, (GFunc) crawl_job_free, NULL);
+  g_queue_free (self->priv->crawl_jobs);
+  g_ptr_array_unref (self->priv->sorted_words);
+  g_hash_table_unref (self->priv->words);
+  g_hash_table_unref (self->priv->doc_ids);
+  g_ptr_array_unref (self->priv->docs);
+  g_hash_table_unref (self->priv->crawled);
+  g_free (self->priv->file);
+
+  G_OBJECT_CLASS (empathy_log_index_parent_class)->finalize (object);
+}
+
+static void
+empathy_log_index_class_init (EmpathyLogIndexClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->get_property = log_index_get_property;
+  object_class->set_property = log_index_set_property;
+  object_class->constructed = log_index_constructed;
+  object_class->dispose = log_index_dispose;
+  object_class->finalize = log_index_finalize;
+
+  g_object_class_install_property (object_class,
+      PROP_FILE,
+      g_param_spec_string ("file",
+          "path of the index file",
+          "The path of the file where the index is saved",
+          NULL,
+          G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (object_class,
+      PROP_READY,
+      g_param_spec_boolean ("ready",
+          "whether the index is complete",
+          "TRUE once all the logs have been indexed",
+          FALSE,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_type_class_add_private (object_class, sizeof (EmpathyLogIndexPrivate));
+}
+
+static void
+empathy_log_index_init (EmpathyLogIndex *self)
+{
+  self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
+      EMPATHY_TYPE_LOG_INDEX, EmpathyLogIndexPrivate);
+
+  self->priv->docs = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) log_index_doc_free);
+  self->priv->doc_ids = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, NULL);
+  self->priv->words = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, (GDestroyNotify) g_array_unref);
+  self->priv->sorted_words = g_ptr_array_new ();
+  self->priv->words_sorted = TRUE;
+  self->priv->crawled = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, NULL);
+  self->priv->crawl_jobs = g_queue_new ();
+}
+
+/**
+ * empathy_log_index_dup_singleton:
+ *
+ * Returns: (transfer full): the index of the user's logs, which starts
+ * indexing the logs it doesn't know about yet.
+ */
+EmpathyLogIndex *
+empathy_log_index_dup_singleton (void)
+{
+  if (index_singleton != NULL)
+    return g_object_ref (index_singleton);
+
+  index_singleton = g_object_new (EMPATHY_TYPE_LOG_INDEX, NULL);
+  g_object_add_weak_pointer (G_OBJECT (index_singleton),
+      (gpointer) &index_singleton);
+
+  log_index_start_crawl (index_singleton);
+
+  return index_singleton;
+}
+
+/**
+ * empathy_log_index_new:
+ * @file: the path of the index file
+ *
+ * Returns: (transfer full): an index loaded from @file, which is only fed
+ * by empathy_log_index_add_text().
+ */
+EmpathyLogIndex *
+empathy_log_index_new (const gchar *file)
+{
+  return g_object_new (EMPATHY_TYPE_LOG_INDEX,
+      "file", file,
+      NULL);
+}
+
+gboolean
+empathy_log_index_is_ready (EmpathyLogIndex *self)
+{
+  g_return_val_if_fail (EMPATHY_IS_LOG_INDEX (self), FALSE);
+
+  return self->priv->ready;
+}
+
+void
+empathy_log_index_add_text (EmpathyLogIndex *self,
+    const gchar *account_path,
+    const gchar *entity_id,
+    TplEntityType entity_type,
+    const gchar *alias,
+    const GDate *date,
+    const gchar *text)
+{
+  GPtrArray *words;
+  guint id, i;
+
+  g_return_if_fail (EMPATHY_IS_LOG_INDEX (self));
+  g_return_if_fail (account_path != NULL);
+  g_return_if_fail (entity_id != NULL);
+  g_return_if_fail (date != NULL);
+
+  if (EMP_STR_EMPTY (text))
+    return;
+
+  words = log_index_tokenize (text, MIN_WORD_CHARS);
+
+  if (words->len > 0)
+    {
+      id = log_index_ensure_doc (self, account_path, entity_id, entity_type,
+          alias, g_date_get_julian (date));
+
+      for (i = 0; i < words->len; i++)
+        log_index_add_posting (self, g_ptr_array_index (words, i), id);
+
+      schedule_save (self);
+    }
+
+  g_ptr_array_unref (words);
+}
+
+static gint
+log_index_compare_words (gconstpointer a,
+    gconstpointer b)
+{
+  return strcmp (*(const gchar **) a, *(const gchar **) b);
+}
+
+/* Returns the set of doc ids + 1 containing a word starting with @prefix */
+static GHashTable *
+log_index_match_prefix (EmpathyLogIndex *self,
+    const gchar *prefix)
+{
+  GPtrArray *sorted_words = self->priv->sorted_words;
+  GHashTable *matches;
+  gsize len = strlen (prefix);
+  guint lo = 0, hi = sorted_words->len;
+  guint i, j;
+
+  matches = g_hash_table_new (NULL, NULL);
+
+  /* Find the first word not sorting before @prefix */
+  while (lo < hi)
+    {
+      guint mid = (lo + hi) / 2;
+
+      if (strcmp (g_ptr_array_index (sorted_words, mid), prefix) < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  for (i = lo; i < sorted_words->len; i++)
+    {
+      const gchar *word = g_ptr_array_index (sorted_words, i);
+      GArray *postings;
+
+      if (strncmp (word, prefix, len) != 0)
+        break;
+
+      postings = g_hash_table_lookup (self->priv->words, word);
+
+      for (j = 0; j < postings->len; j++)
+        {
+          gpointer key = GUINT_TO_POINTER (
+              g_array_index (postings, guint32, j) + 1);
+
+          g_hash_table_insert (matches, key, key);
+        }
+    }
+
+  return matches;
+}
+
+static gboolean
+log_index_not_in_set (gpointer key,
+    gpointer value,
+    gpointer user_data)
+{
+  GHashTable *set = user_data;
+
+  return g_hash_table_lookup (set, key) == NULL;
+}
+
+/**
+ * empathy_log_index_search:
+ * @self: a #EmpathyLogIndex
+ * @query: the searched text
+ *
+ * Returns: (transfer full): a list of #EmpathyLogIndexHit for the
+ * conversations containing, for each word of @query, a word starting with
+ * it. Free with empathy_log_index_search_free().
+ */
+GList *
+empathy_log_index_search (EmpathyLogIndex *self,
+    const gchar *query)
+{
+  GPtrArray *terms;
+  GHashTable *result = NULL;
+  GHashTableIter iter;
+  gpointer key;
+  GList *hits = NULL;
+  guint i;
+
+  g_return_val_if_fail (EMPATHY_IS_LOG_INDEX (self), NULL);
+
+  if (EMP_STR_EMPTY (query))
+    return NULL;
+
+  if (!self->priv->words_sorted)
+    {
+      g_ptr_array_sort (self->priv->sorted_words, log_index_compare_words);
+      self->priv->words_sorted = TRUE;
+    }
+
+  terms = log_index_tokenize (query, 1);
+
+  for (i = 0; i < terms->len; i++)
+    {
+      GHashTable *matches;
+
+      matches = log_index_match_prefix (self, g_ptr_array_index (terms, i));
+
+      if (result == NULL)
+        {
+          result = matches;
+        }
+      else
+        {
+          g_hash_table_foreach_remove (result, log_index_not_in_set, matches);
+          g_hash_table_unref (matches);
+        }
+
+      if (g_hash_table_size (result) == 0)
+        break;
+    }
+
+  g_ptr_array_unref (terms);
+
+  if (result == NULL)
+    return NULL;
+
+  g_hash_table_iter_init (&iter, result);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+      LogIndexDoc *doc;
+      EmpathyLogIndexHit *hit;
+
+      doc = g_ptr_array_index (self->priv->docs, GPOINTER_TO_UINT (key) - 1);
+
+      hit = g_slice_new0 (EmpathyLogIndexHit);
+      hit->account_path = g_strdup (doc->account_path);
+      hit->entity_id = g_strdup (doc->entity_id);
+      hit->entity_type = doc->entity_type;
+      hit->alias = g_strdup (doc->alias);
+      hit->date = g_date_new_julian (doc->julian);
+
+      hits = g_list_prepend (hits, hit);
+    }
+
+  g_hash_table_unref (result);
+
+  return hits;
+}
+
+void
+empathy_log_index_hit_free (EmpathyLogIndexHit *hit)
+{
+  g_free (hit->account_path);
+  g_free (hit->entity_id);
+  g_free (hit->alias);
+  g_date_free (hit->date);
+  g_slice_free (EmpathyLogIndexHit, hit);
+}
+
+void
+empathy_log_index_search_free (GList *hits)
+{
+  g_list_free_full (hits, (GDestroyNotify) empathy_log_index_hit_free);
+}
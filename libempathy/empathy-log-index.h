@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __EMPATHY_LOG_INDEX_H__
+#define __EMPATHY_LOG_INDEX_H__
+
+#include <glib-object.h>
+
+#include <telepathy-logger/entity.h>
+
+G_BEGIN_DECLS
+#define EMPATHY_TYPE_LOG_INDEX         (empathy_log_index_get_type ())
+#define EMPATHY_LOG_INDEX(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), EMPATHY_TYPE_LOG_INDEX, EmpathyLogIndex))
+#define EMPATHY_LOG_INDEX_CLASS(k)     (G_TYPE_CHECK_CLASS_CAST((k), EMPATHY_TYPE_LOG_INDEX, EmpathyLogIndexClass))
+#define EMPATHY_IS_LOG_INDEX(o)        (G_TYPE_CHECK_INSTANCE_TYPE ((o), EMPATHY_TYPE_LOG_INDEX))
+#define EMPATHY_IS_LOG_INDEX_CLASS(k)  (G_TYPE_CHECK_CLASS_TYPE ((k), EMPATHY_TYPE_LOG_INDEX))
+#define EMPATHY_LOG_INDEX_GET_CLASS(o) (G_TYPE_INSTANCE_GET_CLASS ((o), EMPATHY_TYPE_LOG_INDEX, EmpathyLogIndexClass))
+
+typedef struct _EmpathyLogIndex EmpathyLogIndex;
+typedef struct _EmpathyLogIndexClass EmpathyLogIndexClass;
+typedef struct _EmpathyLogIndexPrivate EmpathyLogIndexPrivate;
+
+struct _EmpathyLogIndex
+{
+  GObject parent;
+  EmpathyLogIndexPrivate *priv;
+};
+
+struct _EmpathyLogIndexClass
+{
+  GObjectClass parent_class;
+};
+
+/* One conversation (account, entity, date) containing all the searched
+ * words */
+typedef struct
+{
+  gchar *account_path;
+  gchar *entity_id;
+  TplEntityType entity_type;
+  /* may be NULL */
+  gchar *alias;
+  GDate *date;
+} EmpathyLogIndexHit;
+
+GType empathy_log_index_get_type (void) G_GNUC_CONST;
+
+EmpathyLogIndex *empathy_log_index_dup_singleton (void);
+EmpathyLogIndex *empathy_log_index_new (const gchar *file);
+
+gboolean empathy_log_index_is_ready (EmpathyLogIndex *self);
+
+void empathy_log_index_add_text (EmpathyLogIndex *self,
+    const gchar *account_path,
+    const gchar *entity_id,
+    TplEntityType entity_type,
+    const gchar *alias,
+    const GDate *date,
+    const gchar *text);
+
+GList *empathy_log_index_search (EmpathyLogIndex *self,
+    const gchar *query);
+
+gboolean empathy_log_index_save (EmpathyLogIndex *self,
+    GError **error);
+
+void empathy_log_index_hit_free (EmpathyLogIndexHit *hit);
+void empathy_log_index_search_free (GList *hits);
+
+G_END_DECLS
+#endif /* __EMPATHY_LOG_INDEX_H__ */
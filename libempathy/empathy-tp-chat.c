@@ -41,12 +41,21 @@ struct _EmpathyTpChatPrivate {
 	TpAccount             *account;
 	EmpathyContact        *user;
 	EmpathyContact        *remote_contact;
-	GList                 *members;
+	/* TpHandle -> owned EmpathyContact */
+	GHashTable            *members;
 	/* Queue of messages not signalled yet */
 	GQueue                *messages_queue;
 	/* Queue of messages signalled but not acked yet */
 	GQueue                *pending_messages_queue;
 
+	/* TpHandle -> owned EmpathyContact, senders which are not members */
+	GHashTable            *senders;
+	/* Set of the TpHandle of the senders being requested */
+	GHashTable            *requested_senders;
+	/* TpHandle of the senders to request on the next idle */
+	GArray                *senders_to_request;
+	guint                  request_senders_id;
+
 	/* Subject */
 	gboolean               supports_subject;
 	gboolean               can_set_subject;
@@ -66,6 +75,8 @@ struct _EmpathyTpChatPrivate {
 };
 
 static void tp_chat_iface_init         (EmpathyContactListIface *iface);
+static void tp_chat_request_sender     (EmpathyTpChat           *self,
+					TpHandle                 handle);
 
 enum {
 	PROP_0,
@@ -82,6 +93,7 @@ enum {
 	SEND_ERROR,
 	CHAT_STATE_CHANGED,
 	MESSAGE_ACKNOWLEDGED,
+	MEMBERS_CHANGED_BATCH,
 	LAST_SIGNAL
 };
 
@@ -237,8 +249,8 @@ tp_chat_get_members (EmpathyContactList *list)
 
 	g_return_val_if_fail (EMPATHY_IS_TP_CHAT (list), NULL);
 
-	if (self->priv->members) {
-		members = g_list_copy (self->priv->members);
+	if (g_hash_table_size (self->priv->members) > 0) {
+		members = g_hash_table_get_values (self->priv->members);
 		g_list_foreach (members, (GFunc) g_object_ref, NULL);
 	} else {
 		members = g_list_prepend (members, g_object_ref (self->priv->user));
@@ -264,6 +276,37 @@ check_ready (EmpathyTpChat *self)
 	tp_clear_object (&self->priv->ready_result);
 }
 
+static TpHandle
+tp_chat_get_sender_handle (EmpathyMessage *message)
+{
+	return tp_contact_get_handle (tp_signalled_message_get_sender (
+		empathy_message_get_tp_message (message)));
+}
+
+/* Returns the contact of @handle if we already know it, without ref */
+static EmpathyContact *
+tp_chat_lookup_sender (EmpathyTpChat *self,
+		       TpHandle       handle)
+{
+	EmpathyContact *contact;
+
+	if (self->priv->user != NULL &&
+	    empathy_contact_get_handle (self->priv->user) == handle)
+		return self->priv->user;
+
+	if (self->priv->remote_contact != NULL &&
+	    empathy_contact_get_handle (self->priv->remote_contact) == handle)
+		return self->priv->remote_contact;
+
+	contact = g_hash_table_lookup (self->priv->members,
+				       GUINT_TO_POINTER (handle));
+	if (contact != NULL)
+		return contact;
+
+	return g_hash_table_lookup (self->priv->senders,
+				    GUINT_TO_POINTER (handle));
+}
+
 static void
 tp_chat_emit_queued_messages (EmpathyTpChat *self)
 {
@@ -272,7 +315,20 @@ tp_chat_emit_queued_messages (EmpathyTpChat *self)
 	/* Check if we can now emit some queued messages */
 	while ((message = g_queue_peek_head (self->priv->messages_queue)) != NULL) {
 		if (empathy_message_get_sender (message) == NULL) {
-			break;
+			EmpathyContact *sender;
+			TpHandle        handle;
+
+			handle = tp_chat_get_sender_handle (message);
+			sender = tp_chat_lookup_sender (self, handle);
+			if (sender == NULL) {
+				/* The sender may have left the members since
+				 * the message was queued, make sure it is
+				 * still being requested */
+				tp_chat_request_sender (self, handle);
+				break;
+			}
+
+			empathy_message_set_sender (message, sender);
 		}
 
 		DEBUG ("Queued message ready");
@@ -285,23 +341,105 @@ tp_chat_emit_queued_messages (EmpathyTpChat *self)
 }
 
 static void
-tp_chat_got_sender_cb (TpConnection            *connection,
-		       EmpathyContact          *contact,
-		       const GError            *error,
-		       gpointer                 message,
-		       GObject                 *chat)
+tp_chat_drop_messages_from (EmpathyTpChat *self,
+			    TpHandle       handle)
+{
+	GList *l, *next;
+
+	for (l = self->priv->messages_queue->head; l != NULL; l = next) {
+		EmpathyMessage *message = l->data;
+
+		next = l->next;
+
+		if (empathy_message_get_sender (message) == NULL &&
+		    tp_chat_get_sender_handle (message) == handle) {
+			g_queue_delete_link (self->priv->messages_queue, l);
+			g_object_unref (message);
+		}
+	}
+}
+
+static void
+tp_chat_got_senders_cb (TpConnection            *connection,
+			guint                    n_contacts,
+			EmpathyContact * const * contacts,
+			guint                    n_failed,
+			const TpHandle          *failed,
+			const GError            *error,
+			gpointer                 user_data,
+			GObject                 *chat)
 {
 	EmpathyTpChat *self = (EmpathyTpChat *) chat;
+	GArray *handles = user_data;
+	guint i;
 
 	if (error) {
 		DEBUG ("Error: %s", error->message);
-		/* Do not block the message queue, just drop this message */
-		g_queue_remove (self->priv->messages_queue, message);
-	} else {
-		empathy_message_set_sender (message, contact);
 	}
 
-	tp_chat_emit_queued_messages (EMPATHY_TP_CHAT (self));
+	for (i = 0; i < n_contacts; i++) {
+		g_hash_table_insert (self->priv->senders,
+			GUINT_TO_POINTER (empathy_contact_get_handle (contacts[i])),
+			g_object_ref (contacts[i]));
+	}
+
+	for (i = 0; i < handles->len; i++) {
+		TpHandle handle = g_array_index (handles, TpHandle, i);
+
+		g_hash_table_remove (self->priv->requested_senders,
+				     GUINT_TO_POINTER (handle));
+
+		/* Do not block the message queue, just drop the messages of
+		 * this sender */
+		if (tp_chat_lookup_sender (self, handle) == NULL) {
+			DEBUG ("Failed to get sender %u, dropping its messages",
+			       handle);
+			tp_chat_drop_messages_from (self, handle);
+		}
+	}
+
+	tp_chat_emit_queued_messages (self);
+}
+
+static gboolean
+tp_chat_request_senders_cb (gpointer user_data)
+{
+	EmpathyTpChat *self = user_data;
+	GArray *handles = self->priv->senders_to_request;
+
+	self->priv->request_senders_id = 0;
+	self->priv->senders_to_request = g_array_new (FALSE, FALSE,
+		sizeof (TpHandle));
+
+	DEBUG ("Requesting %u senders", handles->len);
+
+	empathy_tp_contact_factory_get_from_handles (
+		tp_channel_borrow_connection ((TpChannel *) self),
+		handles->len, (TpHandle *) handles->data,
+		tp_chat_got_senders_cb,
+		handles, (GDestroyNotify) g_array_unref, G_OBJECT (self));
+
+	return FALSE;
+}
+
+/* The senders of the messages received during a main loop iteration are
+ * requested at once */
+static void
+tp_chat_request_sender (EmpathyTpChat *self,
+			TpHandle       handle)
+{
+	if (g_hash_table_lookup (self->priv->requested_senders,
+				 GUINT_TO_POINTER (handle)) != NULL)
+		return;
+
+	g_hash_table_insert (self->priv->requested_senders,
+			     GUINT_TO_POINTER (handle), GUINT_TO_POINTER (TRUE));
+	g_array_append_val (self->priv->senders_to_request, handle);
+
+	if (self->priv->request_senders_id == 0) {
+		self->priv->request_senders_id = g_idle_add (
+			tp_chat_request_senders_cb, self);
+	}
 }
 
 static void
@@ -311,6 +449,8 @@ tp_chat_build_message (EmpathyTpChat *self,
 {
 	EmpathyMessage    *message;
 	TpContact *sender;
+	EmpathyContact *contact;
+	TpHandle handle;
 
 	message = empathy_message_new_from_tp_message (msg, incoming);
 	/* FIXME: this is actually a lie for incoming messages. */
@@ -320,19 +460,21 @@ tp_chat_build_message (EmpathyTpChat *self,
 
 	sender = tp_signalled_message_get_sender (msg);
 	g_assert (sender != NULL);
+	handle = tp_contact_get_handle (sender);
 
-	if (tp_contact_get_handle (sender) == 0) {
+	if (handle == 0) {
 		empathy_message_set_sender (message, self->priv->user);
-		tp_chat_emit_queued_messages (self);
+	} else if ((contact = tp_chat_lookup_sender (self, handle)) != NULL) {
+		/* Set it now, the sender could leave the members while older
+		 * messages are waiting for theirs */
+		empathy_message_set_sender (message, contact);
 	} else {
-		TpConnection *connection = tp_channel_borrow_connection (
-			(TpChannel *) self);
-
-		empathy_tp_contact_factory_get_from_handle (connection,
-			tp_contact_get_handle (sender),
-			tp_chat_got_sender_cb,
-			message, NULL, G_OBJECT (self));
+		tp_chat_request_sender (self, handle);
 	}
+
+	/* Messages from known senders are emitted right away, unless older
+	 * ones are still waiting for theirs */
+	tp_chat_emit_queued_messages (self);
 }
 
 static void
@@ -765,6 +907,14 @@ tp_chat_dispose (GObject *object)
 	tp_clear_object (&self->priv->remote_contact);
 	tp_clear_object (&self->priv->user);
 
+	g_hash_table_remove_all (self->priv->members);
+	g_hash_table_remove_all (self->priv->senders);
+
+	if (self->priv->request_senders_id != 0) {
+		g_source_remove (self->priv->request_senders_id);
+		self->priv->request_senders_id = 0;
+	}
+
 	g_queue_foreach (self->priv->messages_queue, (GFunc) g_object_unref, NULL);
 	g_queue_clear (self->priv->messages_queue);
 
@@ -788,6 +938,10 @@ tp_chat_finalize (GObject *object)
 	g_queue_free (self->priv->messages_queue);
 	g_queue_free (self->priv->pending_messages_queue);
 	g_hash_table_unref (self->priv->messages_being_sent);
+	g_hash_table_unref (self->priv->members);
+	g_hash_table_unref (self->priv->senders);
+	g_hash_table_unref (self->priv->requested_senders);
+	g_array_unref (self->priv->senders_to_request);
 
 	g_free (self->priv->title);
 	g_free (self->priv->subject);
@@ -810,7 +964,7 @@ check_almost_ready (EmpathyTpChat *self)
 	/* We need either the members (room) or the remote contact (private chat).
 	 * If the chat is protected by a password we can't get these information so
 	 * consider the chat as ready so it can be presented to the user. */
-	if (!tp_channel_password_needed (channel) && self->priv->members == NULL &&
+	if (!tp_channel_password_needed (channel) && g_hash_table_size (self->priv->members) == 0 &&
 	    self->priv->remote_contact == NULL)
 		return;
 
@@ -848,26 +1002,39 @@ tp_chat_got_added_contacts_cb (TpConnection            *connection,
 	const TpIntSet *members;
 	TpHandle handle;
 	EmpathyContact *contact;
+	GPtrArray *added;
 
 	if (error) {
 		DEBUG ("Error: %s", error->message);
 		return;
 	}
 
+	added = g_ptr_array_sized_new (n_contacts);
+
 	members = tp_channel_group_get_members ((TpChannel *) self);
 	for (i = 0; i < n_contacts; i++) {
 		contact = contacts[i];
 		handle = empathy_contact_get_handle (contact);
 
-		/* Make sure the contact is still member */
-		if (tp_intset_is_member (members, handle)) {
-			self->priv->members = g_list_prepend (self->priv->members,
-				g_object_ref (contact));
+		/* Make sure the contact is still member, and not added twice */
+		if (tp_intset_is_member (members, handle) &&
+		    g_hash_table_lookup (self->priv->members,
+					 GUINT_TO_POINTER (handle)) == NULL) {
+			g_hash_table_insert (self->priv->members,
+				GUINT_TO_POINTER (handle), g_object_ref (contact));
+			g_ptr_array_add (added, contact);
 			g_signal_emit_by_name (chat, "members-changed",
 					       contact, NULL, 0, NULL, TRUE);
 		}
 	}
 
+	if (added->len > 0) {
+		g_signal_emit (self, signals[MEMBERS_CHANGED_BATCH], 0,
+			       added, NULL, NULL, 0, NULL);
+	}
+
+	g_ptr_array_unref (added);
+
 	check_almost_ready (EMPATHY_TP_CHAT (chat));
 }
 
@@ -876,26 +1043,21 @@ chat_lookup_contact (EmpathyTpChat *self,
 		     TpHandle       handle,
 		     gboolean       remove_)
 {
-	GList *l;
-
-	for (l = self->priv->members; l; l = l->next) {
-		EmpathyContact *c = l->data;
+	EmpathyContact *c;
 
-		if (empathy_contact_get_handle (c) != handle) {
-			continue;
-		}
-
-		if (remove_) {
-			/* Caller takes the reference. */
-			self->priv->members = g_list_delete_link (self->priv->members, l);
-		} else {
-			g_object_ref (c);
-		}
+	c = g_hash_table_lookup (self->priv->members, GUINT_TO_POINTER (handle));
+	if (c == NULL) {
+		return NULL;
+	}
 
-		return c;
+	/* Caller takes the reference. */
+	if (remove_) {
+		g_hash_table_steal (self->priv->members, GUINT_TO_POINTER (handle));
+	} else {
+		g_object_ref (c);
 	}
 
-	return NULL;
+	return c;
 }
 
 typedef struct
@@ -958,8 +1120,8 @@ tp_chat_got_renamed_contacts_cb (TpConnection            *connection,
 
 	/* Make sure the contact is still member */
 	if (tp_intset_is_member (members, handle)) {
-		self->priv->members = g_list_prepend (self->priv->members,
-			g_object_ref (new));
+		g_hash_table_insert (self->priv->members,
+			GUINT_TO_POINTER (handle), g_object_ref (new));
 
 		if (old != NULL) {
 			g_signal_emit_by_name (self, "member-renamed",
@@ -993,6 +1155,7 @@ tp_chat_group_members_changed_cb (TpChannel     *channel,
 {
 	EmpathyContact *contact;
 	EmpathyContact *actor_contact = NULL;
+	GPtrArray *removed_contacts;
 	guint i;
 	ContactRenameData *rename_data;
 	TpHandle old_handle;
@@ -1031,6 +1194,7 @@ tp_chat_group_members_changed_cb (TpChannel     *channel,
 	}
 
 	/* Remove contacts that are not members anymore */
+	removed_contacts = g_ptr_array_new_with_free_func (g_object_unref);
 	for (i = 0; i < removed->len; i++) {
 		contact = chat_lookup_contact (self,
 			g_array_index (removed, TpHandle, i), TRUE);
@@ -1039,10 +1203,18 @@ tp_chat_group_members_changed_cb (TpChannel     *channel,
 			g_signal_emit_by_name (self, "members-changed", contact,
 					       actor_contact, reason, message,
 					       FALSE);
-			g_object_unref (contact);
+			g_ptr_array_add (removed_contacts, contact);
 		}
 	}
 
+	if (removed_contacts->len > 0) {
+		g_signal_emit (self, signals[MEMBERS_CHANGED_BATCH], 0,
+			       NULL, removed_contacts, actor_contact, reason,
+			       message);
+	}
+
+	g_ptr_array_unref (removed_contacts);
+
 	/* Request added contacts */
 	if (added->len > 0) {
 		empathy_tp_contact_factory_get_from_handles (connection,
@@ -1289,6 +1461,20 @@ empathy_tp_chat_class_init (EmpathyTpChatClass *klass)
 			      G_TYPE_NONE,
 			      1, EMPATHY_TYPE_MESSAGE);
 
+	/* Emitted once for all the contacts joining or leaving the room at the
+	 * same time, after the "members-changed" signal of each of them. The
+	 * GPtrArrays of EmpathyContact may be NULL. */
+	signals[MEMBERS_CHANGED_BATCH] =
+		g_signal_new ("members-changed-batch",
+			      G_TYPE_FROM_CLASS (klass),
+			      G_SIGNAL_RUN_LAST,
+			      0,
+			      NULL, NULL,
+			      g_cclosure_marshal_generic,
+			      G_TYPE_NONE,
+			      5, G_TYPE_PTR_ARRAY, G_TYPE_PTR_ARRAY,
+			      EMPATHY_TYPE_CONTACT, G_TYPE_UINT, G_TYPE_STRING);
+
 	g_type_class_add_private (object_class, sizeof (EmpathyTpChatPrivate));
 }
 
@@ -1302,6 +1488,13 @@ empathy_tp_chat_init (EmpathyTpChat *self)
 	self->priv->pending_messages_queue = g_queue_new ();
 	self->priv->messages_being_sent = g_hash_table_new_full (
 		g_str_hash, g_str_equal, g_free, NULL);
+	self->priv->members = g_hash_table_new_full (NULL, NULL, NULL,
+		g_object_unref);
+	self->priv->senders = g_hash_table_new_full (NULL, NULL, NULL,
+		g_object_unref);
+	self->priv->requested_senders = g_hash_table_new (NULL, NULL);
+	self->priv->senders_to_request = g_array_new (FALSE, FALSE,
+		sizeof (TpHandle));
 }
 
 static void
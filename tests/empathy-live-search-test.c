@@ -16,38 +16,39 @@ typedef struct
   gboolean should_match;
 } LiveSearchTest;
 
+static LiveSearchTest tests[] =
+{
+  /* Test word separators and case */
+  { "Hello World", "he", TRUE },
+  { "Hello World", "wo", TRUE },
+  { "Hello World", "lo", FALSE },
+  { "Hello World", "ld", FALSE },
+  { "Hello-World", "wo", TRUE },
+  { "HelloWorld", "wo", FALSE },
+
+  /* Test composed chars (accentued letters) */
+  { "Jörgen", "jor", TRUE },
+  { "Gaëtan", "gaetan", TRUE },
+  { "élève", "ele", TRUE },
+  { "Azais", "AzaÏs", TRUE },
+
+  /* Test decomposed chars, they looks the same, but are actually
+   * composed of multiple unicodes */
+  { "Jorgen", "Jör", TRUE },
+  { "Jörgen", "jor", TRUE },
+
+  /* Multi words */
+  { "Xavier Claessens", "Xav Cla", TRUE },
+  { "Xavier Claessens", "Cla Xav", TRUE },
+  { "Foo Bar Baz", "   b  ", TRUE },
+  { "Foo Bar Baz", "bar bazz", FALSE },
+
+  { NULL, NULL, FALSE }
+};
+
 static void
 test_live_search (void)
 {
-  LiveSearchTest tests[] =
-    {
-      /* Test word separators and case */
-      { "Hello World", "he", TRUE },
-      { "Hello World", "wo", TRUE },
-      { "Hello World", "lo", FALSE },
-      { "Hello World", "ld", FALSE },
-      { "Hello-World", "wo", TRUE },
-      { "HelloWorld", "wo", FALSE },
-
-      /* Test composed chars (accentued letters) */
-      { "Jörgen", "jor", TRUE },
-      { "Gaëtan", "gaetan", TRUE },
-      { "élève", "ele", TRUE },
-      { "Azais", "AzaÏs", TRUE },
-
-      /* Test decomposed chars, they looks the same, but are actually
-       * composed of multiple unicodes */
-      { "Jorgen", "Jör", TRUE },
-      { "Jörgen", "jor", TRUE },
-
-      /* Multi words */
-      { "Xavier Claessens", "Xav Cla", TRUE },
-      { "Xavier Claessens", "Cla Xav", TRUE },
-      { "Foo Bar Baz", "   b  ", TRUE },
-      { "Foo Bar Baz", "bar bazz", FALSE },
-
-      { NULL, NULL, FALSE }
-    };
   guint i;
 
   DEBUG ("Started");
@@ -67,6 +68,42 @@ test_live_search (void)
     }
 }
 
+static void
+test_live_search_key (void)
+{
+  EmpathyLiveSearchKey *key;
+  guint i;
+
+  for (i = 0; tests[i].string != NULL; i ++)
+    {
+      GPtrArray *words;
+      gboolean match;
+
+      key = empathy_live_search_key_new (tests[i].string, -1);
+      words = empathy_live_search_strip_utf8_string (tests[i].prefix);
+      match = empathy_live_search_key_match (key, words);
+
+      DEBUG ("key '%s' - '%s' %s: %s", tests[i].string, tests[i].prefix,
+          tests[i].should_match ? "should match" : "should NOT match",
+          match == tests[i].should_match ? "OK" : "FAILED");
+
+      g_assert (match == tests[i].should_match);
+
+      if (words != NULL)
+        g_ptr_array_unref (words);
+      empathy_live_search_key_free (key);
+    }
+
+  /* Updating a key only re-strips it if the string changed */
+  key = empathy_live_search_key_new ("Hello World", -1);
+  g_assert (!empathy_live_search_key_update (key, "Hello World", -1));
+  g_assert (!empathy_live_search_key_update (key, "Hello World@server", 11));
+  g_assert (empathy_live_search_key_update (key, "Goodbye", -1));
+  g_assert (empathy_live_search_key_update (key, NULL, -1));
+  g_assert (empathy_live_search_key_match (key, NULL));
+  empathy_live_search_key_free (key);
+}
+
 int
 main (int argc,
     char **argv)
@@ -76,6 +113,7 @@ main (int argc,
   test_init (argc, argv);
 
   g_test_add_func ("/live-search", test_live_search);
+  g_test_add_func ("/live-search/key", test_live_search_key);
 
   result = g_test_run ();
   test_deinit ();
@@ -0,0 +1,149 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <glib/gstdio.h>
+
+#include "test-helper.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_TESTS
+#include <libempathy/empathy-debug.h>
+
+#include <libempathy/empathy-log-index.h>
+
+#define ACCOUNT "/org/freedesktop/Telepathy/Account/gabble/jabber/me"
+
+static gint
+compare_strings (gconstpointer a,
+    gconstpointer b)
+{
+  return strcmp (*(const gchar **) a, *(const gchar **) b);
+}
+
+/* Returns the sorted, comma separated entity ids of the hits of @query */
+static gchar *
+search (EmpathyLogIndex *index,
+    const gchar *query)
+{
+  GList *hits, *l;
+  GPtrArray *ids;
+  gchar *result;
+
+  hits = empathy_log_index_search (index, query);
+  ids = g_ptr_array_new ();
+
+  for (l = hits; l != NULL; l = l->next)
+    {
+      EmpathyLogIndexHit *hit = l->data;
+
+      g_assert_cmpstr (hit->account_path, ==, ACCOUNT);
+      g_ptr_array_add (ids, hit->entity_id);
+    }
+
+  g_ptr_array_sort (ids, compare_strings);
+  g_ptr_array_add (ids, NULL);
+  result = g_strjoinv (",", (gchar **) ids->pdata);
+
+  g_ptr_array_free (ids, TRUE);
+  empathy_log_index_search_free (hits);
+
+  return result;
+}
+
+static void
+fill_index (EmpathyLogIndex *index)
+{
+  GDate *date;
+
+  date = g_date_new_dmy (14, 2, 2012);
+  empathy_log_index_add_text (index, ACCOUNT, "alice@example.com",
+      TPL_ENTITY_CONTACT, "Alice", date, "Hello World, cet été !");
+  empathy_log_index_add_text (index, ACCOUNT, "bob@example.com",
+      TPL_ENTITY_CONTACT, "Bob", date, "hello there");
+  g_date_free (date);
+
+  /* Same contact, other day */
+  date = g_date_new_dmy (15, 2, 2012);
+  empathy_log_index_add_text (index, ACCOUNT, "bob@example.com",
+      TPL_ENTITY_CONTACT, "Bob", date, "worldwide");
+  g_date_free (date);
+}
+
+static void
+check_index (EmpathyLogIndex *index)
+{
+  const gchar *tests[] =
+    {
+      "hello", "alice@example.com,bob@example.com",
+      "HEL", "alice@example.com,bob@example.com",
+      "hello wor", "alice@example.com",
+      "world", "alice@example.com,bob@example.com",
+      "ÉTÉ", "alice@example.com",
+      "there hello", "bob@example.com",
+      "hello nothing", "",
+      "!", "",
+      NULL, NULL
+    };
+  guint i;
+
+  for (i = 0; tests[i] != NULL; i += 2)
+    {
+      gchar *result;
+
+      result = search (index, tests[i]);
+      DEBUG ("'%s' => '%s'", tests[i], result);
+      g_assert_cmpstr (result, ==, tests[i + 1]);
+      g_free (result);
+    }
+}
+
+static void
+test_log_index (void)
+{
+  EmpathyLogIndex *index;
+  GList *hits;
+  EmpathyLogIndexHit *hit;
+  gchar *file;
+
+  file = g_build_filename (g_get_tmp_dir (), "empathy-log-index-test", NULL);
+  g_unlink (file);
+
+  index = empathy_log_index_new (file);
+  fill_index (index);
+  check_index (index);
+
+  hits = empathy_log_index_search (index, "worldw");
+  g_assert_cmpuint (g_list_length (hits), ==, 1);
+  hit = hits->data;
+  g_assert_cmpstr (hit->alias, ==, "Bob");
+  g_assert_cmpuint (hit->entity_type, ==, TPL_ENTITY_CONTACT);
+  g_assert_cmpuint (g_date_get_day (hit->date), ==, 15);
+  empathy_log_index_search_free (hits);
+
+  g_assert (empathy_log_index_save (index, NULL));
+  g_object_unref (index);
+
+  /* The index is the same once reloaded */
+  index = empathy_log_index_new (file);
+  check_index (index);
+  g_object_unref (index);
+
+  g_unlink (file);
+  g_free (file);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  int result;
+
+  test_init (argc, argv);
+
+  g_test_add_func ("/log-index", test_log_index);
+
+  result = g_test_run ();
+  test_deinit ();
+
+  return result;
+}
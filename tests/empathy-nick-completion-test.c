@@ -0,0 +1,145 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "test-helper.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_TESTS
+#include <libempathy/empathy-debug.h>
+
+#include <libempathy-gtk/empathy-nick-completion.h>
+
+/* Returns the aliases of the contacts completing @prefix, separated by
+ * commas, followed by the completed text between brackets */
+static gchar *
+complete (EmpathyNickCompletion *completion,
+    const gchar *prefix)
+{
+  GString *string;
+  GList *contacts, *l;
+  gchar *completed;
+
+  string = g_string_new (NULL);
+  contacts = empathy_nick_completion_complete (completion, prefix,
+      &completed);
+
+  for (l = contacts; l != NULL; l = l->next)
+    {
+      if (l != contacts)
+        g_string_append_c (string, ',');
+
+      g_string_append (string, empathy_contact_get_alias (l->data));
+    }
+
+  g_string_append_printf (string, " [%s]", completed != NULL ? completed : "");
+
+  g_list_free (contacts);
+  g_free (completed);
+
+  return g_string_free (string, FALSE);
+}
+
+static EmpathyContact *
+contact_new (const gchar *alias)
+{
+  return g_object_new (EMPATHY_TYPE_CONTACT,
+      "id", alias,
+      "alias", alias,
+      NULL);
+}
+
+static void
+check (EmpathyNickCompletion *completion,
+    const gchar *prefix,
+    const gchar *expected)
+{
+  gchar *result;
+
+  result = complete (completion, prefix);
+  DEBUG ("'%s' => '%s'", prefix, result);
+  g_assert_cmpstr (result, ==, expected);
+  g_free (result);
+}
+
+static void
+test_nick_completion (void)
+{
+  EmpathyNickCompletion *completion;
+  EmpathyContact *alice, *alicia, *bob, *bobbie, *bobby, *eve;
+  EmpathyContact *andre, *andrea;
+
+  completion = empathy_nick_completion_new ();
+
+  alice = contact_new ("Alice");
+  alicia = contact_new ("alicia");
+  bob = contact_new ("Bob");
+  eve = contact_new ("Ève");
+
+  empathy_nick_completion_add (completion, alice);
+  empathy_nick_completion_add (completion, alicia);
+  empathy_nick_completion_add (completion, bob);
+  empathy_nick_completion_add (completion, eve);
+  /* Adding twice is harmless */
+  empathy_nick_completion_add (completion, bob);
+
+  check (completion, "b", "Bob [Bob]");
+  check (completion, "ALI", "Alice,alicia [Alic]");
+  check (completion, "alicI", "alicia [alicia]");
+  check (completion, "ève", "Ève [Ève]");
+  check (completion, "x", " []");
+
+  /* Recent speakers come first */
+  empathy_nick_completion_spoke (completion, alicia);
+  check (completion, "al", "alicia,Alice [alic]");
+
+  /* Alias changes are followed */
+  empathy_contact_set_alias (alice, "Carol");
+  check (completion, "al", "alicia [alicia]");
+  check (completion, "c", "Carol [Carol]");
+
+  /* Renamed members keep their rank */
+  bobbie = contact_new ("Bobbie");
+  bobby = contact_new ("Bobby");
+  empathy_nick_completion_add (completion, bobbie);
+  empathy_nick_completion_spoke (completion, bob);
+  empathy_nick_completion_rename (completion, bob, bobby);
+  check (completion, "bob", "Bobby,Bobbie [Bobb]");
+
+  empathy_nick_completion_remove (completion, alicia);
+  check (completion, "al", " []");
+
+  /* The common beginning of accented nicks stops before the accent */
+  andre = contact_new ("André");
+  andrea = contact_new ("Andrea");
+  empathy_nick_completion_add (completion, andre);
+  empathy_nick_completion_add (completion, andrea);
+  check (completion, "and", "Andrea,André [Andr]");
+  check (completion, "andré", "André [André]");
+
+  empathy_nick_completion_free (completion);
+
+  g_object_unref (alice);
+  g_object_unref (alicia);
+  g_object_unref (bob);
+  g_object_unref (bobbie);
+  g_object_unref (bobby);
+  g_object_unref (eve);
+  g_object_unref (andre);
+  g_object_unref (andrea);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  int result;
+
+  test_init (argc, argv);
+
+  g_test_add_func ("/nick-completion", test_nick_completion);
+
+  result = g_test_run ();
+  test_deinit ();
+
+  return result;
+}
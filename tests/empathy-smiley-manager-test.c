@@ -0,0 +1,171 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "test-helper.h"
+
+#include <telepathy-glib/util.h>
+
+#define DEBUG_FLAG EMPATHY_DEBUG_TESTS
+#include <libempathy/empathy-debug.h>
+
+#include <libempathy-gtk/empathy-smiley-manager.h>
+
+/* Returns @text with each smiley hit surrounded by brackets */
+static gchar *
+parse_smileys (EmpathySmileyManager *manager,
+    const gchar *text,
+    gssize len)
+{
+  GString *string;
+  GSList *hits, *l;
+  guint last = 0;
+
+  string = g_string_new (NULL);
+  hits = empathy_smiley_manager_parse_len (manager, text, len);
+
+  for (l = hits; l != NULL; l = l->next)
+    {
+      EmpathySmileyHit *hit = l->data;
+
+      g_assert (hit->start >= last);
+      g_assert (hit->end > hit->start);
+
+      g_string_append_len (string, text + last, hit->start - last);
+      g_string_append_c (string, '[');
+      g_string_append_len (string, text + hit->start, hit->end - hit->start);
+      g_string_append_c (string, ']');
+      last = hit->end;
+
+      empathy_smiley_hit_free (hit);
+    }
+
+  if (len < 0)
+    g_string_append (string, text + last);
+  else
+    g_string_append_len (string, text + last, len - last);
+
+  g_slist_free (hits);
+
+  return g_string_free (string, FALSE);
+}
+
+static void
+test_smiley_manager (void)
+{
+  const gchar *tests[] =
+    {
+      /* Basic smileys */
+      "a:)b", "a[:)]b",
+      ":):)", "[:)][:)]",
+      ">:)", "[>:)]",
+      ">:(", ">[:(]",
+      ">>>>>>>:", ">>>>>>>:",
+      ">>>>>>>:)", ">>>>>>[>:)]",
+
+      /* Longest smiley wins when several start at the same position */
+      ":-)", "[:-)]",
+      ":-))", "[:-))]",
+      ":-)))", "[:-))])",
+
+      /* A failed longer smiley falls back to a shorter one */
+      ":-(|)", "[:-(|)]",
+      ":-(|x", "[:-(]|x",
+      "O:-", "O:-",
+      "O:-(", "O[:-(]",
+
+      /* Non-ASCII text around smileys */
+      "été :) ™", "été [:)] ™",
+
+      NULL, NULL
+    };
+  EmpathySmileyManager *manager;
+  guint i;
+
+  manager = empathy_smiley_manager_dup_singleton ();
+
+  for (i = 0; tests[i] != NULL; i += 2)
+    {
+      gchar *result;
+      gboolean ok;
+
+      result = parse_smileys (manager, tests[i], -1);
+      ok = !tp_strdiff (tests[i + 1], result);
+      DEBUG ("'%s' => '%s': %s", tests[i], result, ok ? "OK" : "FAILED");
+      g_assert (ok);
+
+      g_free (result);
+    }
+
+  /* Only the first len bytes are parsed */
+  {
+    gchar *result;
+
+    result = parse_smileys (manager, ":) :-)", 4);
+    g_assert_cmpstr (result, ==, "[:)] :");
+    g_free (result);
+  }
+
+  g_object_unref (manager);
+}
+
+/* Run with "-m perf" */
+static void
+test_smiley_manager_perf (void)
+{
+  const gchar *lines[] =
+    {
+      "[12:01] <alice> did you see http://foo.com/bar?id=42 :)\n",
+      "[12:02] <bob> >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>:\n",
+      "[12:03] <carol> :-:-:-:-:-:-:-:-:-:-:-:-:-:-:-:-:-:-:-:-:-:-:-:-(\n",
+      "[12:04] <dave> O:-O:-O:-O:-O:-O:-O:-O:-O:-O:-O:-O:-O:-O:-O:-O:-)\n",
+      "[12:05] <eve> nothing to see here, just a plain line of text\n",
+      NULL
+    };
+  EmpathySmileyManager *manager;
+  GString *log;
+  GSList *hits;
+  gdouble elapsed;
+  guint i;
+
+  if (!g_test_perf ())
+    return;
+
+  manager = empathy_smiley_manager_dup_singleton ();
+
+  /* Build a pasted log of about 4MB */
+  log = g_string_new (NULL);
+  while (log->len < 4 * 1024 * 1024)
+    for (i = 0; lines[i] != NULL; i++)
+      g_string_append (log, lines[i]);
+
+  g_test_timer_start ();
+  hits = empathy_smiley_manager_parse_len (manager, log->str, log->len);
+  elapsed = g_test_timer_elapsed ();
+
+  g_test_minimized_result (elapsed, "parsed %" G_GSIZE_FORMAT
+      " bytes, %u smileys, in %f seconds", log->len, g_slist_length (hits),
+      elapsed);
+
+  g_slist_foreach (hits, (GFunc) empathy_smiley_hit_free, NULL);
+  g_slist_free (hits);
+  g_string_free (log, TRUE);
+  g_object_unref (manager);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  int result;
+
+  test_init (argc, argv);
+
+  g_test_add_func ("/smiley-manager", test_smiley_manager);
+  g_test_add_func ("/smiley-manager/perf", test_smiley_manager_perf);
+
+  result = g_test_run ();
+  test_deinit ();
+
+  return result;
+}